@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "audio.h"
+
+const char* audio_track_path(int song) {
+    switch (song) {
+        case 1: return "audio/Venom.mp3";
+        case 2: return "audio/Chandelier.mp3";
+        case 3: return "audio/Hello.mp3";
+        default: return "audio/default.mp3";
+    }
+}
+
+#ifdef AUDIO_NULL_BACKEND
+
+// Headless build: no SDL at all, every call is silent
+
+void audio_disable(void) {}
+void audio_start(void) {}
+double audio_open_ms(void) { return -1; }
+bool audio_available(void) { return false; }
+const char* audio_error(void) { return "built without audio"; }
+bool audio_play_song(int song) { (void)song; return true; }
+void audio_stop(void) {}
+void audio_play_effect(SoundEffect effect) { (void)effect; }
+void audio_shutdown(void) {}
+
+#else
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+
+typedef enum {
+    AUDIO_CLOSED,     // Not brought up yet
+    AUDIO_OPEN,
+    AUDIO_SILENT      // Disabled, or no usable device
+} AudioState;
+
+typedef enum {
+    TRACK_UNLOADED,
+    TRACK_LOADING,
+    TRACK_READY,
+    TRACK_FAILED
+} TrackState;
+
+struct MusicTrack {
+    TrackState state;
+    void* data;          // File contents; Mix_Music streams from here
+    size_t size;
+    Mix_Music* music;
+};
+
+static struct MusicTrack tracks[AUDIO_TRACK_COUNT];
+static pthread_mutex_t tracks_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tracks_changed = PTHREAD_COND_INITIALIZER;
+static pthread_t preload_thread;
+static bool preload_started = false;
+static AudioState audio_state = AUDIO_CLOSED;
+
+// Single-producer, single-consumer ring: only the game thread pushes and only
+// the effects thread pops, so the indices need no lock.
+static unsigned char sfx_queue[AUDIO_SFX_QUEUE];
+static unsigned sfx_head = 0;   // Next slot to play; written by the effects thread
+static unsigned sfx_tail = 0;   // Next slot to fill; written by the game thread
+static sem_t sfx_pending;
+static Mix_Chunk* effects[SFX_COUNT];
+static pthread_t sfx_thread;
+static bool sfx_started = false;
+static bool sfx_stopping = false;
+static pthread_t open_thread;
+static bool open_pending = false;   // audio_start() thread not joined yet
+static double open_time_ms = -1;
+
+static const char* effect_path(SoundEffect effect) {
+    switch (effect) {
+        case SFX_HIT: return "audio/sfx/hit.wav";
+        case SFX_GOLD: return "audio/sfx/gold.wav";
+        case SFX_TRAP: return "audio/sfx/trap.wav";
+        case SFX_DOOR: return "audio/sfx/door.wav";
+        case SFX_LEVEL_UP: return "audio/sfx/level_up.wav";
+        default: return "audio/sfx/victory.wav";
+    }
+}
+
+static void* read_whole_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+
+    void* data = length > 0 ? malloc((size_t)length) : NULL;
+    if (data && fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+// Reads and opens one track. Called without the lock held; the caller has
+// marked the track TRACK_LOADING so nobody else touches it meanwhile.
+static void load_track(int song) {
+    struct MusicTrack* track = &tracks[song];
+    size_t size = 0;
+    void* data = read_whole_file(audio_track_path(song), &size);
+    Mix_Music* music = NULL;
+
+    if (data) {
+        SDL_RWops* rw = SDL_RWFromConstMem(data, (int)size);
+        music = rw ? Mix_LoadMUS_RW(rw, 1) : NULL;
+        if (music == NULL) {
+            free(data);
+            data = NULL;
+        }
+    }
+
+    pthread_mutex_lock(&tracks_lock);
+    track->data = data;
+    track->size = size;
+    track->music = music;
+    track->state = music ? TRACK_READY : TRACK_FAILED;
+    pthread_cond_broadcast(&tracks_changed);
+    pthread_mutex_unlock(&tracks_lock);
+}
+
+// Claims a track for loading; false if it is already loaded or in progress
+static bool claim_track(int song) {
+    pthread_mutex_lock(&tracks_lock);
+    bool claimed = tracks[song].state == TRACK_UNLOADED;
+    if (claimed) tracks[song].state = TRACK_LOADING;
+    pthread_mutex_unlock(&tracks_lock);
+    return claimed;
+}
+
+static void* preload_main(void* arg) {
+    (void)arg;
+    for (int song = 0; song < AUDIO_TRACK_COUNT; song++) {
+        if (claim_track(song)) load_track(song);
+    }
+    return NULL;
+}
+
+// Starts loading every track in the background. Needs the mixer to be open.
+static void audio_preload(void) {
+    if (preload_started) return;
+    preload_started = pthread_create(&preload_thread, NULL, preload_main, NULL) == 0;
+}
+
+static void play_chunk(Mix_Chunk* chunk) {
+    if (Mix_PlayChannel(-1, chunk, 0) < 0) {
+        // Every channel is busy: cut off the one that has played longest
+        int oldest = Mix_GroupOldest(-1);
+        if (oldest >= 0) {
+            Mix_HaltChannel(oldest);
+            Mix_PlayChannel(oldest, chunk, 0);
+        }
+    }
+}
+
+// Loads every effect, then plays queued effects until audio_shutdown()
+static void* sfx_main(void* arg) {
+    (void)arg;
+    for (int effect = 0; effect < SFX_COUNT; effect++) {
+        effects[effect] = Mix_LoadWAV(effect_path((SoundEffect)effect));
+    }
+
+    for (;;) {
+        while (sem_wait(&sfx_pending) != 0) {}
+        if (__atomic_load_n(&sfx_stopping, __ATOMIC_ACQUIRE)) break;
+
+        unsigned head = __atomic_load_n(&sfx_head, __ATOMIC_RELAXED);
+        unsigned char effect = sfx_queue[head % AUDIO_SFX_QUEUE];
+        __atomic_store_n(&sfx_head, head + 1, __ATOMIC_RELEASE);
+
+        if (effect < SFX_COUNT && effects[effect]) play_chunk(effects[effect]);
+    }
+    return NULL;
+}
+
+static void start_effects(void) {
+    if (Mix_AllocateChannels(AUDIO_SFX_CHANNELS) < AUDIO_SFX_CHANNELS) return;
+    if (sem_init(&sfx_pending, 0, 0) != 0) return;
+
+    sfx_stopping = false;
+    sfx_head = sfx_tail = 0;
+    bool started = pthread_create(&sfx_thread, NULL, sfx_main, NULL) == 0;
+    if (!started) sem_destroy(&sfx_pending);
+    // Published last: audio_play_effect may be polling from the game thread
+    __atomic_store_n(&sfx_started, started, __ATOMIC_RELEASE);
+}
+
+// Brings up SDL audio and the mixer on first use. A missing device is not an
+// error: audio just stays silent for the rest of the run.
+static bool audio_open(void) {
+    if (audio_state == AUDIO_CLOSED) {
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+            audio_state = AUDIO_SILENT;
+        } else if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
+            SDL_QuitSubSystem(SDL_INIT_AUDIO);
+            audio_state = AUDIO_SILENT;
+        } else {
+            audio_state = AUDIO_OPEN;
+            audio_preload();
+            start_effects();
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        open_time_ms = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+    }
+    return audio_state == AUDIO_OPEN;
+}
+
+static void* open_main(void* arg) {
+    (void)arg;
+    audio_open();
+    return NULL;
+}
+
+// Everything that touches audio_state from the game thread waits here for
+// an open started by audio_start() to finish.
+static void wait_for_open(void) {
+    if (open_pending) {
+        pthread_join(open_thread, NULL);
+        open_pending = false;
+    }
+}
+
+// Opens audio on a background thread so it is ready by the first song
+void audio_start(void) {
+    if (audio_state != AUDIO_CLOSED || open_pending) return;
+    open_pending = pthread_create(&open_thread, NULL, open_main, NULL) == 0;
+}
+
+// How long bringing audio up took, -1 if it has not happened
+double audio_open_ms(void) {
+    wait_for_open();
+    return open_time_ms;
+}
+
+// --no-audio: never touch SDL
+void audio_disable(void) {
+    wait_for_open();
+    if (audio_state == AUDIO_CLOSED) audio_state = AUDIO_SILENT;
+}
+
+bool audio_available(void) {
+    wait_for_open();
+    return audio_open();
+}
+
+const char* audio_error(void) {
+    return Mix_GetError();
+}
+
+// Returns the cached track, loading it here if the preloader has not got to
+// it yet, or waiting if it is loading it right now. NULL if it cannot load.
+static Mix_Music* get_track(int song) {
+    if (claim_track(song)) load_track(song);
+
+    pthread_mutex_lock(&tracks_lock);
+    while (tracks[song].state == TRACK_LOADING) {
+        pthread_cond_wait(&tracks_changed, &tracks_lock);
+    }
+    Mix_Music* music = tracks[song].music;
+    pthread_mutex_unlock(&tracks_lock);
+    return music;
+}
+
+// Plays a song on loop. Returns false only if audio is up but the track
+// cannot be played; silent audio counts as success.
+bool audio_play_song(int song) {
+    wait_for_open();
+    if (!audio_open()) return true;
+    if (song < 0 || song >= AUDIO_TRACK_COUNT) song = 0;
+
+    Mix_Music* music = get_track(song);
+    if (music == NULL) return false;
+
+    if (Mix_PlayingMusic()) {
+        Mix_HaltMusic();
+    }
+    return Mix_PlayMusic(music, -1) == 0;
+}
+
+// Halts playback; the track stays cached
+void audio_stop(void) {
+    wait_for_open();
+    if (audio_state == AUDIO_OPEN && Mix_PlayingMusic()) {
+        Mix_HaltMusic();
+    }
+}
+
+// Queues an effect without waiting on anything. Game thread only.
+void audio_play_effect(SoundEffect effect) {
+    if (!__atomic_load_n(&sfx_started, __ATOMIC_ACQUIRE)) return;
+
+    unsigned tail = __atomic_load_n(&sfx_tail, __ATOMIC_RELAXED);
+    unsigned head = __atomic_load_n(&sfx_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= AUDIO_SFX_QUEUE) return;   // Backed up; drop it
+
+    sfx_queue[tail % AUDIO_SFX_QUEUE] = (unsigned char)effect;
+    __atomic_store_n(&sfx_tail, tail + 1, __ATOMIC_RELEASE);
+    sem_post(&sfx_pending);
+}
+
+static void stop_effects(void) {
+    if (!sfx_started) return;
+
+    __atomic_store_n(&sfx_stopping, true, __ATOMIC_RELEASE);
+    sem_post(&sfx_pending);
+    pthread_join(sfx_thread, NULL);
+    sem_destroy(&sfx_pending);
+    sfx_started = false;
+
+    Mix_HaltChannel(-1);
+    for (int effect = 0; effect < SFX_COUNT; effect++) {
+        if (effects[effect]) Mix_FreeChunk(effects[effect]);
+        effects[effect] = NULL;
+    }
+}
+
+void audio_shutdown(void) {
+    wait_for_open();
+    if (audio_state != AUDIO_OPEN) return;
+
+    audio_stop();
+    stop_effects();
+    if (preload_started) {
+        pthread_join(preload_thread, NULL);
+        preload_started = false;
+    }
+
+    for (int song = 0; song < AUDIO_TRACK_COUNT; song++) {
+        if (tracks[song].music) Mix_FreeMusic(tracks[song].music);
+        free(tracks[song].data);
+        tracks[song].music = NULL;
+        tracks[song].data = NULL;
+        tracks[song].state = TRACK_UNLOADED;
+    }
+
+    Mix_CloseAudio();
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    audio_state = AUDIO_CLOSED;
+}
+
+#endif
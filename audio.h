@@ -0,0 +1,44 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdbool.h>
+
+// Music playback. Audio is brought up lazily by the first song played, or in
+// the background after audio_start(), so startup never waits on SDL; without a usable device (or after
+// audio_disable(), or when built with -DAUDIO_NULL_BACKEND) every call is a
+// silent no-op. Once open, every configured song is read into memory and
+// opened on a background thread, so switching songs never waits on the
+// disk. Tracks stay cached until audio_shutdown().
+//
+// Sound effects are queued by the game thread and played by an audio thread
+// that owns a fixed pool of mixer channels and the preloaded chunks, so
+// triggering one never allocates, reads a file or blocks. Effects queued
+// while audio is not open, or faster than they can be played, are dropped.
+
+#define AUDIO_TRACK_COUNT 4   // Song 0 is the default track, 1-3 the selectable songs
+#define AUDIO_SFX_CHANNELS 8  // Effects playing at once; the oldest is cut off
+#define AUDIO_SFX_QUEUE 64    // Power of two
+
+typedef enum {
+    SFX_HIT,
+    SFX_GOLD,
+    SFX_TRAP,
+    SFX_DOOR,
+    SFX_LEVEL_UP,
+    SFX_VICTORY,
+    SFX_COUNT
+} SoundEffect;
+
+// Function declarations
+const char* audio_track_path(int song);
+void audio_disable(void);
+void audio_start(void);
+double audio_open_ms(void);
+bool audio_available(void);
+const char* audio_error(void);
+bool audio_play_song(int song);
+void audio_stop(void);
+void audio_play_effect(SoundEffect effect);
+void audio_shutdown(void);
+
+#endif
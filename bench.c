@@ -0,0 +1,781 @@
+#include <ncurses.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "game.h"
+#include "users.h"
+#include "compress.h"
+#include "checksum.h"
+#include "json.h"
+#include "userdb.h"
+#include "input.h"
+#include "levels.h"
+
+// Headless benchmarks for the game core. Built with `make bench`.
+// Progress goes to stderr; the results are written as JSON to the file named
+// on the command line (stdout by default):
+//   {"benchmarks": [{"name": ..., "value": ..., "unit": ...}, ...],
+//    "checks": [{"name": ..., "ok": true}, ...]}
+// The exit status is 1 if any check failed. Drawing goes to an ncurses
+// screen on /dev/null, and files are written in a scratch directory.
+
+#define BENCH_LEVELS 64
+#define BENCH_USERS 100000
+#define BENCH_MAPS 200
+#define BENCH_FOV_CALLS 200000
+#define BENCH_ENEMY_TURNS 200000
+#define BENCH_FRAMES 2000
+#define BENCH_SAVES 50
+#define BENCH_SAVED_FLOORS 16   // Floors left behind in each save, enough to spill
+
+static struct JsonWriter results;
+static struct JsonWriter checks;
+static int result_count = 0;
+static int check_count = 0;
+static bool all_checks_ok = true;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* name, double value, const char* unit) {
+    char number[64];
+    snprintf(number, sizeof(number), "%.6g", value);
+
+    json_write_raw(&results, result_count++ ? ",\n  {\"name\": " : "\n  {\"name\": ");
+    json_write_string(&results, name);
+    json_write_raw(&results, ", \"value\": ");
+    json_write_raw(&results, number);
+    json_write_raw(&results, ", \"unit\": ");
+    json_write_string(&results, unit);
+    json_write_raw(&results, "}");
+    fprintf(stderr, "  %-32s %12.3f %s\n", name, value, unit);
+}
+
+static void check(const char* name, bool ok) {
+    json_write_raw(&checks, check_count++ ? ",\n  {\"name\": " : "\n  {\"name\": ");
+    json_write_string(&checks, name);
+    json_write_raw(&checks, ok ? ", \"ok\": true}" : ", \"ok\": false}");
+    fprintf(stderr, "  %-32s %12s\n", name, ok ? "ok" : "FAILED");
+    all_checks_ok &= ok;
+}
+
+// Generates a batch of SavedGame images the way save_current_game fills them
+static struct SavedGame* generate_saves(struct UserManager* manager, int count) {
+    struct SavedGame* saves = calloc(count, sizeof(struct SavedGame));
+    if (!saves) return NULL;
+
+    for (int i = 0; i < count; i++) {
+        int level = 1 + i % 4;
+        saves[i].game_map = generate_map(manager, NULL, level, 5, 0, 0);
+        initialize_player(manager, &saves[i].player, saves[i].game_map.initial_position);
+        saves[i].current_level = level;
+        saves[i].save_time = time(NULL);
+    }
+    return saves;
+}
+
+static void bench_compression(struct UserManager* manager) {
+    struct SavedGame* saves = generate_saves(manager, BENCH_LEVELS);
+    if (!saves) return;
+
+    const size_t raw_size = sizeof(struct SavedGame);
+    const size_t cap = COMPRESS_BOUND(sizeof(struct SavedGame));
+    uint8_t* packed = malloc(cap * BENCH_LEVELS);
+    size_t* packed_sizes = calloc(BENCH_LEVELS, sizeof(size_t));
+    struct SavedGame* restored = malloc(sizeof(struct SavedGame));
+    if (!packed || !packed_sizes || !restored) {
+        free(saves); free(packed); free(packed_sizes); free(restored);
+        return;
+    }
+
+    const int rounds = 20;
+    size_t total_packed = 0;
+
+    double start = now_seconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < BENCH_LEVELS; i++) {
+            packed_sizes[i] = compress_buffer((const uint8_t*)&saves[i], raw_size,
+                                              packed + i * cap, cap);
+        }
+    }
+    double compress_time = now_seconds() - start;
+
+    for (int i = 0; i < BENCH_LEVELS; i++) total_packed += packed_sizes[i];
+
+    bool ok = true;
+    start = now_seconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < BENCH_LEVELS; i++) {
+            if (decompress_buffer(packed + i * cap, packed_sizes[i],
+                                  (uint8_t*)restored, raw_size) != raw_size) {
+                ok = false;
+            }
+        }
+    }
+    double decompress_time = now_seconds() - start;
+
+    for (int i = 0; i < BENCH_LEVELS && ok; i++) {
+        decompress_buffer(packed + i * cap, packed_sizes[i], (uint8_t*)restored, raw_size);
+        ok = memcmp(restored, &saves[i], raw_size) == 0;
+    }
+
+    double megabytes = (double)raw_size * BENCH_LEVELS * rounds / (1024.0 * 1024.0);
+    fprintf(stderr, "compression: %d levels, %zu bytes raw each\n", BENCH_LEVELS, raw_size);
+    report("compression.ratio", (double)raw_size * BENCH_LEVELS / total_packed, "x");
+    report("compression.compress", megabytes / compress_time, "MB/s");
+    report("compression.decompress", megabytes / decompress_time, "MB/s");
+    check("compression.round_trip", ok);
+
+    free(saves);
+    free(packed);
+    free(packed_sizes);
+    free(restored);
+}
+
+static double bench_crc_gbps(uint32_t (*fn)(uint32_t, const void*, size_t),
+                             const uint8_t* data, size_t len, int rounds) {
+    volatile uint32_t sink = 0;
+    double start = now_seconds();
+    for (int r = 0; r < rounds; r++) {
+        sink ^= fn(0, data, len);
+    }
+    double elapsed = now_seconds() - start;
+    (void)sink;
+    return (double)len * rounds / elapsed / 1e9;
+}
+
+static void bench_checksum(void) {
+    const size_t len = 1 << 20;
+    uint8_t* data = malloc(len);
+    if (!data) return;
+    for (size_t i = 0; i < len; i++) data[i] = (uint8_t)rand();
+
+    const int rounds = 200;
+    fprintf(stderr, "checksum: CRC32C over %zu KB buffers\n", len / 1024);
+    report("checksum.slice_by_8", bench_crc_gbps(crc32c_sw, data, len, rounds), "GB/s");
+    if (crc32c_hw_available()) {
+        report("checksum.sse42", bench_crc_gbps(crc32c, data, len, rounds), "GB/s");
+    }
+    free(data);
+}
+
+// Writes a users.json document with 'count' users in the layout
+// save_users_to_json produces
+static void build_users_json(struct JsonWriter* out, int count) {
+    char name[MAX_STRING_LEN];
+
+    json_write_raw(out, "[\n");
+    for (int i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "player%06d", i);
+        json_write_raw(out, i ? ",\n  {\n    \"username\": " : "  {\n    \"username\": ");
+        json_write_string(out, name);
+        json_write_raw(out, ",\n    \"password\": ");
+        json_write_string(out, "Secret\\Pass\"1");
+        json_write_raw(out, ",\n    \"email\": ");
+        snprintf(name, sizeof(name), "player%06d@example.com", i);
+        json_write_string(out, name);
+        json_write_raw(out, ",\n    \"score\": \"");
+        json_write_long(out, rand() % 100000);
+        json_write_raw(out, "\",\n    \"gold_collected\": \"");
+        json_write_long(out, rand() % 5000);
+        json_write_raw(out, "\",\n    \"difficulty\": ");
+        json_write_long(out, i % 3);
+        json_write_raw(out, ",\n    \"color\": \"Yellow\",\n    \"song\": 1,\n    \"games_played\": ");
+        json_write_long(out, i % 50);
+        json_write_raw(out, ",\n    \"music_on\": 1,\n    \"first_game_time\": ");
+        json_write_long(out, 1700000000L + i);
+        json_write_raw(out, ",\n    \"last_game_time\": ");
+        json_write_long(out, 1710000000L + i);
+        json_write_raw(out, "\n  }");
+    }
+    json_write_raw(out, "\n]\n");
+}
+
+static void count_user(const struct User* user, void* context) {
+    long* score_sum = context;
+    *score_sum += user->score;
+}
+
+static void bench_users_json(void) {
+    struct JsonWriter out;
+    json_writer_init(&out, 0);
+
+    double start = now_seconds();
+    build_users_json(&out, BENCH_USERS);
+    double write_time = now_seconds() - start;
+    if (out.failed) {
+        json_writer_free(&out);
+        return;
+    }
+
+    const int rounds = 5;
+    long score_sum = 0;
+    int parsed = 0;
+    start = now_seconds();
+    for (int r = 0; r < rounds; r++) {
+        parsed = parse_users_json(out.data, out.length, count_user, &score_sum);
+    }
+    double parse_time = (now_seconds() - start) / rounds;
+
+    double megabytes = out.length / (1024.0 * 1024.0);
+    fprintf(stderr, "users.json: %d users, %.1f MB\n", BENCH_USERS, megabytes);
+    report("users_json.write", megabytes / write_time, "MB/s");
+    report("users_json.parse", megabytes / parse_time, "MB/s");
+    check("users_json.users_read", parsed == BENCH_USERS);
+
+    // Registration and lookup through the hash-indexed user store
+    struct UserManager* store = calloc(1, sizeof(struct UserManager));
+    if (store) {
+        start = now_seconds();
+        import_users_json(store, out.data, out.length);
+        double load_time = now_seconds() - start;
+
+        char name[MAX_STRING_LEN];
+        int found = 0;
+        start = now_seconds();
+        for (int i = 0; i < BENCH_USERS; i++) {
+            snprintf(name, sizeof(name), "player%06d", (i * 7919) % BENCH_USERS);
+            found += find_user_index(store, name) >= 0;
+        }
+        double lookup_time = now_seconds() - start;
+
+        // Score changes re-rank one user each; rank lookups are binary searches
+        const int updates = 10000;
+        long rank_sum = 0;
+        start = now_seconds();
+        for (int i = 0; i < updates; i++) {
+            struct User* user = &store->users[rand() % store->user_count];
+            update_user_score(store, user, user->score + rand() % 1000);
+            rank_sum += user_rank(store, user);
+        }
+        double update_time = now_seconds() - start;
+
+        bool ordered = true;
+        for (int r = 1; r < store->user_count && ordered; r++) {
+            ordered = user_at_rank(store, r - 1)->score >= user_at_rank(store, r)->score &&
+                      user_rank(store, user_at_rank(store, r)) == r;
+        }
+
+        report("users.import", load_time * 1e3, "ms");
+        report("users.score_update", update_time / updates * 1e6, "us");
+        report("users.lookup", lookup_time / BENCH_USERS * 1e9, "ns");
+        check("users.ranking_ordered", ordered && rank_sum >= 0);
+        check("users.lookup_found", found == BENCH_USERS);
+
+        // Saving one user: full users.json rewrite vs. one users.db record
+        char db_dir[] = "/tmp/bench_users_XXXXXX";
+        char db_path[64];
+        if (mkdtemp(db_dir)) {
+            snprintf(db_path, sizeof(db_path), "%s/%s", db_dir, USERDB_FILE);
+            start = now_seconds();
+            store->db = userdb_create(store, db_path);
+            double create_time = now_seconds() - start;
+
+            if (store->db) {
+                start = now_seconds();
+                for (int i = 0; i < updates; i++) {
+                    struct User* user = &store->users[rand() % store->user_count];
+                    user->gold++;
+                    userdb_put(store->db, store, user);
+                }
+                double put_time = now_seconds() - start;
+                report("userdb.create", create_time * 1e3, "ms");
+                report("userdb.put", put_time / updates * 1e6, "us");
+            }
+            unlink(db_path);
+            rmdir(db_dir);
+        }
+        free_user_manager(store);
+    }
+
+    json_writer_free(&out);
+}
+
+// Another game process finishing a game: adds 'points' to Shared's score
+// under begin_user_update
+static bool commit_score_elsewhere(const char* db_path, int points) {
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        struct UserManager* other = create_user_manager(db_path);
+        int index = other ? find_user_index(other, "Shared") : -1;
+        if (index < 0) _exit(1);
+        struct User* user = &other->users[index];
+        begin_user_update(other, user);
+        update_user_score(other, user, user->score + points);
+        save_user(other, user, USER_FIELD_SCORE);
+        bool ok = user->dirty == 0;
+        free_user_manager(other);
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Two processes sharing one user. This one queues changes to other fields
+// (as login and the settings menu do) while another commits scores; the
+// queued write and the next update must both keep the other's score.
+static bool shared_user_updates(const char* db_path) {
+    struct UserManager* seed = calloc(1, sizeof(struct UserManager));
+    struct User shared = {0};
+    strcpy(shared.username, "Shared");
+    shared.score = 100;
+    if (seed == NULL || add_user(seed, &shared) == NULL) {
+        free_user_manager(seed);
+        return false;
+    }
+    export_users_json(seed);
+    free_user_manager(seed);
+
+    struct UserManager* mine = create_user_manager(db_path);
+    int index = find_user_index(mine, "Shared");
+    bool ok = index >= 0;
+    if (ok) {
+        struct User* user = &mine->users[index];
+        user->last_game_time = 12345;
+        save_user(mine, user, USER_FIELD_GAME_TIMES);
+        ok = commit_score_elsewhere(db_path, 50);
+        flush_users(mine);
+
+        user->difficulty = 3;
+        save_user(mine, user, USER_FIELD_SETTINGS);
+        ok = commit_score_elsewhere(db_path, 50) && ok;
+        begin_user_update(mine, user);
+        update_user_score(mine, user, user->score + 10);
+        save_user(mine, user, USER_FIELD_SCORE);
+    }
+    free_user_manager(mine);
+
+    struct UserManager* stored = create_user_manager(db_path);
+    index = find_user_index(stored, "Shared");
+    ok = ok && index >= 0 &&
+         stored->users[index].score == 210 &&
+         stored->users[index].last_game_time == 12345 &&
+         stored->users[index].difficulty == 3;
+    free_user_manager(stored);
+
+    remove("users.json");
+    remove(USERS_CHECKSUM_FILE);
+    if (db_path) remove(db_path);
+    return ok;
+}
+
+// Whether a whole document tokenizes without an error
+static bool json_well_formed(const char* text) {
+    struct JsonParser parser;
+    struct JsonToken token;
+    json_parser_init(&parser, text, strlen(text));
+    json_next(&parser, &token);
+    return json_skip_value(&parser, &token) && json_next(&parser, &token) == JSON_END;
+}
+
+static bool json_reads_long(const char* text, JsonTokenType type, long expected) {
+    struct JsonToken token = { type, text, strlen(text) };
+    long value = 0;
+    return json_token_long(&token, &value) && value == expected;
+}
+
+// Commas only between elements; integers only, clamped rather than wrapped
+static bool json_strictness(void) {
+    static const char* const good[] = {
+        "[]", "{}", "[1, 2]", "{\"a\": [1, {\"b\": 2}], \"c\": \"d\"}", "[[], {}]",
+    };
+    static const char* const bad[] = {
+        "[\"a\" \"b\"]", "{\"a\":1,,}", "{\"a\":1,}", "[1,]", "[,1]", "[1,,2]",
+        "{,\"a\":1}", "{\"a\":}", "{\"a\" \"b\":1}", "1 2",
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) ok &= json_well_formed(good[i]);
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) ok &= !json_well_formed(bad[i]);
+
+    long value = 0;
+    struct JsonToken fraction = { JSON_NUMBER, "1.5", 3 }, exponent = { JSON_NUMBER, "1e5", 3 };
+    ok &= !json_token_long(&fraction, &value) && !json_token_long(&exponent, &value);
+    ok &= json_reads_long("-42", JSON_NUMBER, -42) && json_reads_long("17", JSON_STRING, 17);
+    ok &= json_reads_long("99999999999999999999", JSON_NUMBER, LONG_MAX);
+    ok &= json_reads_long("-99999999999999999999", JSON_NUMBER, LONG_MIN);
+    ok &= json_reads_long("-9223372036854775808", JSON_NUMBER, LONG_MIN);
+    return ok;
+}
+
+// users.json carries its own checksum: a leftover checksum file from an
+// older build does not block loading, and a damaged file is refused
+static bool users_json_checksum(void) {
+    struct UserManager* seed = calloc(1, sizeof(struct UserManager));
+    struct User user = {0};
+    strcpy(user.username, "Summed");
+    if (seed == NULL || add_user(seed, &user) == NULL) {
+        free_user_manager(seed);
+        return false;
+    }
+    export_users_json(seed);
+    free_user_manager(seed);
+
+    FILE* stale = fopen(USERS_CHECKSUM_FILE, "w");
+    if (stale) {
+        fputs("00000000\n", stale);
+        fclose(stale);
+    }
+    struct UserManager* loaded = create_user_manager(NULL);
+    bool ok = loaded && find_user_index(loaded, "Summed") >= 0;
+    free_user_manager(loaded);
+
+    // Damage one byte of a name
+    size_t length = 0;
+    char* data = NULL;
+    FILE* file = fopen("users.json", "r+");
+    if (file) {
+        data = calloc(1, 4096);
+        length = data ? fread(data, 1, 4095, file) : 0;
+        char* name = data ? strstr(data, "Summed") : NULL;
+        if (name) {
+            name[0] = 's';
+            rewind(file);
+            fwrite(data, 1, length, file);
+        }
+        ok = ok && name != NULL;
+        fclose(file);
+    }
+    free(data);
+    loaded = create_user_manager(NULL);
+    ok = ok && file != NULL && loaded == NULL;
+    free_user_manager(loaded);
+
+    remove("users.json");
+    remove(USERS_CHECKSUM_FILE);
+    return ok;
+}
+
+// Another game process registering 'name' with 'password'
+static bool register_elsewhere(const char* db_path, const char* name, const char* password) {
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        struct UserManager* other = create_user_manager(db_path);
+        struct User user = {0};
+        strcpy(user.username, name);
+        strcpy(user.password, password);
+        bool ok = other && register_user(other, &user) != NULL;
+        free_user_manager(other);
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Two processes registering one name: the one that has not seen the other's
+// registration must be refused, and the first account must survive
+static bool shared_registration(const char* db_path) {
+    struct UserManager* mine = create_user_manager(db_path);
+    bool ok = mine != NULL && register_elsewhere(db_path, "Twin", "Theirs1");
+    if (ok) {
+        struct User twin = {0};
+        strcpy(twin.username, "Twin");
+        strcpy(twin.password, "Mine1");
+        ok = find_user_index(mine, "Twin") < 0 && register_user(mine, &twin) == NULL;
+    }
+    free_user_manager(mine);
+
+    struct UserManager* stored = create_user_manager(db_path);
+    int index = stored ? find_user_index(stored, "Twin") : -1;
+    ok = ok && index >= 0 && stored->user_count == 1 &&
+         strcmp(stored->users[index].password, "Theirs1") == 0 &&
+         (db_path == NULL || stored->db->known_records == 1);
+    free_user_manager(stored);
+
+    remove("users.json");
+    remove(USERS_CHECKSUM_FILE);
+    if (db_path) remove(db_path);
+    return ok;
+}
+
+static void bench_generation(struct UserManager* manager) {
+    fprintf(stderr, "generate_map: %d levels\n", BENCH_MAPS);
+    volatile int rooms = 0;
+    double start = now_seconds();
+    for (int i = 0; i < BENCH_MAPS; i++) {
+        struct Map map = generate_map(manager, NULL, 1 + i % 5, 5, 0, 0);
+        rooms += map.room_count;
+    }
+    double elapsed = now_seconds() - start;
+    report("generate_map.rate", BENCH_MAPS / elapsed, "levels/s");
+}
+
+// Floor tiles of a map, to stand the player or enemies on
+static int collect_floor(const struct Map* map, struct Point* points, int max_points) {
+    int count = 0;
+    for (int y = 0; y < MAP_HEIGHT && count < max_points; y++) {
+        for (int x = 0; x < MAP_WIDTH && count < max_points; x++) {
+            if (map->grid[y][x] == FLOOR) points[count++] = (struct Point){ x, y };
+        }
+    }
+    return count;
+}
+
+static void bench_visibility(struct UserManager* manager) {
+    static struct Map map;
+    static struct Point floor[MAP_HEIGHT * MAP_WIDTH];
+    static bool visible[MAP_HEIGHT][MAP_WIDTH];
+    map = generate_map(manager, NULL, 3, 5, 0, 0);
+    int floor_count = collect_floor(&map, floor, MAP_HEIGHT * MAP_WIDTH);
+    if (floor_count == 0) return;
+
+    fprintf(stderr, "update_visibility: %d calls\n", BENCH_FOV_CALLS);
+    double start = now_seconds();
+    for (int i = 0; i < BENCH_FOV_CALLS; i++) {
+        update_visibility(&map, &floor[(i * 7919) % floor_count], visible);
+    }
+    double elapsed = now_seconds() - start;
+    report("update_visibility.rate", BENCH_FOV_CALLS / elapsed, "calls/s");
+}
+
+// One enemy turn over 'enemy_count' awake enemies spread over the floor; the
+// enemies and grid are put back before every turn so each does the same work
+static double enemy_turn_ns(struct UserManager* manager, int enemy_count) {
+    static struct Map map;
+    static struct Point floor[MAP_HEIGHT * MAP_WIDTH];
+    static char grid[MAP_HEIGHT][MAP_WIDTH];
+    static Enemy enemies[MAX_ENEMIES];
+    map = generate_map(manager, NULL, 3, 5, 0, 0);
+    int floor_count = collect_floor(&map, floor, MAP_HEIGHT * MAP_WIDTH);
+    if (floor_count <= enemy_count) return 0;
+
+    Player player;
+    initialize_player(manager, &player, floor[0]);
+    for (int i = 0; i < enemy_count; i++) {
+        Enemy* enemy = &map.enemies[i];
+        memset(enemy, 0, sizeof(*enemy));
+        enemy->type = (EnemyType)(i % 5);
+        enemy->position = floor[1 + (i * 131) % (floor_count - 1)];
+        enemy->hp = 10;
+        enemy->damage = 1;
+        enemy->active = true;
+        enemy->chasing_tiles_left = 1000000;
+    }
+    map.enemy_count = enemy_count;
+    memcpy(grid, map.grid, sizeof(grid));
+    memcpy(enemies, map.enemies, sizeof(enemies));
+
+    struct MessageQueue messages = { .count = 0 };
+    double start = now_seconds();
+    for (int turn = 0; turn < BENCH_ENEMY_TURNS; turn++) {
+        memcpy(map.grid, grid, sizeof(grid));
+        memcpy(map.enemies, enemies, sizeof(enemies));
+        map.enemy_count = enemy_count;
+        player.hitpoints = 1000;
+        update_enemies(&map, &player, &messages);
+    }
+    return (now_seconds() - start) / BENCH_ENEMY_TURNS * 1e9;
+}
+
+static void bench_enemies(struct UserManager* manager) {
+    fprintf(stderr, "update_enemies: %d turns\n", BENCH_ENEMY_TURNS);
+    report("update_enemies.1", enemy_turn_ns(manager, 1), "ns/turn");
+    report("update_enemies.5", enemy_turn_ns(manager, 5), "ns/turn");
+    report("update_enemies.max", enemy_turn_ns(manager, MAX_ENEMIES), "ns/turn");
+}
+
+// Draws into an ncurses screen whose terminal is /dev/null: print_map costs
+// what it does in the game, and refresh() still encodes every change
+static void bench_rendering(struct UserManager* manager) {
+    static struct Map map;
+    static bool visible[MAP_HEIGHT][MAP_WIDTH];
+    map = generate_map(manager, NULL, 3, 5, 0, 0);
+    memset(visible, true, sizeof(visible));
+    struct Point position = map.initial_position;
+
+    fprintf(stderr, "rendering: %d frames\n", BENCH_FRAMES);
+    double start = now_seconds();
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+        print_map(&map, visible, position, manager);
+    }
+    report("print_map", (now_seconds() - start) / BENCH_FRAMES * 1e6, "us/frame");
+
+    start = now_seconds();
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+        print_full_map(&map, &position, manager);
+    }
+    report("print_full_map", (now_seconds() - start) / BENCH_FRAMES * 1e6, "us/frame");
+
+    // Alternate two positions so every refresh has something to send
+    struct Point moved = { position.x + 1, position.y };
+    start = now_seconds();
+    for (int i = 0; i < BENCH_FRAMES; i++) {
+        erase();
+        print_map(&map, visible, i % 2 ? moved : position, manager);
+        refresh();
+    }
+    report("print_map_refresh", (now_seconds() - start) / BENCH_FRAMES * 1e6, "us/frame");
+}
+
+static void bench_saves(struct UserManager* manager) {
+    static struct Map map;
+    static struct SavedGame loaded;
+    static struct GameContext game;
+    static struct Map floors[BENCH_SAVED_FLOORS];
+    game_context_init(&game);
+    game.levels = level_store_create();
+    for (int depth = 0; depth < BENCH_SAVED_FLOORS; depth++) {
+        floors[depth] = generate_map(manager, NULL, 3, 5, 0, 0);
+        level_store_put(game.levels, depth, &floors[depth], BENCH_SAVED_FLOORS);
+    }
+    map = generate_map(manager, NULL, 3, 5, 0, 0);
+    Player player;
+    initialize_player(manager, &player, map.initial_position);
+
+    fprintf(stderr, "saves: %d round trips\n", BENCH_SAVES);
+    double pause_time = 0, save_time = 0, load_time = 0;
+    bool ok = true;
+    for (int i = 0; i < BENCH_SAVES; i++) {
+        double start = now_seconds();
+        save_current_game(&game, manager, &map, &player, BENCH_SAVED_FLOORS);
+        pause_time += now_seconds() - start;
+        reap_save_snapshot(&game, NULL, true);
+        save_time += now_seconds() - start;
+
+        struct LevelStore* levels = level_store_create();
+        start = now_seconds();
+        ok &= load_saved_game(manager, &loaded, levels);
+        load_time += now_seconds() - start;
+
+        // Every floor left behind comes back as it was
+        static struct Map restored;
+        for (int depth = 0; ok && i == BENCH_SAVES - 1 && depth < BENCH_SAVED_FLOORS; depth++) {
+            ok = level_store_take(levels, depth, &restored) &&
+                 memcmp(restored.grid, floors[depth].grid, sizeof(restored.grid)) == 0;
+        }
+        level_store_destroy(levels);
+    }
+    ok &= memcmp(loaded.game_map.grid, map.grid, sizeof(map.grid)) == 0;
+    ok &= loaded.current_level == BENCH_SAVED_FLOORS;
+    game_context_free(&game);
+
+    report("save_current_game.pause", pause_time / BENCH_SAVES * 1e3, "ms");
+    report("save_current_game.complete", save_time / BENCH_SAVES * 1e3, "ms");
+    report("load_saved_game", load_time / BENCH_SAVES * 1e3, "ms");
+    check("saves.round_trip", ok);
+}
+
+// Loading users.json and showing the first scoreboard page ('q' is queued so
+// print_scoreboard returns after one draw)
+static void bench_scoreboard(int user_count) {
+    struct JsonWriter out;
+    json_writer_init(&out, 0);
+    build_users_json(&out, user_count);
+    FILE* file = fopen("users.json", "wb");
+    bool written = file && !out.failed && fwrite(out.data, 1, out.length, file) == out.length;
+    if (file) fclose(file);
+    json_writer_free(&out);
+    if (!written) return;
+
+    int rounds = user_count >= 100000 ? 3 : user_count >= 1000 ? 50 : 500;
+    double load_time = 0, board_time = 0;
+    bool ok = true;
+    for (int r = 0; r < rounds; r++) {
+        double start = now_seconds();
+        struct UserManager* manager = create_user_manager(NULL);
+        load_time += now_seconds() - start;
+        if (!manager) return;
+        ok &= manager->user_count == user_count;
+
+        manager->current_user = &manager->users[user_count / 2];
+        start = now_seconds();
+        ungetch('q');
+        print_scoreboard(manager);
+        board_time += now_seconds() - start;
+        free_user_manager(manager);
+    }
+    remove("users.json");
+
+    char name[64];
+    fprintf(stderr, "users: %d\n", user_count);
+    snprintf(name, sizeof(name), "load_users_from_json.%d", user_count);
+    report(name, load_time / rounds * 1e3, "ms");
+    snprintf(name, sizeof(name), "print_scoreboard.%d", user_count);
+    report(name, board_time / rounds * 1e3, "ms");
+    snprintf(name, sizeof(name), "load_users_from_json.%d.count", user_count);
+    check(name, ok);
+}
+
+static bool write_results(FILE* file) {
+    fprintf(file, "{\n\"benchmarks\": [%.*s\n],\n\"checks\": [%.*s\n]\n}\n",
+            (int)results.length, results.data, (int)checks.length, checks.data);
+    return fclose(file) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Opened up front: the benchmarks run in another directory
+    FILE* results_file = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (results_file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    srand(12345);
+    json_writer_init(&results, 0);
+    json_writer_init(&checks, 0);
+
+    if (!input_open_headless(MAP_HEIGHT + 10, MAP_WIDTH + 60)) {
+        fprintf(stderr, "benchmark: cannot open a headless terminal\n");
+        return 1;
+    }
+
+    // Files go into a scratch directory that is removed afterwards
+    char scratch[] = "/tmp/bench_XXXXXX";
+    if (!mkdtemp(scratch) || chdir(scratch) != 0 || mkdir("saves", 0755) != 0) {
+        input_close_headless();
+        fprintf(stderr, "benchmark: cannot create a scratch directory\n");
+        return 1;
+    }
+
+    // generate_map only needs a current user for the difficulty setting
+    struct UserManager* manager = calloc(1, sizeof(struct UserManager));
+    if (!manager) return 1;
+    struct User bench_user = {0};
+    strcpy(bench_user.username, "Bench");
+    bench_user.difficulty = 1;
+    manager->current_user = add_user(manager, &bench_user);
+    if (!manager->current_user) return 1;
+
+    bench_generation(manager);
+    bench_visibility(manager);
+    bench_enemies(manager);
+    bench_rendering(manager);
+    bench_saves(manager);
+    bench_compression(manager);
+    bench_checksum();
+    bench_users_json();
+    check("users_json.shared_updates", shared_user_updates(NULL));
+    check("userdb.shared_updates", shared_user_updates(USERDB_FILE));
+    check("json.strict", json_strictness());
+    check("users_json.checksum", users_json_checksum());
+    check("users_json.shared_registration", shared_registration(NULL));
+    check("userdb.shared_registration", shared_registration(USERDB_FILE));
+    bench_scoreboard(10);
+    bench_scoreboard(1000);
+    bench_scoreboard(BENCH_USERS);
+
+    free_user_manager(manager);
+    input_close_headless();
+
+    remove("saves/Bench.sav");
+    rmdir("saves");
+    remove(USERS_LOCK_FILE);
+    if (chdir("/") == 0) rmdir(scratch);
+
+    bool written = write_results(results_file);
+    json_writer_free(&results);
+    json_writer_free(&checks);
+    if (!written) {
+        fprintf(stderr, "benchmark: cannot write results\n");
+        return 1;
+    }
+    return all_checks_ok ? 0 : 1;
+}
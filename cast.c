@@ -0,0 +1,205 @@
+#include <ncurses.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cast.h"
+#include "frame.h"
+#include "json.h"
+
+// Frame records in the double buffer: header, then 'length' bytes of escapes
+struct CastRecord {
+    double time;          // Seconds since the recording started
+    uint32_t length;
+};
+
+struct Cast {
+    FILE* file;
+    struct timespec start;
+    struct FramePalette palette;
+    struct FrameGrid* shown;      // Last frame recorded
+    struct FrameGrid* next;       // Scratch for the frame being captured
+
+    pthread_mutex_t lock;         // Guards front
+    struct FrameText buffers[2];
+    int front;                    // Half the game appends to; the writer owns the other
+    struct Cast* next_cast;
+};
+
+// Every open recording, guarded by list_lock. The writer holds it while it
+// writes, so a cast unlinked under it is no longer the writer's.
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t list_changed = PTHREAD_COND_INITIALIZER;
+static struct Cast* casts = NULL;
+static bool writer_running = false;
+static struct Cast* current_cast = NULL;
+
+// Writes a buffer half of records as asciicast output events
+static void write_records(struct Cast* cast, struct FrameText* records, struct JsonWriter* json) {
+    size_t pos = 0;
+    json->length = 0;
+    while (pos + sizeof(struct CastRecord) <= records->length) {
+        struct CastRecord record;
+        memcpy(&record, records->data + pos, sizeof(record));
+        pos += sizeof(record);
+
+        char time_text[32];
+        snprintf(time_text, sizeof(time_text), "[%.6f, \"o\", ", record.time);
+        json_write_raw(json, time_text);
+        json_write_string_length(json, records->data + pos, record.length);
+        json_write_raw(json, "]\n");
+        pos += record.length;
+    }
+    records->length = 0;
+    if (json->length > 0) fwrite(json->data, 1, json->length, cast->file);
+    fflush(cast->file);
+}
+
+static void flush_cast(struct Cast* cast, struct JsonWriter* json) {
+    pthread_mutex_lock(&cast->lock);
+    int full = cast->front;
+    cast->front = 1 - full;
+    pthread_mutex_unlock(&cast->lock);
+    write_records(cast, &cast->buffers[full], json);
+}
+
+// Runs for the rest of the process once started; sleeps while nothing records
+static void* writer_main(void* arg) {
+    (void)arg;
+    struct JsonWriter json;
+    json_writer_init(&json, 64 * 1024);
+
+    pthread_mutex_lock(&list_lock);
+    for (;;) {
+        if (casts == NULL) {
+            pthread_cond_wait(&list_changed, &list_lock);
+            continue;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += CAST_FLUSH_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&list_changed, &list_lock, &deadline);
+
+        for (struct Cast* cast = casts; cast; cast = cast->next_cast) flush_cast(cast, &json);
+    }
+    return NULL;
+}
+
+// Starts recording the current curses screen to 'path'; NULL if the file
+// cannot be created
+struct Cast* cast_open(const char* path) {
+    struct Cast* cast = calloc(1, sizeof(struct Cast));
+    if (cast == NULL) return NULL;
+    cast->file = fopen(path, "w");
+    if (cast->file == NULL) {
+        free(cast);
+        return NULL;
+    }
+
+    int lines, columns;
+    getmaxyx(stdscr, lines, columns);
+    const char* term = getenv("TERM");
+    fprintf(cast->file, "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %ld, "
+            "\"env\": {\"TERM\": \"%s\"}}\n", columns, lines, (long)time(NULL), term && *term ? term : "xterm");
+    fflush(cast->file);
+
+    clock_gettime(CLOCK_MONOTONIC, &cast->start);
+    frame_capture_palette(&cast->palette);
+    pthread_mutex_init(&cast->lock, NULL);
+
+    pthread_mutex_lock(&list_lock);
+    if (!writer_running) {
+        pthread_t thread;
+        writer_running = pthread_create(&thread, NULL, writer_main, NULL) == 0;
+        if (writer_running) pthread_detach(thread);
+    }
+    bool ok = writer_running;
+    if (ok) {
+        cast->next_cast = casts;
+        casts = cast;
+        pthread_cond_signal(&list_changed);
+    }
+    pthread_mutex_unlock(&list_lock);
+
+    if (!ok) {
+        fclose(cast->file);
+        pthread_mutex_destroy(&cast->lock);
+        free(cast);
+        return NULL;
+    }
+    return cast;
+}
+
+// Writes out what is left and closes the file. Stop recording into it
+// (cast_set_current) first.
+void cast_close(struct Cast* cast) {
+    if (cast == NULL) return;
+
+    pthread_mutex_lock(&list_lock);
+    for (struct Cast** link = &casts; *link; link = &(*link)->next_cast) {
+        if (*link == cast) {
+            *link = cast->next_cast;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&list_lock);
+
+    struct JsonWriter json;
+    json_writer_init(&json, 4096);
+    write_records(cast, &cast->buffers[1 - cast->front], &json);
+    write_records(cast, &cast->buffers[cast->front], &json);
+    json_writer_free(&json);
+
+    fclose(cast->file);
+    free(cast->buffers[0].data);
+    free(cast->buffers[1].data);
+    free(cast->shown);
+    free(cast->next);
+    pthread_mutex_destroy(&cast->lock);
+    free(cast);
+}
+
+// Where cast_frame() records; NULL for nowhere
+void cast_set_current(struct Cast* cast) {
+    current_cast = cast;
+}
+
+// Records the screen as it is now, if it changed
+void cast_frame(void) {
+    struct Cast* cast = current_cast;
+    if (cast == NULL) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    cast->next = frame_capture(cast->next);
+    if (cast->next == NULL) return;
+
+    const struct FrameGrid* from = cast->shown;
+    if (from && (from->lines != cast->next->lines || from->columns != cast->next->columns)) from = NULL;
+
+    struct CastRecord record = {
+        .time = (double)(now.tv_sec - cast->start.tv_sec) + (now.tv_nsec - cast->start.tv_nsec) / 1e9,
+    };
+    pthread_mutex_lock(&cast->lock);
+    struct FrameText* out = &cast->buffers[cast->front];
+    size_t start = out->length;
+    bool changed = frame_append(out, &record, sizeof(record)) &&
+                   frame_encode(out, from, cast->next, &cast->palette);
+    if (changed) {
+        record.length = (uint32_t)(out->length - start - sizeof(record));
+        memcpy(out->data + start, &record, sizeof(record));
+    } else {
+        out->length = start;
+    }
+    pthread_mutex_unlock(&cast->lock);
+
+    if (changed) {
+        struct FrameGrid* shown = cast->shown;
+        cast->shown = cast->next;
+        cast->next = shown;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef CAST_H
+#define CAST_H
+
+// Recordings of what a player saw, in asciicast v2 (`asciinema play FILE`).
+// Once a turn, just before waiting for the key, the game adds a frame: the
+// time and the escapes for the cells that changed since the last frame
+// (frame.h). Frames go into one half of a double buffer. A writer thread
+// swaps the halves every CAST_FLUSH_MS and writes out the full one as
+// JSON lines, so recording makes no system calls on the game thread. The
+// clock is read through the vDSO, and the writer holds the buffer lock
+// only for a swap.
+
+#define CAST_FLUSH_MS 250
+
+struct Cast;
+
+// Function declarations
+struct Cast* cast_open(const char* path);
+void cast_close(struct Cast* cast);
+void cast_set_current(struct Cast* cast);
+void cast_frame(void);
+
+#endif
@@ -0,0 +1,98 @@
+#include <string.h>
+#include "checksum.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u   // Reflected Castagnoli polynomial
+
+static uint32_t crc_table[8][256];
+static bool crc_use_hw = false;
+
+// Tables and CPU detection run once before main() so lookups never race
+__attribute__((constructor))
+static void crc32c_init(void) {
+    crc_use_hw = crc32c_hw_available();
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t prev = crc_table[t - 1][i];
+            crc_table[t][i] = (prev >> 8) ^ crc_table[0][prev & 0xFF];
+        }
+    }
+}
+
+// Slice-by-8: consumes 8 bytes per step with 8 independent table lookups
+uint32_t crc32c_sw(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = data;
+    crc = ~crc;
+
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc_table[7][lo & 0xFF] ^
+              crc_table[6][(lo >> 8) & 0xFF] ^
+              crc_table[5][(lo >> 16) & 0xFF] ^
+              crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xFF] ^
+              crc_table[2][(hi >> 8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^
+              crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint64_t c = ~crc;
+
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    uint32_t c32 = (uint32_t)c;
+    while (len--) {
+        c32 = _mm_crc32_u8(c32, *p++);
+    }
+
+    return ~c32;
+}
+#endif
+
+bool crc32c_hw_available(void) {
+#ifdef CRC32C_HAVE_SSE42
+    __builtin_cpu_init();   // Required when called from a constructor
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+#ifdef CRC32C_HAVE_SSE42
+    if (crc_use_hw) return crc32c_hw(crc, data, len);
+#endif
+    return crc32c_sw(crc, data, len);
+}
@@ -0,0 +1,18 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// CRC32C (Castagnoli) used to verify saves and the user database.
+// crc32c() uses the SSE4.2 crc32 instruction when the CPU has it and falls
+// back to a slice-by-8 table implementation otherwise.
+// To checksum data in pieces, pass the previous result as 'crc' (start at 0).
+
+// Function declarations
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+uint32_t crc32c_sw(uint32_t crc, const void* data, size_t len);
+bool crc32c_hw_available(void);
+
+#endif
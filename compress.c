@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+
+// ---------------------------------------------------------------------------
+// RLE (PackBits layout)
+//   control 0..127   => copy the next (control + 1) bytes literally
+//   control 128..255 => repeat the next byte (control - 128 + 3) times
+// ---------------------------------------------------------------------------
+
+#define RLE_MIN_RUN      3
+#define RLE_MAX_RUN      (127 + RLE_MIN_RUN)
+#define RLE_MAX_LITERAL  128
+
+size_t rle_encode(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap) {
+    size_t i = 0;
+    size_t op = 0;
+
+    while (i < src_len) {
+        // Measure the run starting at i
+        size_t run = 1;
+        while (i + run < src_len && run < RLE_MAX_RUN && src[i + run] == src[i]) {
+            run++;
+        }
+
+        if (run >= RLE_MIN_RUN) {
+            if (op + 2 > dst_cap) return 0;
+            dst[op++] = (uint8_t)(128 + (run - RLE_MIN_RUN));
+            dst[op++] = src[i];
+            i += run;
+            continue;
+        }
+
+        // Collect literals until the next worthwhile run
+        size_t j = i;
+        while (j < src_len && j - i < RLE_MAX_LITERAL) {
+            if (j + 2 < src_len && src[j] == src[j + 1] && src[j] == src[j + 2]) break;
+            j++;
+        }
+
+        size_t count = j - i;
+        if (op + 1 + count > dst_cap) return 0;
+        dst[op++] = (uint8_t)(count - 1);
+        memcpy(dst + op, src + i, count);
+        op += count;
+        i = j;
+    }
+
+    return op;
+}
+
+size_t rle_decode(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < src_len) {
+        uint8_t control = src[ip++];
+
+        if (control < 128) {
+            size_t count = (size_t)control + 1;
+            if (ip + count > src_len || op + count > dst_cap) return 0;
+            memcpy(dst + op, src + ip, count);
+            ip += count;
+            op += count;
+        } else {
+            size_t count = (size_t)(control - 128) + RLE_MIN_RUN;
+            if (ip >= src_len || op + count > dst_cap) return 0;
+            memset(dst + op, src[ip++], count);
+            op += count;
+        }
+    }
+
+    return op;
+}
+
+// ---------------------------------------------------------------------------
+// LZ block codec
+//   sequence = token, [literal length bytes], literals, offset (2 bytes LE),
+//              [match length bytes]
+//   token high nibble = literal length, low nibble = match length - 4;
+//   a nibble of 15 is continued by bytes of 255 ... terminated by one < 255.
+//   The final sequence carries only literals.
+// ---------------------------------------------------------------------------
+
+#define LZ_HASH_SIZE (1u << LZ_HASH_BITS)
+
+static uint32_t lz_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static bool lz_write_length(uint8_t* dst, size_t* op, size_t dst_cap, size_t length) {
+    while (length >= 255) {
+        if (*op >= dst_cap) return false;
+        dst[(*op)++] = 255;
+        length -= 255;
+    }
+    if (*op >= dst_cap) return false;
+    dst[(*op)++] = (uint8_t)length;
+    return true;
+}
+
+static bool lz_emit_sequence(uint8_t* dst, size_t* op, size_t dst_cap,
+                             const uint8_t* literals, size_t literal_len,
+                             size_t offset, size_t match_len) {
+    if (*op >= dst_cap) return false;
+
+    size_t token_pos = (*op)++;
+    uint8_t token = (uint8_t)((literal_len >= 15 ? 15 : literal_len) << 4);
+
+    if (literal_len >= 15 && !lz_write_length(dst, op, dst_cap, literal_len - 15)) return false;
+    if (*op + literal_len > dst_cap) return false;
+    memcpy(dst + *op, literals, literal_len);
+    *op += literal_len;
+
+    if (match_len > 0) {
+        size_t extra = match_len - LZ_MIN_MATCH;
+        token |= (uint8_t)(extra >= 15 ? 15 : extra);
+
+        if (*op + 2 > dst_cap) return false;
+        dst[(*op)++] = (uint8_t)(offset & 0xFF);
+        dst[(*op)++] = (uint8_t)(offset >> 8);
+
+        if (extra >= 15 && !lz_write_length(dst, op, dst_cap, extra - 15)) return false;
+    }
+
+    dst[token_pos] = token;
+    return true;
+}
+
+size_t lz_compress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap) {
+    uint32_t table[LZ_HASH_SIZE];
+    memset(table, 0, sizeof(table));
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+    size_t misses = 0;
+
+    while (ip + LZ_MIN_MATCH <= src_len) {
+        uint32_t sequence = lz_read32(src + ip);
+        uint32_t h = lz_hash(sequence);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)ip;
+
+        if (candidate < ip && ip - candidate <= LZ_MAX_OFFSET &&
+            lz_read32(src + candidate) == sequence) {
+            size_t match_len = LZ_MIN_MATCH;
+            while (ip + match_len < src_len && src[candidate + match_len] == src[ip + match_len]) {
+                match_len++;
+            }
+
+            if (!lz_emit_sequence(dst, &op, dst_cap, src + anchor, ip - anchor,
+                                  ip - candidate, match_len)) {
+                return 0;
+            }
+
+            ip += match_len;
+            anchor = ip;
+            misses = 0;
+        } else {
+            // Skip faster through data that does not compress
+            ip += 1 + (misses++ >> 6);
+        }
+    }
+
+    if (!lz_emit_sequence(dst, &op, dst_cap, src + anchor, src_len - anchor, 0, 0)) {
+        return 0;
+    }
+    return op;
+}
+
+static bool lz_read_length(const uint8_t* src, size_t* ip, size_t src_len, size_t* length) {
+    uint8_t b;
+    do {
+        if (*ip >= src_len) return false;
+        b = src[(*ip)++];
+        *length += b;
+    } while (b == 255);
+    return true;
+}
+
+size_t lz_decompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < src_len) {
+        uint8_t token = src[ip++];
+
+        // Literals
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !lz_read_length(src, &ip, src_len, &literal_len)) return 0;
+        if (ip + literal_len > src_len || op + literal_len > dst_cap) return 0;
+        memcpy(dst + op, src + ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        // The last sequence has no match part
+        if (ip == src_len) break;
+
+        // Match
+        if (ip + 2 > src_len) return 0;
+        size_t offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return 0;
+
+        size_t match_len = (token & 15);
+        if (match_len == 15 && !lz_read_length(src, &ip, src_len, &match_len)) return 0;
+        match_len += LZ_MIN_MATCH;
+        if (op + match_len > dst_cap) return 0;
+
+        // Byte-wise copy: the match may overlap the bytes it produces
+        const uint8_t* match = dst + op - offset;
+        for (size_t i = 0; i < match_len; i++) {
+            dst[op + i] = match[i];
+        }
+        op += match_len;
+    }
+
+    return op;
+}
+
+// ---------------------------------------------------------------------------
+// Combined pipeline
+// ---------------------------------------------------------------------------
+
+size_t compress_buffer(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap) {
+    uint8_t* stage = malloc(RLE_BOUND(src_len));
+    if (!stage) return 0;
+
+    size_t rle_len = rle_encode(src, src_len, stage, RLE_BOUND(src_len));
+    size_t out_len = rle_len ? lz_compress(stage, rle_len, dst, dst_cap) : 0;
+
+    free(stage);
+    return out_len;
+}
+
+size_t decompress_buffer(const uint8_t* src, size_t src_len, uint8_t* dst, size_t raw_len) {
+    uint8_t* stage = malloc(RLE_BOUND(raw_len));
+    if (!stage) return 0;
+
+    size_t rle_len = lz_decompress(src, src_len, stage, RLE_BOUND(raw_len));
+    size_t out_len = rle_len ? rle_decode(stage, rle_len, dst, raw_len) : 0;
+
+    free(stage);
+    return (out_len == raw_len) ? out_len : 0;
+}
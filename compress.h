@@ -0,0 +1,32 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Two-stage codec used for save files and archived levels:
+//   1) PackBits-style RLE collapses the long FOG/FLOOR runs and zeroed arrays
+//   2) a small LZ77 block codec (LZ4-like token layout) removes what repeats
+// All functions return the number of bytes written, or 0 on error / overflow.
+// Inputs must be non-empty.
+
+#define LZ_MIN_MATCH     4
+#define LZ_MAX_OFFSET    65535
+#define LZ_HASH_BITS     12
+
+// Worst-case output sizes for a given input size
+#define RLE_BOUND(n)      ((n) + (n) / 128 + 1)
+#define LZ_BOUND(n)       ((n) + (n) / 255 + 16)
+#define COMPRESS_BOUND(n) LZ_BOUND(RLE_BOUND(n))
+
+// Function declarations
+size_t rle_encode(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap);
+size_t rle_decode(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap);
+size_t lz_compress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap);
+size_t lz_decompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap);
+
+// RLE followed by LZ; decompress_buffer succeeds only if exactly raw_len bytes come out
+size_t compress_buffer(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_cap);
+size_t decompress_buffer(const uint8_t* src, size_t src_len, uint8_t* dst, size_t raw_len);
+
+#endif
@@ -0,0 +1,169 @@
+#include <ncurses.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+
+// Copies stdscr into 'grid', which is replaced if the screen changed size
+// (NULL: a new one). Returns NULL, with 'grid' freed, if out of memory.
+struct FrameGrid* frame_capture(struct FrameGrid* grid) {
+    int lines, columns, y, x;
+    getmaxyx(stdscr, lines, columns);
+    getyx(stdscr, y, x);
+
+    if (grid == NULL || grid->lines != lines || grid->columns != columns) {
+        free(grid);
+        // winchnstr stores a terminating 0 after the last cell: hence the +1
+        grid = malloc(sizeof(struct FrameGrid) + sizeof(chtype) * (size_t)(lines * columns + 1));
+        if (grid == NULL) return NULL;
+        grid->lines = lines;
+        grid->columns = columns;
+    }
+    for (int row = 0; row < lines; row++) {
+        mvwinchnstr(stdscr, row, 0, &grid->cells[row * columns], columns);
+    }
+    move(y, x);
+    return grid;
+}
+
+void frame_capture_palette(struct FramePalette* palette) {
+    int count = COLOR_PAIRS < FRAME_PAIRS ? COLOR_PAIRS : FRAME_PAIRS;
+    for (int pair = 0; pair < FRAME_PAIRS; pair++) {
+        short foreground = -1, background = -1;
+        if (pair > 0 && pair < count && has_colors()) pair_content(pair, &foreground, &background);
+        palette->colors[pair][0] = foreground;
+        palette->colors[pair][1] = background;
+    }
+}
+
+bool frame_append(struct FrameText* text, const void* data, size_t length) {
+    if (text->length + length > text->capacity) {
+        size_t capacity = text->capacity ? text->capacity : 4096;
+        while (capacity < text->length + length) capacity *= 2;
+        char* grown = realloc(text->data, capacity);
+        if (grown == NULL) return false;
+        text->data = grown;
+        text->capacity = capacity;
+    }
+    memcpy(text->data + text->length, data, length);
+    text->length += length;
+    return true;
+}
+
+void frame_appendf(struct FrameText* text, const char* format, ...) {
+    char buffer[64];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > 0) frame_append(text, buffer, (size_t)length < sizeof(buffer) ? (size_t)length : sizeof(buffer) - 1);
+}
+
+// Terminal's cursor and pen; y < 0 when the position is not known
+struct Cursor {
+    int y, x;
+    chtype attributes;
+};
+
+static void append_attributes(struct FrameText* out, chtype attributes, const struct FramePalette* palette) {
+    frame_appendf(out, "\x1b[0");
+    if (attributes & A_BOLD) frame_appendf(out, ";1");
+    if (attributes & A_DIM) frame_appendf(out, ";2");
+    if (attributes & A_UNDERLINE) frame_appendf(out, ";4");
+    if (attributes & A_BLINK) frame_appendf(out, ";5");
+    if (attributes & (A_REVERSE | A_STANDOUT)) frame_appendf(out, ";7");
+
+    int pair = PAIR_NUMBER(attributes);
+    if (pair > 0 && pair < FRAME_PAIRS) {
+        short foreground = palette->colors[pair][0], background = palette->colors[pair][1];
+        if (foreground >= 0 && foreground < 8) frame_appendf(out, ";3%d", foreground);
+        if (background >= 0 && background < 8) frame_appendf(out, ";4%d", background);
+    }
+    frame_appendf(out, "m");
+}
+
+static char cell_char(chtype cell) {
+    chtype c = cell & A_CHARTEXT;
+    return c < ' ' || c == 127 ? ' ' : (char)c;
+}
+
+// Moves the cursor with the shortest of: resending a few unchanged cells,
+// a move along the row, CR (LF), or an absolute position
+static void move_cursor(struct FrameText* out, struct Cursor* cursor, const chtype* row, int y, int x) {
+    if (cursor->y == y && cursor->x == x) return;
+
+    char best[32], candidate[32];
+    int best_length = snprintf(best, sizeof(best), "\x1b[%d;%dH", y + 1, x + 1);
+
+    if (cursor->y == y && x > cursor->x && x - cursor->x <= FRAME_GAP_FILL) {
+        int length = 0;
+        for (int column = cursor->x; column < x && length >= 0; column++) {
+            if ((row[column] & A_ATTRIBUTES) != cursor->attributes) length = -1;
+            else candidate[length++] = cell_char(row[column]);
+        }
+        if (length > 0 && length < best_length) {
+            memcpy(best, candidate, (size_t)length);
+            best_length = length;
+        }
+    }
+    if (cursor->y == y) {
+        int length;
+        if (x == 0) length = snprintf(candidate, sizeof(candidate), "\r");
+        else if (x > cursor->x) length = snprintf(candidate, sizeof(candidate), "\x1b[%dC", x - cursor->x);
+        else length = snprintf(candidate, sizeof(candidate), "\x1b[%dD", cursor->x - x);
+        if (length < best_length) {
+            memcpy(best, candidate, (size_t)length);
+            best_length = length;
+        }
+    } else if (cursor->y >= 0 && y == cursor->y + 1) {
+        int length = x == 0 ? snprintf(candidate, sizeof(candidate), "\r\n")
+                            : snprintf(candidate, sizeof(candidate), "\r\n\x1b[%dC", x);
+        if (length < best_length) {
+            memcpy(best, candidate, (size_t)length);
+            best_length = length;
+        }
+    }
+
+    frame_append(out, best, (size_t)best_length);
+    cursor->y = y;
+    cursor->x = x;
+}
+
+// Appends the escapes that turn 'from' (same size) into 'to' (from NULL:
+// clears the screen and draws all of 'to'); false if nothing changed. Every frame
+// starts and ends with the default pen, so any frame can follow any other.
+bool frame_encode(struct FrameText* out, const struct FrameGrid* from, const struct FrameGrid* to,
+                  const struct FramePalette* palette) {
+    struct Cursor cursor = { -1, -1, 0 };
+    size_t start = out->length;
+
+    if (from == NULL) {
+        frame_appendf(out, "\x1b[0m\x1b[?25l\x1b[H\x1b[2J");
+        cursor.y = cursor.x = 0;
+    }
+
+    for (int y = 0; y < to->lines; y++) {
+        const chtype* row = &to->cells[y * to->columns];
+        const chtype* before = from ? &from->cells[y * from->columns] : NULL;
+        for (int x = 0; x < to->columns; x++) {
+            chtype was = before ? before[x] : (chtype)' ';
+            if (row[x] == was) continue;
+
+            move_cursor(out, &cursor, row, y, x);
+            chtype attributes = row[x] & A_ATTRIBUTES;
+            if (attributes != cursor.attributes) {
+                append_attributes(out, attributes, palette);
+                cursor.attributes = attributes;
+            }
+            char c = cell_char(row[x]);
+            frame_append(out, &c, 1);
+            cursor.x++;
+            if (cursor.x == to->columns) cursor.y = -1;   // Where the terminal wraps to is its business
+        }
+    }
+
+    if (from && out->length == start) return false;
+    if (cursor.attributes) frame_appendf(out, "\x1b[0m");
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <ncurses.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Terminal frames for outputs curses does not drive itself (spectators,
+// session recordings). A grid is a copy of stdscr's cells. frame_encode
+// writes the escapes that turn one grid into the next on an ANSI terminal,
+// for changed cells only: a cursor move chosen by cost, the attributes
+// when they change, then the text.
+
+#define FRAME_PAIRS 64         // Color pairs whose colors are encoded
+#define FRAME_GAP_FILL 4       // Unchanged cells worth resending instead of a cursor move
+
+struct FrameGrid {
+    int lines, columns;
+    chtype cells[];
+};
+
+// Growable byte buffer
+struct FrameText {
+    char* data;
+    size_t length, capacity;
+};
+
+// Foreground and background of each color pair, -1 for the default
+struct FramePalette {
+    short colors[FRAME_PAIRS][2];
+};
+
+// Function declarations
+struct FrameGrid* frame_capture(struct FrameGrid* grid);
+void frame_capture_palette(struct FramePalette* palette);
+bool frame_append(struct FrameText* text, const void* data, size_t length);
+void frame_appendf(struct FrameText* text, const char* format, ...);
+bool frame_encode(struct FrameText* out, const struct FrameGrid* from, const struct FrameGrid* to,
+                  const struct FramePalette* palette);
+
+#endif
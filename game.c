@@ -1,14 +1,26 @@
 #include <ncurses.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
 #include <limits.h>
 #include <dirent.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "game.h"
 #include "users.h"
-
-bool hasPassword = false;  // The single definition
+#include "compress.h"
+#include "checksum.h"
+#include "audio.h"
+#include "trace.h"
+#include "perf.h"
+#include "input.h"
+#include "spectate.h"
+#include "cast.h"
+#include "levels.h"
 
 #define DOOR '+'
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -22,18 +34,44 @@ bool hasPassword = false;  // The single definition
 #define MAP_HEIGHT 24
 #define MAX_LEVELS 5
 
-//For Ancient Keys
-int ancient_key_count = 0;
-int broken_key_count = 0;
+// Whether new games save from a forked child (see game_set_snapshot_saves)
+static bool snapshot_saves = SAVE_SNAPSHOT_FORK;
+
+// Fresh state for a game about to be played or resumed
+void game_context_init(struct GameContext* game) {
+    memset(game, 0, sizeof(*game));
+    game->snapshot_saves = snapshot_saves;
+}
+
+// Server mode turns snapshot saves off: fork() there would copy a process
+// full of threads, mid-way through other sessions, with every player's
+// socket, while game_lock is held. Games started afterwards save inline.
+void game_set_snapshot_saves(bool enabled) {
+    snapshot_saves = enabled && SAVE_SNAPSHOT_FORK;
+}
+
+// Releases what a game holds outside its context: the stored floors and a
+// save child still running. play_game calls it on the way out; a caller that
+// abandons a game without returning through play_game (a server session
+// hanging up) calls it instead. Safe to call twice.
+void game_context_free(struct GameContext* game) {
+    level_store_destroy(game->levels);
+    game->levels = NULL;
+    if (game->pending_save_pid > 0) waitpid(game->pending_save_pid, NULL, 0);
+    game->pending_save_pid = 0;
+}
 
-time_t last_enchant_drain = 0; // static or global to track intervals
+// The game play_game is running, NULL outside a game. The server swaps it
+// along with the rest of a session's state.
+static struct GameContext* current_game = NULL;
 
-//variables for 'f' movement
-static bool run_mode = false;  // tracks if user pressed 'f' and is waiting for arrow
-static int run_dx = 0, run_dy = 0; 
+struct GameContext* game_context_current(void) {
+    return current_game;
+}
 
-//variable for 'g' movement
-static bool skipCollectNext = false;
+void game_context_set_current(struct GameContext* game) {
+    current_game = game;
+}
 
 // Initialize a player structure (Modify existing player initialization if necessary)
 void initialize_player(struct UserManager* manager, Player* player, struct Point start_location) {
@@ -64,10 +102,62 @@ void initialize_player(struct UserManager* manager, Player* player, struct Point
     player->temporary_speed_timer = 0;
 }
 
-void play_game(struct UserManager* manager, struct Map* game_map, 
-               Player* player, int initial_score) {
+// Map cells whose glyph changed since the last call: what the next refresh
+// has to send for the map, since every tile is drawn each turn
+static int count_redrawn_tiles(struct GameContext* game) {
+    int changed = 0;
+    for (int y = 0; y < MAP_HEIGHT; y++) {
+        for (int x = 0; x < MAP_WIDTH; x++) {
+            chtype cell = mvinch(y, x);
+            if (cell != game->hud_tiles[y][x]) {
+                game->hud_tiles[y][x] = cell;
+                changed++;
+            }
+        }
+    }
+    return changed;
+}
+
+// Last turn's breakdown and running percentiles, in milliseconds
+static void draw_perf_hud(const struct PerfStats* perf, int y, int x) {
+    static const char* names[PERF_PHASES + 1] = { "logic", "render", "flush", "turn" };
+
+    mvprintw(y, x, "%-7s %8s %8s %8s", "perf", "last", "p50", "p99");
+    for (int phase = 0; phase <= PERF_PHASES; phase++) {
+        const struct PerfHistogram* histogram = &perf->histograms[phase];
+        mvprintw(y + 1 + phase, x, "%-7s %8.3f %8.3f %8.3f", names[phase],
+                 perf->last_ns[phase] / 1e6,
+                 perf_percentile(histogram, 50) / 1e6,
+                 perf_percentile(histogram, 99) / 1e6);
+    }
+    mvprintw(y + PERF_PHASES + 2, x, "enemies ticked %d, tiles redrawn %d",
+             perf->last_entities_ticked, perf->last_tiles_redrawn);
+    mvprintw(y + PERF_PHASES + 3, x, "bytes/frame %llu (p50 %llu, p99 %llu)",
+             (unsigned long long)perf->last_frame_bytes,
+             (unsigned long long)perf_percentile(&perf->frame_bytes, 50),
+             (unsigned long long)perf_percentile(&perf->frame_bytes, 99));
+}
+
+// Swaps the floor being played for the stored one at 'depth', keeping the
+// current one in the store. Changes nothing if that floor is not stored or
+// cannot be read back.
+static bool switch_floor(struct LevelStore* levels, struct Map* game_map, int* current_level, int depth) {
+    if (levels == NULL || !level_store_has(levels, depth) ||
+        !level_store_put(levels, *current_level, game_map, depth)) {
+        return false;
+    }
+    if (!level_store_take(levels, depth, game_map)) {
+        level_store_take(levels, *current_level, game_map);
+        return false;
+    }
+    *current_level = depth;
+    return true;
+}
+
+void play_game(struct GameContext* game, struct UserManager* manager,
+               struct Map* game_map, Player* player, int initial_score) {
     const int max_level = 5;  // Define maximum levels
-    int current_level = 1;    // Start at level 1
+    int current_level = game->start_level > 0 ? game->start_level : 1;
     bool game_running = true;
 
     bool show_map = false;
@@ -87,12 +177,8 @@ void play_game(struct UserManager* manager, struct Map* game_map,
     int gold_count = 0;
 
 
-    game_map->last_hunger_decrease = time(NULL);
-    game_map->last_attack_time = time(NULL);
-
-    // Keep track of the last direction used for ranged shots
-    static int last_dx = 0;
-    static int last_dy = 0;
+    game_map->last_hunger_decrease = game_time();
+    game_map->last_attack_time = game_time();
 
     // Initialize visibility array (all tiles hidden initially)
     bool visible[MAP_HEIGHT][MAP_WIDTH] = {0}; 
@@ -101,17 +187,42 @@ void play_game(struct UserManager* manager, struct Map* game_map,
     // Message Queue for game messages
     struct MessageQueue message_queue = { .count = 0 };
 
+    // Floors left behind, for going back up ('<') and down again
+    // (a loaded game arrives with the ones from its save)
+    if (game->levels == NULL) game->levels = level_store_create();
+    struct LevelStore* levels = game->levels;
+    game_context_set_current(game);
+
+    // Performance HUD ('p'); timing runs whether or not it is shown
+    struct PerfStats* perf = &game->perf;
+    perf_init(perf);
+    bool show_perf = false;
+    perf_phase(perf, PERF_LOGIC);
+
+    // A turn runs from one key to the wait for the next: the time the player
+    // takes is the "input" span, not part of the turn
+    TRACE_BEGIN("turn");
     while (game_running) {
-        clear();
+        input_next_turn();
+        perf_phase(perf, PERF_RENDER);
+        if (show_perf) perf_count_frame_bytes(perf);
+        erase();   // Not clear(): that would make refresh() resend every cell
 
         if (show_map) {
             // Display the entire map
+            TRACE_BEGIN("print_full_map");
             print_full_map(game_map, &player->location, manager);
+            TRACE_END();
         } else {
             // Update visibility based on player's field of view
+            TRACE_BEGIN("update_visibility");
             update_visibility(game_map, &player->location, visible);
+            TRACE_END();
+            TRACE_BEGIN("print_map");
             print_map(game_map, visible, player->location, manager);
+            TRACE_END();
         }
+        if (show_perf) perf->tiles_redrawn += count_redrawn_tiles(game);
 
         mvprintw(MAP_HEIGHT + 1, 0, 
             "Score: %d   HP: %d   Hunger Rate: %d/100    Gold: %d  Player: %s",
@@ -130,10 +241,16 @@ void play_game(struct UserManager* manager, struct Map* game_map,
             mvprintw(MAP_HEIGHT + 2, 0, "Level: %d                             Equipped Weapon: None"
                     ,current_level);
         }
-        mvprintw(MAP_HEIGHT + 4, 0, "Controls: Arrow Keys to Move or use numbers of numpad,  'r' - Weapon Inventory, 'e' - General Inventory, 'q' - Quit \n'z' - save   'x' - spell inventory");
+        mvprintw(MAP_HEIGHT + 4, 0, "Controls: Arrow Keys to Move or use numbers of numpad,  'r' - Weapon Inventory, 'e' - General Inventory, 'q' - Quit \n'z' - save   'x' - spell inventory   'l' - message log   'p' - performance");
+        if (show_perf) draw_perf_hud(perf, MAX_MESSAGES + 1, MAP_WIDTH + 1);
+        perf_phase(perf, PERF_FLUSH);
+        TRACE_BEGIN("refresh");
         refresh();
+        TRACE_END();
+        perf_phase(perf, PERF_LOGIC);
 
         // Increase hunger rate over time
+        TRACE_BEGIN("timers");
         if (frame_count % HUNGER_INCREASE_INTERVAL == 0) {
             if (player->hunger_rate < MAX_HUNGER) {
                 player->hunger_rate+=10;
@@ -155,50 +272,77 @@ void play_game(struct UserManager* manager, struct Map* game_map,
         // }
 
         if (player->hunger_rate >= MAX_HUNGER){
-            handle_death(manager, player);
+            handle_death(game, manager, player);
             game_running = false;
         }
 
         Room* current_room = find_room_by_position(game_map, player->location.x, player->location.y);
         if (current_room && current_room->theme == THEME_ENCHANT) {
-            time_t now = time(NULL);
+            time_t now = game_time();
             // If at least 1 second passed since last drain
-            if (difftime(now, last_enchant_drain) >= 1.0) {
+            if (difftime(now, game->last_enchant_drain) >= 1.0) {
                 player->hitpoints -= 1;
                 add_game_message(&message_queue, 
                     "A magical aura drains your life by 1 HP!", 
                     4 // pick a color pair, e.g. red or cyan
                 );
-                last_enchant_drain = now;
+                game->last_enchant_drain = now;
             }
         }
 
         // Check if hitpoints are zero
         if (player->hitpoints <= 0) {
-            handle_death(manager, player);
+            handle_death(game, manager, player);
             game_running = false;
         }
 
         // Possibly add gold and food periodically
         // Example: Add a new food and gold every 30 seconds
-        static time_t last_item_add_time = 0;
-        if (difftime(time(NULL), last_item_add_time) >= 30.0) {
+        if (difftime(game_time(), game->last_item_add_time) >= 30.0) {
             add_food(game_map, player);
             //add_gold(game_map, player);
-            last_item_add_time = time(NULL);
+            game->last_item_add_time = game_time();
         }
         update_temporary_effects(player, game_map, &message_queue);
 
-        update_password_display();
+        update_password_display(game);
+        TRACE_END();
+
+        // Report background saves that finished since the last frame
+        reap_save_snapshot(game, &message_queue, false);
+        flush_users_if_due(manager);
 
         // Display messages
+        perf_phase(perf, PERF_RENDER);
         draw_messages(&message_queue, 0, MAP_WIDTH+1);
+        perf_phase(perf, PERF_LOGIC);
         update_messages(&message_queue);
         
+        TRACE_BEGIN("update_food_inventory");
         update_food_inventory(player, &message_queue);
+        TRACE_END();
         // Handle input
         
-        int key = getch();
+        perf_end_turn(perf);
+        spectate_publish(manager->current_user ? manager->current_user->username : "Guest");
+        cast_frame();
+        TRACE_END();   // turn
+        TRACE_BEGIN("input");
+        int key = input_getch();
+        TRACE_END();
+        TRACE_BEGIN("turn");
+        perf_phase(perf, PERF_LOGIC);
+
+        if (key == 'l' || key == 'L') {
+            open_message_log(&message_queue);
+            continue;
+        }
+
+        if (key == 'p' || key == 'P') {
+            show_perf = !show_perf;
+            perf->bytes_mark = 0;
+            continue;
+        }
 
         if (key == 's') {
             // For each of the 8 neighbors (dx = -1..+1, dy=-1..+1)
@@ -229,35 +373,35 @@ void play_game(struct UserManager* manager, struct Map* game_map,
         }
 
         if (key == 'g') {
-            skipCollectNext = true;
+            game->skip_collect_next = true;
             add_game_message(&message_queue, "The next tile you step on won't collect its item.", 2);
         }
 
 
-        if (!run_mode && key == 'f') {
+        if (!game->run_mode && key == 'f') {
             // The next arrow key will set run_mode direction
             add_game_message(&message_queue, 
                 "Press an arrow key to run continuously in that direction...",
                 2);
-            run_mode = true;
+            game->run_mode = true;
             continue; // wait for next input
         }
-        if (run_mode) {
+        if (game->run_mode) {
             // The user pressed 'f' previously, so we expect an arrow key
             // decide direction
             switch (key) {
-                case KEY_UP:    run_dx=0;  run_dy=-1; run_mode=false; break;
-                case KEY_DOWN:  run_dx=0;  run_dy=+1; run_mode=false; break;
-                case KEY_LEFT:  run_dx=-1; run_dy=0;  run_mode=false; break;
-                case KEY_RIGHT: run_dx=+1; run_dy=0;  run_mode=false; break;
+                case KEY_UP:    game->run_dx=0;  game->run_dy=-1; break;
+                case KEY_DOWN:  game->run_dx=0;  game->run_dy=+1; break;
+                case KEY_LEFT:  game->run_dx=-1; game->run_dy=0;  break;
+                case KEY_RIGHT: game->run_dx=+1; game->run_dy=0;  break;
                 default:
                     // invalid direction => cancel run_mode
-                    run_mode=false;
                     break;
             }
-            if (!run_mode && (run_dx!=0 || run_dy!=0)) {
+            game->run_mode = false;
+            if (game->run_dx!=0 || game->run_dy!=0) {
                 // Now we actually run
-                run_in_direction(player, game_map, run_dx, run_dy);
+                run_in_direction(player, game_map, game->run_dx, game->run_dy);
             }
             continue;
         }
@@ -271,7 +415,7 @@ void play_game(struct UserManager* manager, struct Map* game_map,
 
         else if (key=='z'){
             if (manager->current_user)
-                save_current_game(manager, game_map, player, current_level);
+                save_current_game(game, manager, game_map, player, current_level);
         }
 
 
@@ -289,15 +433,28 @@ void play_game(struct UserManager* manager, struct Map* game_map,
             case '8':
             case '9':
                 // Move the character
-                move_character(player, key, game_map, &player->hitpoints, &message_queue);
+                TRACE_BEGIN("move_character");
+                move_character(game, player, key, game_map, &player->hitpoints, &message_queue);
+                TRACE_END();
 
+                TRACE_BEGIN("update_enemies");
+                perf->entities_ticked += game_map->enemy_count;
                 update_enemies(game_map, player, &message_queue);
+                TRACE_END();
                 // Check the tile the player moves onto
                 char tile = game_map->grid[player->location.y][player->location.x];
 
+                // A snapshot child may still be reading floors from the spill
+                // file that changing floors writes over
+                if (tile == STAIRS || tile == STAIRS_UP) reap_save_snapshot(game, &message_queue, true);
+
                 if (tile == STAIRS) {
                     // Handle level up logic
-                    if (current_level < max_level) {
+                    if (current_level < max_level && switch_floor(levels, game_map, &current_level, current_level + 1)) {
+                        add_game_messagef(&message_queue, 3, "Back down to Level %d.", current_level);
+                    } else if (current_level < max_level) {
+                        // Keep this floor for the way back up
+                        if (levels) level_store_put(levels, current_level, game_map, current_level + 1);
                         current_level++;
                         struct Room* current_room = NULL;
 
@@ -314,26 +471,36 @@ void play_game(struct UserManager* manager, struct Map* game_map,
                         int stair_y = player->location.y;
                         Room* old_room = find_room_by_position(game_map, player->location.x, player->location.y);
 
+                        input_begin_level(current_level);
                         struct Map new_map = generate_map(manager, current_room, current_level, max_level, stair_x, stair_y);
                         *game_map = new_map;
 
+                        audio_play_effect(SFX_LEVEL_UP);
                         add_game_message(&message_queue, "Level up! Welcome to Level.", 3); // COLOR_PAIR_WEAPONS
                         // Optionally, append the level number to the message
-                        char level_msg[50];
-                        snprintf(level_msg, sizeof(level_msg), "Level up! Welcome to Level %d.", current_level);
-                        add_game_message(&message_queue, level_msg, 3);
+                        add_game_messagef(&message_queue, 3, "Level up! Welcome to Level %d.", current_level);
                         // Reset player stats or adjust as needed
                     } else {
                         // Final level completion (Treasure Room reached)
-                        finalize_victory(manager, player);
+                        finalize_victory(game, manager, player);
                         //add_game_message(&message_queue, "Congratulations! You've completed all levels.", 2); // COLOR_PAIR_UNLOCKED_DOOR
                         game_running = false;
                     }
                 }
                 
                 
+                else if (tile == STAIRS_UP) {
+                    // '<' sits where the '>' of the floor above was, so the player
+                    // arrives standing on it
+                    if (switch_floor(levels, game_map, &current_level, current_level - 1)) {
+                        add_game_messagef(&message_queue, 3, "You climb back up to Level %d.", current_level);
+                    } else {
+                        add_game_message(&message_queue, "The stairs up are blocked: the floor above is gone.", 7);
+                    }
+                }
+
                 else if (tile == TREASURE_CHEST_SYM) {
-                    finalize_victory(manager, player);
+                    finalize_victory(game, manager, player);
                     game_running = false;
                     // Handle treasure chest
                     // Example: Increase score or provide rewards
@@ -352,6 +519,7 @@ void play_game(struct UserManager* manager, struct Map* game_map,
                                 trap->triggered = true;
                                 game_map->grid[player->location.y][player->location.x] = TRAP_SYMBOL;
                                 player->hitpoints -= 10;
+                                audio_play_effect(SFX_TRAP);
                                 add_game_message(&message_queue, "You triggered a trap! Hitpoints decreased.", 4); // COLOR_PAIR_TRAPS
                             }
                             break;
@@ -377,7 +545,7 @@ void play_game(struct UserManager* manager, struct Map* game_map,
                     } else {
                         // Ranged usage - ask user for direction every time
                         throw_ranged_weapon_with_drop(player, w, game_map, &message_queue,
-                                                    last_dx, last_dy);
+                                                    game->last_dx, game->last_dy);
                     }
                 }
                 break;
@@ -397,9 +565,9 @@ void play_game(struct UserManager* manager, struct Map* game_map,
                         use_melee_weapon(player, w, game_map, &message_queue);
                     } else {
                         // Ranged usage - ask user for direction every time
-                        ask_ranged_direction(&last_dx, &last_dy, w->name);
+                        ask_ranged_direction(&game->last_dx, &game->last_dy, w->name);
                         throw_ranged_weapon_with_drop(player, w, game_map, &message_queue,
-                                                    last_dx, last_dy);
+                                                    game->last_dx, game->last_dy);
                     }
                 }
                 break;
@@ -412,13 +580,20 @@ void play_game(struct UserManager* manager, struct Map* game_map,
 
             case 'q':
                 if(manager->current_user)
-                    save_current_game(manager, game_map, player, current_level);
+                    save_current_game(game, manager, game_map, player, current_level);
 
                 game_running = false;
                 break;
         }
         frame_count++;
     }
+    TRACE_END();   // turn
+
+    // Don't leave the menu while a snapshot is still being written
+    reap_save_snapshot(game, &message_queue, true);
+    flush_users(manager);
+    game_context_free(game);
+    game_context_set_current(NULL);
 }
 
 void print_full_map(struct Map* game_map, struct Point* character_location, struct UserManager* manager) {
@@ -681,6 +856,9 @@ struct Map generate_map(struct UserManager* manager, struct Room* previous_room,
         
         // Draw the big room
         place_room(&map, &map.rooms[0]);
+        if (stair_x != 0 && stair_y != 0) {
+            map.grid[stair_y][stair_x] = STAIRS_UP;
+        }
 
         // Add items for the final treasure area:
         // e.g. lots of enemies, gold, spells
@@ -727,7 +905,7 @@ struct Map generate_map(struct UserManager* manager, struct Room* previous_room,
         place_room(&map, &map.rooms[0]);
 
         if (stair_x != 0 && stair_y != 0){
-            map.grid[stair_y][stair_x] = '<'; // or some tile
+            map.grid[stair_y][stair_x] = STAIRS_UP; // or some tile
         }
 
         // If you also want to place your usual random rooms, 
@@ -747,7 +925,8 @@ struct Map generate_map(struct UserManager* manager, struct Room* previous_room,
     }
 
     // Generate additional rooms
-    for (int i = (previous_room ? 1 : 0); i < num_rooms; i++) {  // Skip first room if previous_room exists
+    // The kept room takes two slots above, so stop before overrunning rooms[]
+    for (int i = (previous_room ? 1 : 0); i < num_rooms && map.room_count < MAX_ROOMS; i++) {  // Skip first room if previous_room exists
         struct Room room;
         int attempts = 0;
         bool placed = false;
@@ -953,7 +1132,7 @@ void open_inventory_menu(Player* player, struct MessageQueue* message_queue, str
     bool menu_open = true;
 
     while (menu_open) {
-        clear();
+        erase();
         mvprintw(0, 0, "=== Inventory ===");
 
         //---------------------------------
@@ -969,7 +1148,7 @@ void open_inventory_menu(Player* player, struct MessageQueue* message_queue, str
         int magical_count  = 0;
         int rotten_count   = 0;
 
-        time_t now = time(NULL);
+        time_t now = game_time();
 
         // Tally
         for (int i = 0; i < player->food_count; i++) {
@@ -1017,7 +1196,7 @@ void open_inventory_menu(Player* player, struct MessageQueue* message_queue, str
         //---------------------------------
         char input[32];
         echo();
-        getnstr(input, sizeof(input) - 1);
+        input_getnstr(input, sizeof(input) - 1);
         noecho();
 
         if (!strlen(input)) continue;  // If empty, just re-print
@@ -1152,7 +1331,7 @@ void add_food(struct Map* map, Player* player) {
             map->foods[map->food_count].type = type;
             map->foods[map->food_count].position.x = x;
             map->foods[map->food_count].position.y = y;
-            map->foods[map->food_count].spawn_time = time(NULL);
+            map->foods[map->food_count].spawn_time = game_time();
             map->foods[map->food_count].consumed = false;
 
             // Assign symbol based on food type
@@ -1188,13 +1367,13 @@ void add_food(struct Map* map, Player* player) {
 }
 
 void update_food_inventory(Player* player, struct MessageQueue* message_queue) {
-    time_t current_time = time(NULL);
+    time_t current_time = game_time();
     for (int i = 0; i < player->food_count; i++) {
         Food* food = &player->foods[i];
         if (!food->consumed && difftime(current_time, food->pickup_time) >= 60.0) {
             if (food->type == FOOD_GREAT || food->type == FOOD_MAGICAL) {
                 food->type = FOOD_NORMAL;
-                food->pickup_time = time(NULL);
+                food->pickup_time = game_time();
                 add_game_message(message_queue, "Great or Magical Food has turned into Normal Food.", 14);
             } else if (food->type == FOOD_NORMAL) {
                 food->type = FOOD_ROTTEN;
@@ -1204,14 +1383,14 @@ void update_food_inventory(Player* player, struct MessageQueue* message_queue) {
 }
 
 void open_food_inventory_menu(Player* player, struct MessageQueue* message_queue) {
-    clear();
+    erase();
     
     // Tally how many of each type are unconsumed
     int normal_count = 0;
     int great_count = 0;
     int magical_count = 0;
     
-    time_t current_time = time(NULL);
+    time_t current_time = game_time();
 
     // Track the most recent pickup_time for each type, to show elapsed seconds
     time_t normal_last_pick = 0;
@@ -1281,7 +1460,7 @@ void open_food_inventory_menu(Player* player, struct MessageQueue* message_queue
     // Input (example approach)
     char input[32];
     echo();
-    getnstr(input, 31);
+    input_getnstr(input, 31);
     noecho();
 
     if (tolower(input[0]) == 'q') {
@@ -1324,7 +1503,7 @@ void open_food_inventory_menu(Player* player, struct MessageQueue* message_queue
         }
     }
     // If typed something else, just ignore or handle error
-    getch();  // pause to let user see any resulting messages
+    input_getch();  // pause to let user see any resulting messages
 }
 
 void print_map(struct Map* game_map,
@@ -1787,7 +1966,7 @@ void place_password_generator_in_corner(struct Map* map, struct Room* room) {
     // (This is unlikely if the room is large enough).
 }
 
-void move_character(Player* player, int key, struct Map* game_map, int* hitpoints, struct MessageQueue* message_queue){
+void move_character(struct GameContext* game, Player* player, int key, struct Map* game_map, int* hitpoints, struct MessageQueue* message_queue){
     int steps_to_move = (player->speed_spell_steps > 0) ? 2 : 1;
 
     for (int step = 0; step < steps_to_move; step++) {
@@ -1839,16 +2018,16 @@ void move_character(Player* player, int key, struct Map* game_map, int* hitpoint
                     snprintf(current_room->door_code, sizeof(current_room->door_code), "%04d", code_num);
                 }
 
-                // Store the code in our global variable
-                strncpy(current_code, current_room->door_code, sizeof(current_code) - 1);
-                current_code[sizeof(current_code) - 1] = '\0';
+                // Keep a copy for the on-screen display
+                strncpy(game->current_code, current_room->door_code, sizeof(game->current_code) - 1);
+                game->current_code[sizeof(game->current_code) - 1] = '\0';
 
                 // Mark it visible and reset the timer
-                code_visible = true;
-                code_start_time = time(NULL);
+                game->code_visible = true;
+                game->code_start_time = game_time();
 
                 // Call our display function right away so it appears immediately
-                update_password_display();
+                update_password_display(game);
             }
         }
 
@@ -1860,15 +2039,15 @@ void move_character(Player* player, int key, struct Map* game_map, int* hitpoint
                 player->location = new_location;
             } else {
                 // if the user has at least 1 key, let them choose
-                bool has_key = (ancient_key_count > 0);
+                bool has_key = (player->ancient_key_count > 0);
                 bool used_key = false;
 
                 if (has_key) {
                     // Ask user if they'd like to use the Ancient Key or enter password
-                    clear();
+                    erase();
                     mvprintw(2, 2, "Door is locked! You have an Ancient Key. Use it? (y/n)");
                     refresh();
-                    int c = getch();
+                    int c = input_getch();
                     if (c == 'y' || c == 'Y') {
                         used_key = true;
                     }
@@ -1879,25 +2058,27 @@ void move_character(Player* player, int key, struct Map* game_map, int* hitpoint
                     // 10% break chance
                     if ((rand() % 100) < 10) {
                         // Key breaks => lose 1 key, gain 1 broken piece
-                        ancient_key_count--;
-                        broken_key_count++;
+                        player->ancient_key_count--;
+                        player->broken_key_count++;
                         mvprintw(4, 2, "The Ancient Key broke!");
                     } else {
                         // Key successfully used => remove 1 key
-                        ancient_key_count--;
+                        player->ancient_key_count--;
                         door_room->password_unlocked = true; 
+                        audio_play_effect(SFX_DOOR);
                         mvprintw(4, 2, "Door unlocked with the Ancient Key!");
                         // Player can pass through now
                         player->location = new_location;
                     }
                     refresh();
-                    getch();
+                    input_getch();
                     return; 
                 } else {
                     // Normal prompt for password (as before)...
                     bool success = prompt_for_password_door(door_room);
                     if (success) {
                         door_room->password_unlocked = true;
+                        audio_play_effect(SFX_DOOR);
                         player->location = new_location;
                     }
                     return;
@@ -1908,10 +2089,10 @@ void move_character(Player* player, int key, struct Map* game_map, int* hitpoint
         else if (target_tile == ANCIENT_KEY) {
             // Pick up the Ancient Key
             game_map->grid[new_location.y][new_location.x] = FLOOR; // Remove the key from the map
-            ancient_key_count++;
+            player->ancient_key_count++;
             add_game_message(message_queue, "You picked up an Ancient Key!", 2); //at the time 2 is the color green
             refresh();
-            getch();
+            input_getch();
         }
 
         
@@ -1921,7 +2102,7 @@ void move_character(Player* player, int key, struct Map* game_map, int* hitpoint
             game_map->grid[new_location.y][new_location.x] = SECRET_DOOR_REVEALED;
             add_game_message(message_queue, "You discovered a secret door!", 2); //at the time 2 is the color green
             refresh();
-            getch();
+            input_getch();
             // Move the player through the revealed secret door
             player->location = new_location;
             return;
@@ -1947,10 +2128,10 @@ void move_character(Player* player, int key, struct Map* game_map, int* hitpoint
 
         // Otherwise, it's considered passable:
         //   (Floor, Corridor, Food, Gold, 
-        //    OR password door with hasPassword==true)
+        //    OR an unlocked password door)
         player->location = new_location;
 
-        if (!skipCollectNext) {
+        if (!game->skip_collect_next) {
 
             handle_weapon_pickup(player, game_map, new_location, message_queue);
 
@@ -1963,7 +2144,7 @@ void move_character(Player* player, int key, struct Map* game_map, int* hitpoint
 
             else {
                 // We skip it this time
-                skipCollectNext = false; // reset so next tile collects again
+                game->skip_collect_next = false; // reset so next tile collects again
             }
 
         // -----------------------------------------------------------
@@ -2013,7 +2194,9 @@ void move_character(Player* player, int key, struct Map* game_map, int* hitpoint
     }
 }
 
-void finalize_victory(struct UserManager* manager, Player* player) {
+void finalize_victory(struct GameContext* game, struct UserManager* manager, Player* player) {
+    audio_play_effect(SFX_VICTORY);
+    reap_save_snapshot(game, NULL, true);  // A pending snapshot would recreate the save below
     if (manager->current_user->username != "guest") {
         // Remove last save
         char filename[256];
@@ -2021,28 +2204,32 @@ void finalize_victory(struct UserManager* manager, Player* player) {
         remove(filename);
 
         // Add the player's current gold/score to the user
-        manager->current_user->score += player->current_score; 
+        begin_user_update(manager, manager->current_user);
+        update_user_score(manager, manager->current_user,
+                          manager->current_user->score + player->current_score);
         manager->current_user->gold  += player->current_gold;
         manager->current_user->games_completed ++;
-        save_users_to_json(manager);
+        save_user(manager, manager->current_user, USER_FIELD_SCORE | USER_FIELD_GOLD | USER_FIELD_GAMES);
 
-        clear();
+        erase();
         printw("Congratulations, you reached the treasure room!\n");
         printw("Game Finished! Gold and Score saved successfully!");
-        getch();
+        input_getch();
     }
 }
 
-void handle_death(struct UserManager* manager, Player* player) {
+void handle_death(struct GameContext* game, struct UserManager* manager, Player* player) {
+    reap_save_snapshot(game, NULL, true);  // A pending snapshot would recreate the save below
     // same idea: remove the .sav
     if (manager->current_user) {
         char filename[256];
         snprintf(filename, sizeof(filename), "saves/%s.sav", manager->current_user->username);
         remove(filename);
     }
-    clear();
+    flush_users(manager);
+    erase();
     printw("You lost the match! Better luck next time.\nPress any key to continue.\n");
-    getch();
+    input_getch();
 }
 
 bool prompt_for_password_door(Room* door_room) {
@@ -2052,7 +2239,7 @@ bool prompt_for_password_door(Room* door_room) {
 
     for (int attempt = 1; attempt <= 3; attempt++) {
         // Clear the screen so we're on a "special page"
-        clear();
+        erase();
 
         // Prompt text
         mvprintw(2, 2, "You have encountered a locked door.");
@@ -2080,7 +2267,7 @@ bool prompt_for_password_door(Room* door_room) {
         // Read the input
         echo();
         char entered[5];
-        getnstr(entered, 4);
+        input_getnstr(entered, 4);
         noecho();
 
         // Check if user typed nothing
@@ -2093,12 +2280,12 @@ bool prompt_for_password_door(Room* door_room) {
         // Compare with door_room->door_code
         if (strcmp(entered, door_room->door_code) == 0) {
             // Correct => unlock
-            clear();
+            erase();
             attron(COLOR_PAIR(2)); // or some "success" color if you want
             mvprintw(2, 2, "Door unlocked successfully!");
             attroff(COLOR_PAIR(2));
             refresh();
-            getch();
+            input_getch();
             return true;  // success
         }
         else {
@@ -2108,12 +2295,12 @@ bool prompt_for_password_door(Room* door_room) {
     }
 
     // If we get here, the user has failed 3 attempts
-    clear();
+    erase();
     attron(COLOR_PAIR(7)); // Red for final fail
     mvprintw(2, 2, "Too many wrong attempts! The door remains locked.");
     attroff(COLOR_PAIR(7));
     refresh();
-    getch();
+    input_getch();
     return false; // remain locked
 }
 
@@ -2144,19 +2331,19 @@ void print_password_messages(const char* message, int line_offset) {
     refresh();
 }
 
-void update_password_display() {
-    if (!code_visible) return;
+void update_password_display(struct GameContext* game) {
+    if (!game->code_visible) return;
 
-    double elapsed = difftime(time(NULL), code_start_time);
+    double elapsed = difftime(game_time(), game->code_start_time);
     if (elapsed > 30.0) {
-        code_visible = false;
+        game->code_visible = false;
         print_password_messages("                              ", MAP_HEIGHT + 5);
         print_password_messages("                              ", MAP_HEIGHT + 6);
     } else {
         char msg[128], msg2[128];
         snprintf(msg, sizeof(msg),
                  "Room code: %s",
-                 current_code);
+                 game->current_code);
         snprintf(msg2, sizeof(msg2),
                  "(%.0f seconds left)",
                  30.0 - elapsed);
@@ -2196,8 +2383,8 @@ void init_map(struct Map* map) {
         map->foods[i].spawn_time = 0;
     }
 
-    map->last_hunger_decrease = time(NULL);
-    map->last_attack_time = time(NULL);
+    map->last_hunger_decrease = game_time();
+    map->last_attack_time = game_time();
 }
 
 /// Place a certain number of gold piles in a single room
@@ -2245,22 +2432,21 @@ void handle_gold_collection(Player* player, struct Map* map, struct MessageQueue
             GoldType type = map->golds[i].type;
             map->golds[i].collected = true;
             map->grid[pos.y][pos.x] = FLOOR; // Remove gold symbol from map
+            audio_play_effect(SFX_GOLD);
 
             if (type == GOLD_NORMAL) {
                 int gold_amount = rand() % 100 + 1; // Random between 1 and 100
                 player->current_gold += gold_amount;
                 player->current_score += gold_amount;
-                char message[100];
-                snprintf(message, sizeof(message), "You collected Normal Gold: +%d Gold.", gold_amount);
-                add_game_message(message_queue, message, COLOR_PAIR_HEALTH); // Green color
+                add_game_messagef(message_queue, COLOR_PAIR_HEALTH, // Green color
+                                  "You collected Normal Gold: +%d Gold.", gold_amount);
             }
             else if (type == GOLD_BLACK) {
                 int gold_amount = (rand() % 100 + 1) * 2; // Twice normal gold
                 player->current_gold += gold_amount;
                 player->current_score += gold_amount;
-                char message[100];
-                snprintf(message, sizeof(message), "You collected Black Gold: +%d Gold.", gold_amount);
-                add_game_message(message_queue, message, COLOR_PAIR_SPEED); // Blue color
+                add_game_messagef(message_queue, COLOR_PAIR_SPEED, // Blue color
+                                  "You collected Black Gold: +%d Gold.", gold_amount);
             }
 
             break; // Assuming only one gold item per tile
@@ -2277,42 +2463,99 @@ int manhattanDistance(int x1, int y1, int x2, int y2) {
     return abs(x1 - x2) + abs(y1 - y2);
 }
 
-void add_game_message(struct MessageQueue* queue, const char* text, int color_pair) {
-    if (queue->count >= MAX_MESSAGES) {
-        // Shift messages up
-        for (int i = 0; i < MAX_MESSAGES - 1; i++) {
-            queue->messages[i] = queue->messages[i + 1];
+#define MESSAGE_SLOT(queue, index) (&(queue)->messages[(index) & (MESSAGE_HISTORY - 1)])
+
+// Keeps the message just written into the free slot, or folds it into the
+// newest one if it says the same thing
+static void commit_message(struct MessageQueue* queue, int color_pair) {
+    struct GameMessage* msg = MESSAGE_SLOT(queue, queue->count);
+    msg->expires = queue->turn + MESSAGE_TTL;
+    msg->color_pair = color_pair;
+
+    if (queue->count > 0) {
+        struct GameMessage* newest = MESSAGE_SLOT(queue, queue->count - 1);
+        if (newest->color_pair == color_pair && strcmp(newest->text, msg->text) == 0) {
+            newest->repeats++;
+            newest->expires = msg->expires;
+            if (queue->first_shown == queue->count) queue->first_shown--;
+            return;
         }
-        queue->count--;
     }
-    
-    struct GameMessage* msg = &queue->messages[queue->count];
-    strncpy(msg->text, text, MESSAGE_LENGTH - 1);
-    msg->text[MESSAGE_LENGTH - 1] = '\0';
-    msg->time_to_live = 10;  // Show for ~2 seconds at 30 fps
-    msg->color_pair = color_pair;
+    msg->repeats = 1;
     queue->count++;
+    // Only the newest MAX_MESSAGES fit beside the map
+    if (queue->count - queue->first_shown > MAX_MESSAGES) queue->first_shown = queue->count - MAX_MESSAGES;
 }
 
+void add_game_message(struct MessageQueue* queue, const char* text, int color_pair) {
+    struct GameMessage* msg = MESSAGE_SLOT(queue, queue->count);
+    size_t length = strlen(text);
+    if (length > MESSAGE_LENGTH - 1) length = MESSAGE_LENGTH - 1;
+    memcpy(msg->text, text, length);
+    msg->text[length] = '\0';
+    commit_message(queue, color_pair);
+}
+
+// Formats straight into the free slot, so callers need no buffer of their own
+void add_game_messagef(struct MessageQueue* queue, int color_pair, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(MESSAGE_SLOT(queue, queue->count)->text, MESSAGE_LENGTH, format, args);
+    va_end(args);
+    commit_message(queue, color_pair);
+}
+
+// Called once a turn. Expiry follows insertion order, so this only ever
+// looks at the oldest message on screen.
 void update_messages(struct MessageQueue* queue) {
-    for (int i = 0; i < queue->count; i++) {
-        queue->messages[i].time_to_live--;
-        if (queue->messages[i].time_to_live <= 0) {
-            // Remove this message
-            for (int j = i; j < queue->count - 1; j++) {
-                queue->messages[j] = queue->messages[j + 1];
-            }
-            queue->count--;
-            i--;
-        }
+    queue->turn++;
+    while (queue->first_shown < queue->count &&
+           MESSAGE_SLOT(queue, queue->first_shown)->expires <= queue->turn) {
+        queue->first_shown++;
     }
 }
 
+static void draw_message(const struct GameMessage* msg, int y, int x) {
+    attron(COLOR_PAIR(msg->color_pair));
+    mvaddstr(y, x, msg->text);
+    if (msg->repeats > 1) printw(" x%d", msg->repeats);
+    attroff(COLOR_PAIR(msg->color_pair));
+}
+
 void draw_messages(struct MessageQueue* queue, int start_y, int start_x) {
-    for (int i = 0; i < queue->count; i++) {
-        attron(COLOR_PAIR(queue->messages[i].color_pair));
-        mvprintw(start_y + i, start_x, "%s", queue->messages[i].text);
-        attroff(COLOR_PAIR(queue->messages[i].color_pair));
+    for (unsigned long i = queue->first_shown; i < queue->count; i++) {
+        draw_message(MESSAGE_SLOT(queue, i), start_y + (int)(i - queue->first_shown), start_x);
+    }
+}
+
+// Every message still in the ring, oldest first, a screen at a time ('l')
+void open_message_log(struct MessageQueue* queue) {
+    unsigned long kept = MIN(queue->count, MESSAGE_HISTORY - 1);
+    unsigned long oldest = queue->count - kept;
+    int rows = MAX(LINES - 4, 1);
+    long last_top = MAX((long)kept - rows, 0);
+    long top = last_top;   // Open at the newest messages
+
+    while (true) {
+        erase();
+        mvprintw(0, 0, "Message Log (%lu messages)", kept);
+        if (kept == 0) mvprintw(2, 0, "No messages yet.");
+        for (int row = 0; row < rows && top + row < (long)kept; row++) {
+            draw_message(MESSAGE_SLOT(queue, oldest + top + row), row + 2, 0);
+        }
+        mvprintw(LINES - 1, 0, "Up/Down - scroll   PgUp/PgDn - page   any other key - back");
+        refresh();
+
+        switch (input_getch()) {
+            case KEY_UP:    top--; break;
+            case KEY_DOWN:  top++; break;
+            case KEY_PPAGE: top -= rows; break;
+            case KEY_NPAGE: top += rows; break;
+            case KEY_HOME:  top = 0; break;
+            case KEY_END:   top = last_top; break;
+            default:        return;
+        }
+        top = MAX(MIN(top, last_top), 0);
     }
 }
 
@@ -2457,65 +2700,244 @@ void place_pillars(struct Map* map, struct Room* room) {
     }
 }
 
-void save_current_game(struct UserManager* manager, struct Map* game_map, 
-                       Player* player, int current_level) {
+// Header bytes present in every version; v2 appended the checksum
+#define SAVE_HEADER_V1_SIZE offsetof(struct SaveFileHeader, checksum)
+
+static uint32_t save_checksum(struct SaveFileHeader header, const uint8_t* payload,
+                              const uint8_t* floors, size_t floors_size) {
+    header.checksum = 0;
+    uint32_t crc = crc32c(0, &header, sizeof(header));
+    crc = crc32c(crc, payload, header.stored_size);
+    return crc32c(crc, floors, floors_size);
+}
+
+// 'levels' may be NULL: the save then carries no floors
+bool write_save_file(const char* filename, const struct SavedGame* save, const struct LevelStore* levels) {
+    TRACE_SCOPE("write_save_file");
+    struct SaveFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SAVE_MAGIC, sizeof(header.magic));
+    header.version  = SAVE_FORMAT_VERSION;
+    header.flags    = 0;
+    header.raw_size = sizeof(*save);
+
+    const uint8_t* payload = (const uint8_t*)save;
+    uint8_t* packed = NULL;
+    size_t payload_size = sizeof(*save);
+
+    if (SAVE_COMPRESSION) {
+        packed = malloc(COMPRESS_BOUND(sizeof(*save)));
+        size_t packed_size = packed ? compress_buffer(payload, sizeof(*save),
+                                                      packed, COMPRESS_BOUND(sizeof(*save))) : 0;
+        // Keep the raw payload if compression fails or does not help
+        if (packed_size > 0 && packed_size < sizeof(*save)) {
+            payload = packed;
+            payload_size = packed_size;
+            header.flags |= SAVE_FLAG_COMPRESSED;
+        }
+    }
+    header.stored_size = (uint32_t)payload_size;
+
+    uint8_t* floors = NULL;
+    size_t floors_size = 0;
+    if (levels && !level_store_serialize(levels, &floors, &floors_size)) {
+        free(packed);
+        return false;
+    }
+    header.checksum = save_checksum(header, payload, floors, floors_size);
+
+    // Write next to the target and rename, so a save is never seen half-written.
+    // The temporary name is per process: two games saving the same file each
+    // write their own copy and the last rename wins whole.
+    char tmp_filename[300];
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp.%d", filename, (int)getpid());
+
+    FILE* file = fopen(tmp_filename, "wb");
+    bool ok = (file != NULL);
+    if (ok) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(payload, payload_size, 1, file) == 1 &&
+             (floors_size == 0 || fwrite(floors, floors_size, 1, file) == 1);
+        ok = (fclose(file) == 0) && ok;
+        ok = ok && rename(tmp_filename, filename) == 0;
+        if (!ok) remove(tmp_filename);
+    }
+
+    free(packed);
+    free(floors);
+    return ok;
+}
+
+// The floors a v3 save carries go into 'levels'; NULL skips them
+SaveStatus read_save_file(const char* filename, struct SavedGame* save, struct LevelStore* levels) {
+    TRACE_SCOPE("read_save_file");
+    FILE* file = fopen(filename, "rb");
+    if (!file) return SAVE_MISSING;
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
+
+    struct SaveFileHeader header;
+    memset(&header, 0, sizeof(header));
+    bool has_header = fread(&header, SAVE_HEADER_V1_SIZE, 1, file) == 1 &&
+                      memcmp(header.magic, SAVE_MAGIC, sizeof(header.magic)) == 0;
+
+    if (!has_header) {
+        // Legacy save: the file must be exactly one raw SavedGame
+        bool ok = file_size == (long)sizeof(*save);
+        if (ok) {
+            rewind(file);
+            ok = fread(save, sizeof(*save), 1, file) == 1;
+        }
+        fclose(file);
+        return ok ? SAVE_OK : SAVE_CORRUPTED;
+    }
+
+    bool ok = header.version >= 1 && header.version <= SAVE_FORMAT_VERSION &&
+              header.raw_size == sizeof(*save);
+    if (ok && header.version >= 2) {
+        ok = fread(&header.checksum, sizeof(header.checksum), 1, file) == 1;
+    }
+    // Whatever follows the payload is floors, which only v3 has
+    long floors_size = ok ? file_size - ftell(file) - (long)header.stored_size : 0;
+    ok = ok && (header.version >= 3 ? floors_size >= 0 : floors_size == 0);
+
+    uint8_t* payload = ok ? malloc(header.stored_size ? header.stored_size : 1) : NULL;
+    uint8_t* floors = ok ? malloc(floors_size ? (size_t)floors_size : 1) : NULL;
+    ok = ok && payload != NULL && fread(payload, header.stored_size, 1, file) == 1 &&
+         floors != NULL && (floors_size == 0 || fread(floors, (size_t)floors_size, 1, file) == 1);
+    fclose(file);
+
+    // Version 1 files predate checksums and rely on the size checks above
+    if (ok && header.version >= 2) {
+        ok = save_checksum(header, payload, floors, (size_t)floors_size) == header.checksum;
+    }
+
+    if (ok && (header.flags & SAVE_FLAG_COMPRESSED)) {
+        ok = decompress_buffer(payload, header.stored_size,
+                               (uint8_t*)save, sizeof(*save)) == sizeof(*save);
+    } else if (ok) {
+        ok = header.stored_size == sizeof(*save);
+        if (ok) memcpy(save, payload, sizeof(*save));
+    }
+    if (ok && levels) {
+        ok = level_store_deserialize(levels, floors, (size_t)floors_size, save->current_level);
+    }
+
+    free(payload);
+    free(floors);
+    return ok ? SAVE_OK : SAVE_CORRUPTED;
+}
+
+static void fill_saved_game(struct SavedGame* save, struct Map* game_map,
+                            Player* player, int current_level) {
+    memset(save, 0, sizeof(*save));  // Zero padding and unused fields so they compress away
+    save->game_map = *game_map;
+    save->player   = *player;
+    save->current_level = current_level;
+    save->save_time = game_time();
+    // We do not ask for name => skip "char name[]"
+}
+
+// Forks a child that serializes the parent's copy-on-write view of the game
+// and writes it out. The parent returns at once; the child's result is
+// collected by reap_save_snapshot. Returns false if fork failed.
+static bool start_save_snapshot(struct GameContext* game, const char* filename,
+                                struct Map* game_map, Player* player, int current_level) {
+    TRACE_SCOPE("save_snapshot");
+    // Only one writer per save file at a time
+    reap_save_snapshot(game, NULL, true);
+
+    pid_t pid = fork();
+    if (pid < 0) return false;
+
+    if (pid == 0) {
+        // Child: never touch curses or stdio buffers inherited from the parent
+        static struct SavedGame save;
+        fill_saved_game(&save, game_map, player, current_level);
+        _exit(write_save_file(filename, &save, game->levels) ? 0 : 1);
+    }
+
+    game->pending_save_pid = pid;
+    return true;
+}
+
+bool reap_save_snapshot(struct GameContext* game, struct MessageQueue* queue, bool block) {
+    if (game->pending_save_pid <= 0) return true;
+
+    int status = 0;
+    pid_t done = waitpid(game->pending_save_pid, &status, block ? 0 : WNOHANG);
+    if (done == 0) return false;  // Still writing
+
+    game->pending_save_pid = 0;
+    bool ok = done > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (queue) {
+        add_game_message(queue, ok ? "Game saved." : "Error: Background save failed!", ok ? 2 : 7);
+    } else if (!ok) {
+        mvprintw(2, 0, "Error: Background save failed!");
+        input_getch();
+    }
+    return true;
+}
+
+void save_current_game(struct GameContext* game, struct UserManager* manager,
+                       struct Map* game_map, Player* player, int current_level) {
     if (!manager->current_user) {
         mvprintw(0, 0, "Cannot save game as guest user.");
         refresh();
-        getch();
+        input_getch();
         return;
     }
 
-    save_users_to_json(manager);  // So scoreboard is updated
+    flush_users(manager);  // So scoreboard is updated (no-op if nothing changed)
 
     char filename[256];
     snprintf(filename, sizeof(filename), "saves/%s.sav", manager->current_user->username);
 
-    FILE* file = fopen(filename, "wb");
-    if (!file) {
-        mvprintw(2, 0, "Error: Could not create save file.");
-        getch();
+    // Snapshot mode: the pause is one fork(), whatever the size of the level
+    if (game->snapshot_saves && start_save_snapshot(game, filename, game_map, player, current_level)) {
         return;
     }
 
     struct SavedGame save;
-    save.game_map = *game_map;
-    save.player   = *player;
-    save.current_level = current_level;
-    save.save_time = time(NULL);
-    // We do not ask for name => skip "char name[]"
+    fill_saved_game(&save, game_map, player, current_level);
     
-    fwrite(&save, sizeof(save), 1, file);
-    fclose(file);
+    if (!write_save_file(filename, &save, game->levels)) {
+        mvprintw(2, 0, "Error: Could not create save file.");
+        input_getch();
+        return;
+    }
     if (manager->current_user->username != "guest"){
         noecho();
         mvprintw(2, 0, "Game saved successfully!");
         echo();
-        getch();
+        input_getch();
     }
 }
 
-bool load_saved_game(struct UserManager* manager, struct SavedGame* saved_game) {
+// The floors left behind in the save go into 'levels' (NULL skips them)
+bool load_saved_game(struct UserManager* manager, struct SavedGame* saved_game, struct LevelStore* levels) {
     if (!manager->current_user) {
         mvprintw(0, 0, "Cannot load game as guest user.");
-        getch();
+        input_getch();
         return false;
     }
 
     char filename[256];
     snprintf(filename, sizeof(filename), "saves/%s.sav", manager->current_user->username);
 
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
+    SaveStatus status = read_save_file(filename, saved_game, levels);
+    if (status == SAVE_MISSING) {
         mvprintw(2, 0, "No saved game found for user: %s", manager->current_user->username);
-        getch();
+        input_getch();
+        return false;
+    }
+    if (status == SAVE_CORRUPTED) {
+        mvprintw(2, 0, "Save file %s is corrupted or truncated and was not loaded.", filename);
+        input_getch();
         return false;
     }
-    //struct SavedGame loaded;
-    //fread(&loaded, sizeof(loaded), 1, file);
-    fread(saved_game, sizeof(*saved_game), 1, file);
-    //fread(out_save, sizeof(*out_save), 1, file);
-    fclose(file);
     return true;
 }
 
@@ -2644,7 +3066,7 @@ void open_weapon_inventory_menu(Player* player,
     bool menu_open = true;
 
     while (menu_open) {
-        clear();
+        erase();
         mvprintw(0, 0, "Weapon Inventory:");
 
         // Show all weapons by index
@@ -2678,7 +3100,7 @@ void open_weapon_inventory_menu(Player* player,
 
         char input[32];
         echo();
-        getnstr(input, sizeof(input)-1);
+        input_getnstr(input, sizeof(input)-1);
         noecho();
         if (!strlen(input)) continue;
 
@@ -2694,10 +3116,7 @@ void open_weapon_inventory_menu(Player* player,
             if (tolower(cmd) == 'e') {
                 // Equip
                 player->equipped_weapon = widx;
-                char buf[64];
-                snprintf(buf, sizeof(buf),
-                         "Equipped %s.", player->weapons[widx].name);
-                add_game_message(msg_queue, buf, 2);
+                add_game_messagef(msg_queue, 2, "Equipped %s.", player->weapons[widx].name);
 
             } else if (tolower(cmd) == 'd') {
                 // Drop logic: 
@@ -2896,13 +3315,11 @@ void handle_spell_pickup(Player* player, struct Map* map, struct Point new_locat
     // Check if the tile is a spell
     if (tile == SPELL_HEALTH || tile == SPELL_SPEED || tile == SPELL_DAMAGE) {
         if (player->spell_count >= MAX_SPELLS) {
-            char full_message[100];
-            snprintf(full_message, sizeof(full_message), "Your spell inventory is full! Cannot pick up %s.", spell_type_to_name(
+            add_game_messagef(message_queue, 7, "Your spell inventory is full! Cannot pick up %s.", spell_type_to_name( //at the time 7 is the color red
                (tile == SPELL_HEALTH) ? SPELL_HEALTH_TYPE :
                 (tile == SPELL_SPEED)  ? SPELL_SPEED_TYPE :
                SPELL_DAMAGE_TYPE
             ));
-            add_game_message(message_queue, full_message, 7); //at the time 7 is the color red
             return;
         }
 
@@ -2914,9 +3331,7 @@ void handle_spell_pickup(Player* player, struct Map* map, struct Point new_locat
         map->grid[new_location.y][new_location.x] = FLOOR;
 
         // Notify the player
-        char message[100];
-        snprintf(message, sizeof(message), "You picked up a %s!", picked_spell.name);
-        add_game_message(message_queue, message, 2); // at the time 2 is the color green
+        add_game_messagef(message_queue, 2, "You picked up a %s!", picked_spell.name); // at the time 2 is the color green
     }
 }
 
@@ -2938,7 +3353,7 @@ void open_spell_inventory_menu(struct Map* game_map, Player* player, struct Mess
     bool menu_open = true;
 
     while (menu_open) {
-        clear();
+        erase();
         mvprintw(0, 0, "Spell Inventory:");
 
         if (player->spell_count == 0) {
@@ -2967,7 +3382,7 @@ void open_spell_inventory_menu(struct Map* game_map, Player* player, struct Mess
         // Read input (simple approach)
         char input[10];
         echo();
-        getnstr(input, sizeof(input) - 1);
+        input_getnstr(input, sizeof(input) - 1);
         noecho();
 
         // Parse input
@@ -2986,7 +3401,7 @@ void open_spell_inventory_menu(struct Map* game_map, Player* player, struct Mess
             if (player->spell_count == 0) {
                 mvprintw(12, 0, "No spells to use.");
                 refresh();
-                getch();
+                input_getch();
                 continue;
             }
 
@@ -2996,7 +3411,7 @@ void open_spell_inventory_menu(struct Map* game_map, Player* player, struct Mess
             } else {
                 mvprintw(12, 0, "Invalid spell number!");
                 refresh();
-                getch();
+                input_getch();
             }
         }
         else if (command == 'd') {
@@ -3004,7 +3419,7 @@ void open_spell_inventory_menu(struct Map* game_map, Player* player, struct Mess
             if (player->spell_count == 0) {
                 mvprintw(12, 0, "No spells to drop.");
                 refresh();
-                getch();
+                input_getch();
                 continue;
             }
 
@@ -3023,7 +3438,7 @@ void open_spell_inventory_menu(struct Map* game_map, Player* player, struct Mess
                     snprintf(message, sizeof(message), "You dropped a %s at your current location.", player->spells[spell_num].name);
                     mvprintw(12, 0, "%s", message);
                     refresh();
-                    getch();
+                    input_getch();
 
                     // Remove the spell from inventory
                     for (int i = spell_num; i < player->spell_count - 1; i++) {
@@ -3033,18 +3448,18 @@ void open_spell_inventory_menu(struct Map* game_map, Player* player, struct Mess
                 } else {
                     mvprintw(12, 0, "Cannot drop spell here. Tile is not empty.");
                     refresh();
-                    getch();
+                    input_getch();
                 }
             } else {
                 mvprintw(12, 0, "Invalid spell number!");
                 refresh();
-                getch();
+                input_getch();
             }
         }
         else {
             mvprintw(12, 0, "Invalid command!");
             refresh();
-            getch();
+            input_getch();
         }
     }
 }
@@ -3057,7 +3472,7 @@ void use_spell(Player* player, struct Map* game_map, struct MessageQueue* messag
     }
 
     // Clear the screen or show them a small prompt
-    clear();
+    erase();
     mvprintw(0, 0, "Your Spells:\n");
     for (int i = 0; i < player->spell_count; i++) {
         mvprintw(i + 1, 2, "%d) %s (Effect: %d)",
@@ -3072,7 +3487,7 @@ void use_spell(Player* player, struct Map* game_map, struct MessageQueue* messag
     // Get user input
     echo();
     char input[10];
-    getnstr(input, sizeof(input) - 1);
+    input_getnstr(input, sizeof(input) - 1);
     noecho();
 
     int choice = atoi(input);
@@ -3127,7 +3542,7 @@ void use_spell(Player* player, struct Map* game_map, struct MessageQueue* messag
     player->spell_count--;
 
     // Wait a moment or keypress, if you like:
-    getch();
+    input_getch();
 }
 
 void add_enemies(struct Map* map, int current_level) {
@@ -3282,6 +3697,7 @@ void deal_damage_to_enemy(Player* player, struct Map* map, int x, int y, int dam
         Enemy* enemy = &map->enemies[i];
         if (enemy->position.x == x && enemy->position.y == y) {
             enemy->hp -= damage;
+            audio_play_effect(SFX_HIT);
             if (enemy->hp <= 0) {
                 player->current_score += (2 * enemy->damage);
 
@@ -3313,22 +3729,18 @@ void stun_enemy(struct Map* map, int x, int y, int damage, struct MessageQueue*
 }
 
 void update_temporary_effects(Player* player, struct Map* map, struct MessageQueue* message_queue) {
-    time_t current_time = time(NULL);
+    time_t current_time = game_time();
 
     // Handle temporary damage boost
     if (player->temporary_damage > 0 && difftime(current_time, player->temporary_damage_start_time) >= 30.0) {
         player->temporary_damage = 0;
-        char message[100];
-        snprintf(message, sizeof(message), "Temporary damage boost has worn off.");
-        add_game_message(message_queue, message, 14); // Yellow color
+        add_game_message(message_queue, "Temporary damage boost has worn off.", 14); // Yellow color
     }
 
     // Handle temporary speed boost
     if (player->temporary_speed > 0 && difftime(current_time, player->temporary_speed_start_time) >= 30.0) {
         player->temporary_speed = 0;
-        char message[100];
-        snprintf(message, sizeof(message), "Temporary speed boost has worn off.");
-        add_game_message(message_queue, message, 14); // Yellow color
+        add_game_message(message_queue, "Temporary speed boost has worn off.", 14); // Yellow color
     }
 }
 
@@ -3346,7 +3758,7 @@ void consume_food(Player* player, int food_index, struct MessageQueue* message_q
         case FOOD_GREAT:
             player->hitpoints += 10;
             player->temporary_damage += 5;
-            player->temporary_damage_start_time = time(NULL);
+            player->temporary_damage_start_time = game_time();
             add_game_message(message_queue, "Consumed Great Food: Weapon damage increased.", 2);
             break;
         case FOOD_MAGICAL:
@@ -3373,7 +3785,7 @@ void collect_food(Player* player, struct Map* map, struct MessageQueue* message_
         if (!map->foods[i].consumed && map->foods[i].position.x == pos.x && map->foods[i].position.y == pos.y) {
             if (player->food_count < MAX_FOOD_COUNT) {
                 player->foods[player->food_count++] = map->foods[i];
-                player->foods[player->food_count - 1].pickup_time = time(NULL);
+                player->foods[player->food_count - 1].pickup_time = game_time();
                 map->foods[i].consumed = true;
                 map->grid[pos.y][pos.x] = FLOOR;
                 add_game_message(message_queue, "Picked up food.", 2);
@@ -3427,20 +3839,18 @@ void use_melee_weapon(Player* player, Weapon* weapon, struct Map* map, struct Me
         }
     }
 
-    char msg[128];
-    snprintf(msg, sizeof(msg), "You used your %s (melee)!", weapon->name);
-    add_game_message(msg_queue, msg, 2);
+    add_game_messagef(msg_queue, 2, "You used your %s (melee)!", weapon->name);
 }
 
 void ask_ranged_direction(int* dx, int* dy, const char* weapon_name) {
     // Clear
-    clear();
+    erase();
     mvprintw(0,0, "In which direction do you want to shoot your %s? (w/a/s/d): ", weapon_name);
     refresh();
 
     *dx = 0;
     *dy = 0;
-    int ch = getch();
+    int ch = input_getch();
     switch (tolower(ch)) {
         case 'w': *dy = -1; break;
         case 's': *dy =  1; break;
@@ -3555,7 +3965,7 @@ void run_in_direction(Player* player, struct Map* map, int dx, int dy) {
 }
 
 void update_inventory_food_spoilage(Player* player, struct MessageQueue* message_queue) {
-    time_t now = time(NULL);
+    time_t now = game_time();
 
     for (int i = 0; i < player->food_count; i++) {
         Food* f = &player->foods[i];
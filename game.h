@@ -5,7 +5,9 @@
 #include <stdint.h>
 #include <ncurses.h>
 #include <time.h>
+#include <sys/types.h>
 #include "users.h"
+#include "perf.h"
 #include "menu.h"
 
 // Probability thresholds (adjust as needed)
@@ -24,6 +26,7 @@
 #define PILLAR              'O'
 #define WINDOW              '='
 #define STAIRS              '>'
+#define STAIRS_UP           '<'
 #define FOG                 ' '
 #define TRAP_SYMBOL         '^'
 #define PLAYER_CHAR         'P'
@@ -110,8 +113,10 @@ static const char *ARROW_SYMBOL      = "\u27B3";   // ➳
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 
-#define MAX_MESSAGES        5
+#define MAX_MESSAGES        5     // Shown beside the map
+#define MESSAGE_HISTORY     64    // Ring slots for the message log ('l'); a power of two
 #define MESSAGE_LENGTH      100
+#define MESSAGE_TTL         10    // Turns a message stays beside the map
 
 
 struct Point {
@@ -324,14 +329,21 @@ typedef struct Player {
 
 
 struct GameMessage {
-    char text[100];
-    int time_to_live;
+    char text[MESSAGE_LENGTH];
+    long expires;        // Turn it leaves the screen
+    int repeats;         // Identical messages folded into this one ("x3")
     int color_pair;
 };
 
+// Ring of the last MESSAGE_HISTORY - 1 messages. The slot after the newest
+// is always free: messages are formatted straight into it and only kept if
+// they differ from the newest. Messages expire in the order they were
+// added, so the ones on screen are always the newest few.
 struct MessageQueue {
-    struct GameMessage messages[MAX_MESSAGES];
-    int count;
+    struct GameMessage messages[MESSAGE_HISTORY];
+    unsigned long count;        // Messages ever added; the newest is count - 1
+    unsigned long first_shown;  // Oldest message still on screen
+    long turn;
 };
 
 struct SavedGame {
@@ -344,20 +356,68 @@ struct SavedGame {
     char name[MAX_STRING_LEN];
 };
 
+// -- Save file format --
+// A header followed by the SavedGame payload, optionally compressed, then
+// (v3) the floors left behind as level_store_serialize writes them.
+// Files without the magic are legacy raw SavedGame dumps.
+#define SAVE_MAGIC              "RGSV"
+#define SAVE_FORMAT_VERSION     3   // v2 added the checksum, v3 the floors
+#define SAVE_FLAG_COMPRESSED    0x0001
+#define SAVE_COMPRESSION        1   // Set to 0 to write uncompressed saves
+#define SAVE_SNAPSHOT_FORK      1   // Write saves from a forked child (not in server mode); 0 saves inline
+
+struct SaveFileHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t raw_size;      // sizeof(struct SavedGame) when written
+    uint32_t stored_size;   // Payload bytes following the header
+    uint32_t checksum;      // CRC32C of this header (checksum = 0), the payload and the floors
+};
 
-static bool code_visible = false;        // Is there a code currently on screen?
-static time_t code_start_time = 0;           // When was it generated?
-static char current_code[6] = "";    // Holds the 4-digit code
-extern bool hasPassword;  // Just a declaration, no assignment
-
-// If you only have one password door at a time, you could do:
-static bool door_unlocked = false;
+typedef enum {
+    SAVE_OK,
+    SAVE_MISSING,
+    SAVE_CORRUPTED
+} SaveStatus;
+
+// Everything one game in progress keeps between turns apart from its map and
+// player. The caller owns it and resets it with game_context_init before
+// each game, so any number of games can share a process.
+struct GameContext {
+    // 'f' movement: waiting for an arrow key, then the direction to run in
+    bool run_mode;
+    int run_dx, run_dy;
+    bool skip_collect_next;      // 'g': the next tile stepped on is not collected
+    int last_dx, last_dy;        // Last direction used for ranged shots
+
+    time_t last_enchant_drain;   // Enchant rooms drain 1 HP a second
+    time_t last_item_add_time;   // New food every 30 seconds
+
+    // Password door code shown under the map
+    bool code_visible;
+    time_t code_start_time;
+    char current_code[6];
+
+    bool snapshot_saves;         // Save from a forked child (SAVE_SNAPSHOT_FORK), else inline
+    pid_t pending_save_pid;      // Child writing a snapshot save (0 when none)
+    struct LevelStore* levels;   // Floors left behind, for '<' and '>' (levels.h)
+    int start_level;             // Level a loaded game resumes on (0: level 1)
+
+    struct PerfStats perf;       // Performance HUD ('p')
+    chtype hud_tiles[MAP_HEIGHT][MAP_WIDTH];   // Map as of the last HUD redraw count
+};
 
 
 
 // Game core functions
-void play_game(struct UserManager* manager, struct Map* game_map, 
-               Player* player, int initial_score);
+void game_context_init(struct GameContext* game);
+void game_context_free(struct GameContext* game);
+struct GameContext* game_context_current(void);
+void game_context_set_current(struct GameContext* game);
+void game_set_snapshot_saves(bool enabled);
+void play_game(struct GameContext* game, struct UserManager* manager,
+               struct Map* game_map, Player* player, int initial_score);
 void init_map(struct Map* map);
 void add_traps_to_room(struct Map* map, struct Room* room, int trap_count);
 void add_items_to_room(struct Map* map, struct Room* room);
@@ -376,17 +436,20 @@ void convert_deadend_to_enchant(struct Map* map);
 void print_full_map(struct Map* game_map, struct Point* character_location, struct UserManager* manager);
 
 // Saving/Loading
-void save_current_game(struct UserManager* manager, struct Map* game_map, 
-                      Player* player, int current_level);
-bool load_saved_game(struct UserManager* manager, struct SavedGame* saved_game);
-void handle_death(struct UserManager* manager, Player* player);
+void save_current_game(struct GameContext* game, struct UserManager* manager,
+                       struct Map* game_map, Player* player, int current_level);
+bool load_saved_game(struct UserManager* manager, struct SavedGame* saved_game, struct LevelStore* levels);
+bool write_save_file(const char* filename, const struct SavedGame* save, const struct LevelStore* levels);
+SaveStatus read_save_file(const char* filename, struct SavedGame* save, struct LevelStore* levels);
+bool reap_save_snapshot(struct GameContext* game, struct MessageQueue* queue, bool block);
+void handle_death(struct GameContext* game, struct UserManager* manager, Player* player);
 
 // Room connectivity
 void connect_rooms_with_corridors(struct Map* map);
 
 // Movement and visibility
 // game.h
-void move_character(Player* player, int key, struct Map* game_map, int* hitpoints, struct MessageQueue* message_queue);
+void move_character(struct GameContext* game, Player* player, int key, struct Map* game_map, int* hitpoints, struct MessageQueue* message_queue);
 void place_password_generator_in_corner(struct Map* map, struct Room* room);
 void update_visibility(struct Map* map, struct Point* player_pos, bool visible[MAP_HEIGHT][MAP_WIDTH]);
 void add_ancient_key(struct Map* game_map);
@@ -399,9 +462,12 @@ void place_password_generator_in_corner(struct Map* game_map, struct Room* room)
 
 // Message system
 void add_game_message(struct MessageQueue* queue, const char* text, int color_pair);
+void add_game_messagef(struct MessageQueue* queue, int color_pair, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
 void update_messages(struct MessageQueue* queue);
 void draw_messages(struct MessageQueue* queue, int start_y, int start_x);
-void update_password_display();
+void open_message_log(struct MessageQueue* queue);
+void update_password_display(struct GameContext* game);
 void run_in_direction(Player* player, struct Map* map, int dx, int dy);
 
 // Map display
@@ -460,6 +526,6 @@ void consume_food(Player* player, int food_index, struct MessageQueue* message_q
 void collect_food(Player* player, struct Map* map, struct MessageQueue* message_queue);
 // Ensure this is in game.c
 void update_temporary_effects(Player* player, struct Map* map, struct MessageQueue* message_queue);
-void finalize_victory(struct UserManager* manager, Player* player);
+void finalize_victory(struct GameContext* game, struct UserManager* manager, Player* player);
 
 #endif
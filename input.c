@@ -0,0 +1,367 @@
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "input.h"
+
+typedef enum {
+    EVENT_GAME,
+    EVENT_LEVEL,
+    EVENT_KEY,
+    EVENT_STR,
+    EVENT_END
+} InputEventType;
+
+struct InputEvent {
+    InputEventType type;
+    long turn;           // EVENT_KEY/EVENT_STR
+    long value;          // Key code, level number or difficulty
+    unsigned seed;       // EVENT_LEVEL
+    time_t time;         // 0 if not recorded
+    char* text;          // EVENT_STR line, EVENT_GAME color
+};
+
+static InputMode mode = INPUT_LIVE;
+static FILE* record_file = NULL;
+static struct InputEvent* events = NULL;
+static int event_count = 0;
+static int cursor = 0;               // Next replay event
+static bool in_game = false;         // Between input_begin_game and input_end_game
+static long turn = 0;
+static time_t clock_now = 0;         // game_time() while recording or replaying
+static struct InputReplayStats stats;
+static struct InputBot bot;
+static bool new_turn = false;        // No key read yet this turn
+static SCREEN* headless_screen = NULL;
+
+// Writes text so it is one space-free token: bytes outside '!'..'~' and '%'
+// become %XX
+static void write_escaped(FILE* file, const char* text) {
+    fputc('=', file);
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p > ' ' && *p < 0x7f && *p != '%') fputc(*p, file);
+        else fprintf(file, "%%%02X", *p);
+    }
+}
+
+static char* read_escaped(const char* token) {
+    if (token[0] != '=') return NULL;
+    char* text = malloc(strlen(token));
+    if (text == NULL) return NULL;
+
+    char* out = text;
+    for (const char* p = token + 1; *p; p++) {
+        unsigned int byte;
+        if (*p == '%' && sscanf(p + 1, "%2X", &byte) == 1) {
+            *out++ = (char)byte;
+            p += 2;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+    return text;
+}
+
+bool input_record_open(const char* path) {
+    record_file = fopen(path, "a");
+    if (record_file == NULL) return false;
+
+    setvbuf(record_file, NULL, _IOLBF, 0);   // A crash keeps everything up to the last key
+    fprintf(record_file, "# input log v1\n");
+    mode = INPUT_RECORD;
+    return true;
+}
+
+static bool parse_event(const char* line, struct InputEvent* event) {
+    char word[16], token[INPUT_MAX_LINE];
+    long time_value = 0;
+    memset(event, 0, sizeof(*event));
+
+    if (sscanf(line, "%15s", word) != 1) return false;
+    if (strcmp(word, "game") == 0) {
+        event->type = EVENT_GAME;
+        if (sscanf(line, "game %ld %511s %ld", &event->value, token, &time_value) < 2) return false;
+        event->text = strdup(token);
+    } else if (strcmp(word, "level") == 0) {
+        event->type = EVENT_LEVEL;
+        if (sscanf(line, "level %ld %u", &event->value, &event->seed) != 2) return false;
+    } else if (strcmp(word, "key") == 0) {
+        event->type = EVENT_KEY;
+        if (sscanf(line, "key %ld %ld %ld", &event->turn, &event->value, &time_value) < 2) return false;
+    } else if (strcmp(word, "str") == 0) {
+        event->type = EVENT_STR;
+        if (sscanf(line, "str %ld %511s %ld", &event->turn, token, &time_value) < 2) return false;
+        event->text = read_escaped(token);
+        if (event->text == NULL) return false;
+    } else if (strcmp(word, "end") == 0) {
+        event->type = EVENT_END;
+    } else {
+        return false;
+    }
+    event->time = (time_t)time_value;
+    return true;
+}
+
+// Loads the whole log up front so replay never touches the disk
+bool input_replay_open(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return false;
+
+    char line[INPUT_MAX_LINE];
+    int capacity = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        if (event_count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            struct InputEvent* grown = realloc(events, capacity * sizeof(struct InputEvent));
+            if (grown == NULL) {
+                ok = false;
+                break;
+            }
+            events = grown;
+        }
+        ok = parse_event(line, &events[event_count]);
+        if (ok) event_count++;
+    }
+    fclose(file);
+
+    if (!ok) {
+        input_close();
+        return false;
+    }
+    mode = INPUT_REPLAY;
+    memset(&stats, 0, sizeof(stats));
+    return true;
+}
+
+// Hands input to 'player' (NULL gives it back to the terminal)
+void input_set_bot(const struct InputBot* player) {
+    if (player) {
+        bot = *player;
+        mode = INPUT_BOT;
+    } else if (mode == INPUT_BOT) {
+        mode = INPUT_LIVE;
+    }
+}
+
+InputMode input_mode(void) {
+    return mode;
+}
+
+void input_close(void) {
+    if (record_file) fclose(record_file);
+    record_file = NULL;
+
+    for (int i = 0; i < event_count; i++) free(events[i].text);
+    free(events);
+    events = NULL;
+    event_count = cursor = 0;
+    mode = INPUT_LIVE;
+}
+
+// Next event of the game being replayed, NULL once it has ended
+static struct InputEvent* peek_event(void) {
+    if (cursor >= event_count || events[cursor].type == EVENT_END ||
+        events[cursor].type == EVENT_GAME) {
+        return NULL;
+    }
+    return &events[cursor];
+}
+
+// The log ran out (or was cut short) while the game still wants input:
+// answer with keys that back out of any prompt or menu
+static int overrun_key(void) {
+    if (++stats.overruns > INPUT_OVERRUN_LIMIT) {
+        endwin();
+        fprintf(stderr, "replay: the game kept asking for input after its log ended\n");
+        exit(1);
+    }
+    return stats.overruns % 2 ? 'q' : '\n';
+}
+
+static void replay_consumed(const struct InputEvent* event) {
+    if (event->turn != turn) stats.desyncs++;
+    if (event->time) clock_now = event->time;
+    stats.keys++;
+    cursor++;
+}
+
+int input_getch(void) {
+    bool turn_key = new_turn;
+    new_turn = false;
+
+    if (mode == INPUT_BOT) return bot.next_key(bot.context, turn_key);
+    if (mode == INPUT_REPLAY && in_game) {
+        struct InputEvent* event = peek_event();
+        if (event && event->type == EVENT_KEY) {
+            replay_consumed(event);
+            return (int)event->value;
+        }
+        if (event) {
+            // Asked for a key where the log has something else
+            stats.desyncs++;
+            cursor++;
+        }
+        return overrun_key();
+    }
+
+    int key = getch();
+    if (mode == INPUT_RECORD && in_game) {
+        clock_now = time(NULL);
+        fprintf(record_file, "key %ld %d %ld\n", turn, key, (long)clock_now);
+    }
+    return key;
+}
+
+int input_getnstr(char* buffer, int max_len) {
+    new_turn = false;
+    if (mode == INPUT_BOT) {
+        bot.next_line(bot.context, buffer, max_len);
+        return OK;
+    }
+    if (mode == INPUT_REPLAY && in_game) {
+        struct InputEvent* event = peek_event();
+        if (event && event->type == EVENT_STR) {
+            replay_consumed(event);
+            snprintf(buffer, (size_t)max_len + 1, "%s", event->text);
+            return OK;
+        }
+        if (event) {
+            stats.desyncs++;
+            cursor++;
+        }
+        overrun_key();
+        buffer[0] = '\0';
+        return OK;
+    }
+
+    int result = getnstr(buffer, max_len);
+    if (mode == INPUT_RECORD && in_game) {
+        clock_now = time(NULL);
+        fprintf(record_file, "str %ld ", turn);
+        write_escaped(record_file, result == OK ? buffer : "");
+        fprintf(record_file, " %ld\n", (long)clock_now);
+    }
+    return result;
+}
+
+time_t game_time(void) {
+    bool simulated = mode != INPUT_LIVE && in_game && !(mode == INPUT_BOT && bot.real_time);
+    return simulated ? clock_now : time(NULL);
+}
+
+// Called before the first level of a new game is generated
+void input_begin_game(struct UserManager* manager) {
+    struct User* user = manager->current_user;
+    turn = 0;
+    clock_now = time(NULL);
+
+    if (mode == INPUT_RECORD) {
+        fprintf(record_file, "game %d ", user ? user->difficulty : 1);
+        write_escaped(record_file, user ? user->character_color : "");
+        fprintf(record_file, " %ld\n", (long)clock_now);
+        in_game = true;
+    } else if (mode == INPUT_REPLAY) {
+        while (cursor < event_count && events[cursor].type != EVENT_GAME) cursor++;
+        if (cursor == event_count) return;
+
+        const struct InputEvent* game = &events[cursor++];
+        if (user) {
+            user->difficulty = (int)game->value;
+            char* color = read_escaped(game->text);
+            if (color) snprintf(user->character_color, sizeof(user->character_color), "%s", color);
+            free(color);
+        }
+        if (game->time) clock_now = game->time;
+        stats.games++;
+        in_game = true;
+    } else if (mode == INPUT_BOT) {
+        in_game = true;
+    }
+}
+
+// Seeds rand() for a level about to be generated. Live games keep the
+// process-wide seed.
+void input_begin_level(int level) {
+    if (!in_game) return;
+
+    if (mode == INPUT_BOT) {
+        if (bot.level_started) bot.level_started(bot.context, level);
+    } else if (mode == INPUT_RECORD) {
+        unsigned seed = (unsigned)rand() ^ ((unsigned)time(NULL) << 8) ^ (unsigned)level;
+        fprintf(record_file, "level %d %u\n", level, seed);
+        srand(seed);
+    } else if (mode == INPUT_REPLAY) {
+        struct InputEvent* event = peek_event();
+        if (event && event->type == EVENT_LEVEL) {
+            srand(event->seed);
+            cursor++;
+        } else {
+            stats.desyncs++;
+        }
+    }
+}
+
+void input_next_turn(void) {
+    turn++;
+    new_turn = true;
+    if (mode == INPUT_REPLAY && in_game) stats.turns++;
+    if (mode == INPUT_BOT) clock_now++;
+}
+
+void input_end_game(void) {
+    if (!in_game) return;
+
+    if (mode == INPUT_RECORD) {
+        fprintf(record_file, "end\n");
+    } else if (mode == INPUT_REPLAY) {
+        // Whatever the game did not read is a mismatch
+        while (peek_event()) {
+            stats.desyncs++;
+            cursor++;
+        }
+        if (cursor < event_count && events[cursor].type == EVENT_END) cursor++;
+    }
+    in_game = false;
+}
+
+bool input_replay_has_game(void) {
+    for (int i = cursor; i < event_count; i++) {
+        if (events[i].type == EVENT_GAME) return true;
+    }
+    return false;
+}
+
+const struct InputReplayStats* input_replay_stats(void) {
+    return &stats;
+}
+
+// A curses screen for running without a terminal (replay, simulator,
+// benchmarks) sized lines x columns: output goes to /dev/null and reads
+// never block
+bool input_open_headless(int lines, int columns) {
+    FILE* out = fopen("/dev/null", "w");
+    FILE* in = fopen("/dev/null", "r");
+    const char* term = getenv("TERM");
+    headless_screen = out && in ? newterm(term && *term ? term : "xterm", out, in) : NULL;
+    if (headless_screen == NULL) {
+        if (out) fclose(out);
+        if (in) fclose(in);
+        return false;
+    }
+
+    resize_term(lines, columns);
+    nodelay(stdscr, TRUE);
+    if (has_colors()) start_color();
+    return true;
+}
+
+void input_close_headless(void) {
+    if (headless_screen == NULL) return;
+    endwin();
+    delscreen(headless_screen);
+    headless_screen = NULL;
+}
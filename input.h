@@ -0,0 +1,81 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <time.h>
+#include "users.h"
+
+// Every key and line the game reads during play goes through here, as does
+// the game's notion of the current time. That makes a game reproducible:
+//
+//   --record FILE   appends each new game to FILE: the player's settings,
+//                   the seed of every level, and every key and line typed,
+//                   with the turn it was typed on and the time
+//   --replay FILE   plays the games in FILE back through the same code with
+//                   no terminal and no waiting, as fast as the CPU allows
+//
+// While recording or replaying, game_time() only moves when a key is read,
+// so time-based rules (hunger, spoilage, spell timers) see the same clock
+// both times. Saved games that are continued are not recorded.
+//
+// A bot (the simulator) can stand in for the player with input_set_bot();
+// its clock moves one second per turn. The game server uses the same hook
+// for remote players, with real_time set so their clock is the wall clock.
+//
+// The log is text, one event per line ('#' starts a comment):
+//   game <difficulty> <color> <time>
+//   level <number> <seed>
+//   key <turn> <keycode> <time>
+//   str <turn> =<text, %XX-escaped> <time>
+//   end
+
+#define INPUT_MAX_LINE 512
+#define INPUT_OVERRUN_LIMIT 1000  // Keys invented after a log runs out before giving up
+
+typedef enum {
+    INPUT_LIVE,
+    INPUT_RECORD,
+    INPUT_REPLAY,
+    INPUT_BOT
+} InputMode;
+
+struct InputBot {
+    // new_turn is true for the key play_game's main loop reads each turn;
+    // other keys answer prompts and menus opened during the turn
+    int (*next_key)(void* context, bool new_turn);
+    void (*next_line)(void* context, char* buffer, int max_len);
+    void (*level_started)(void* context, int level);   // May be NULL
+    void* context;
+    bool real_time;     // game_time() is the wall clock, not one second per turn
+};
+
+struct InputReplayStats {
+    int games;
+    long keys;          // Keys and lines fed back
+    long turns;
+    long desyncs;       // Events that did not match what the game asked for
+    long overruns;      // Keys invented after a game's log ran out
+};
+
+// Function declarations
+bool input_record_open(const char* path);
+bool input_replay_open(const char* path);
+void input_set_bot(const struct InputBot* bot);
+InputMode input_mode(void);
+void input_close(void);
+bool input_open_headless(int lines, int columns);
+void input_close_headless(void);
+
+int input_getch(void);
+int input_getnstr(char* buffer, int max_len);
+time_t game_time(void);
+
+void input_begin_game(struct UserManager* manager);
+void input_begin_level(int level);
+void input_next_turn(void);
+void input_end_game(void);
+
+bool input_replay_has_game(void);
+const struct InputReplayStats* input_replay_stats(void);
+
+#endif
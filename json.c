@@ -0,0 +1,408 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+
+#define JSON_MAX_DEPTH 64
+
+void json_parser_init(struct JsonParser* parser, const char* data, size_t length) {
+    parser->data = data;
+    parser->length = length;
+    parser->pos = 0;
+    parser->after_value = false;
+    parser->need_value = false;
+}
+
+static void skip_whitespace(struct JsonParser* parser) {
+    while (parser->pos < parser->length) {
+        char c = parser->data[parser->pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+        parser->pos++;
+    }
+}
+
+// Consumes the ',' between two elements. The tokens themselves say nothing
+// of it, but it must be exactly where one value ends and the next begins:
+// not before the first, after the last, doubled or missing.
+static bool take_separator(struct JsonParser* parser) {
+    skip_whitespace(parser);
+    if (parser->pos >= parser->length) return true;
+
+    char c = parser->data[parser->pos];
+    if (parser->after_value) {
+        if (c == ',') {
+            parser->pos++;
+            parser->need_value = true;
+            skip_whitespace(parser);
+            if (parser->pos >= parser->length) return true;
+            c = parser->data[parser->pos];
+        } else if (c != '}' && c != ']') {
+            return false;
+        }
+    }
+    if (c == ',') return false;
+    return !(parser->need_value && (c == '}' || c == ']'));
+}
+
+static bool match_literal(struct JsonParser* parser, const char* word) {
+    size_t len = strlen(word);
+    if (parser->length - parser->pos < len) return false;
+    if (memcmp(parser->data + parser->pos, word, len) != 0) return false;
+    parser->pos += len;
+    return true;
+}
+
+static JsonTokenType next_token(struct JsonParser* parser, struct JsonToken* token);
+
+JsonTokenType json_next(struct JsonParser* parser, struct JsonToken* token) {
+    bool placed = take_separator(parser);
+    token->start = parser->data + parser->pos;
+    token->length = 0;
+    if (!placed) {
+        token->type = JSON_ERROR;
+        return token->type;
+    }
+
+    JsonTokenType type = next_token(parser, token);
+    parser->after_value = type != JSON_OBJECT_START && type != JSON_ARRAY_START && type != JSON_KEY;
+    parser->need_value = type == JSON_KEY;
+    return type;
+}
+
+static JsonTokenType next_token(struct JsonParser* parser, struct JsonToken* token) {
+    if (parser->pos >= parser->length) {
+        token->type = JSON_END;
+        return token->type;
+    }
+
+    char c = parser->data[parser->pos];
+    switch (c) {
+        case '{': parser->pos++; token->type = JSON_OBJECT_START; return token->type;
+        case '}': parser->pos++; token->type = JSON_OBJECT_END;   return token->type;
+        case '[': parser->pos++; token->type = JSON_ARRAY_START;  return token->type;
+        case ']': parser->pos++; token->type = JSON_ARRAY_END;    return token->type;
+
+        case '"': {
+            size_t start = ++parser->pos;
+            while (parser->pos < parser->length && parser->data[parser->pos] != '"') {
+                if (parser->data[parser->pos] == '\\') parser->pos++;
+                parser->pos++;
+            }
+            if (parser->pos >= parser->length) {
+                token->type = JSON_ERROR;
+                return token->type;
+            }
+            token->start = parser->data + start;
+            token->length = parser->pos - start;
+            parser->pos++;   // Closing quote
+
+            // A string directly followed by ':' is an object key
+            size_t after = parser->pos;
+            while (after < parser->length &&
+                   (parser->data[after] == ' ' || parser->data[after] == '\t' ||
+                    parser->data[after] == '\n' || parser->data[after] == '\r')) {
+                after++;
+            }
+            if (after < parser->length && parser->data[after] == ':') {
+                parser->pos = after + 1;
+                token->type = JSON_KEY;
+            } else {
+                token->type = JSON_STRING;
+            }
+            return token->type;
+        }
+
+        case 't':
+            token->type = match_literal(parser, "true") ? JSON_TRUE : JSON_ERROR;
+            return token->type;
+        case 'f':
+            token->type = match_literal(parser, "false") ? JSON_FALSE : JSON_ERROR;
+            return token->type;
+        case 'n':
+            token->type = match_literal(parser, "null") ? JSON_NULL : JSON_ERROR;
+            return token->type;
+    }
+
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        size_t start = parser->pos;
+        while (parser->pos < parser->length) {
+            c = parser->data[parser->pos];
+            if (!((c >= '0' && c <= '9') || c == '-' || c == '+' ||
+                  c == '.' || c == 'e' || c == 'E')) break;
+            parser->pos++;
+        }
+        token->length = parser->pos - start;
+        token->type = JSON_NUMBER;
+        return token->type;
+    }
+
+    token->type = JSON_ERROR;
+    return token->type;
+}
+
+// Skips the value that starts with 'first', including any nested containers.
+// Used to ignore keys the caller does not know about.
+bool json_skip_value(struct JsonParser* parser, const struct JsonToken* first) {
+    if (first->type != JSON_OBJECT_START && first->type != JSON_ARRAY_START) {
+        return first->type != JSON_ERROR && first->type != JSON_END;
+    }
+
+    int depth = 1;
+    struct JsonToken token;
+    while (depth > 0) {
+        switch (json_next(parser, &token)) {
+            case JSON_OBJECT_START:
+            case JSON_ARRAY_START:
+                if (++depth > JSON_MAX_DEPTH) return false;
+                break;
+            case JSON_OBJECT_END:
+            case JSON_ARRAY_END:
+                depth--;
+                break;
+            case JSON_ERROR:
+            case JSON_END:
+                return false;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool read_hex4(const char* p, const char* end, unsigned int* out) {
+    if (end - p < 4) return false;
+    unsigned int value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_value(p[i]);
+        if (digit < 0) return false;
+        value = (value << 4) | (unsigned int)digit;
+    }
+    *out = value;
+    return true;
+}
+
+// Appends a byte unless the destination is full (one byte is kept for '\0')
+#define PUT_BYTE(b) do { if (out + 1 < dst_size) dst[out] = (char)(b); out++; } while (0)
+
+// Copies a string or key token into dst with escapes decoded, truncating to
+// fit. Returns the decoded length (which may exceed dst_size - 1).
+size_t json_copy_string(const struct JsonToken* token, char* dst, size_t dst_size) {
+    const char* p = token->start;
+    const char* end = token->start + token->length;
+    size_t out = 0;
+
+    while (p < end) {
+        char c = *p++;
+        if (c != '\\' || p >= end) {
+            PUT_BYTE(c);
+            continue;
+        }
+
+        c = *p++;
+        switch (c) {
+            case 'b': PUT_BYTE('\b'); break;
+            case 'f': PUT_BYTE('\f'); break;
+            case 'n': PUT_BYTE('\n'); break;
+            case 'r': PUT_BYTE('\r'); break;
+            case 't': PUT_BYTE('\t'); break;
+            case 'u': {
+                unsigned int cp;
+                if (!read_hex4(p, end, &cp)) break;
+                p += 4;
+                // Combine UTF-16 surrogate pairs
+                unsigned int low;
+                if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 6 &&
+                    p[0] == '\\' && p[1] == 'u' && read_hex4(p + 2, end, &low) &&
+                    low >= 0xDC00 && low <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                if (cp < 0x80) {
+                    PUT_BYTE(cp);
+                } else if (cp < 0x800) {
+                    PUT_BYTE(0xC0 | (cp >> 6));
+                    PUT_BYTE(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    PUT_BYTE(0xE0 | (cp >> 12));
+                    PUT_BYTE(0x80 | ((cp >> 6) & 0x3F));
+                    PUT_BYTE(0x80 | (cp & 0x3F));
+                } else {
+                    PUT_BYTE(0xF0 | (cp >> 18));
+                    PUT_BYTE(0x80 | ((cp >> 12) & 0x3F));
+                    PUT_BYTE(0x80 | ((cp >> 6) & 0x3F));
+                    PUT_BYTE(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:   // '"', '\\', '/' and anything unknown map to themselves
+                PUT_BYTE(c);
+                break;
+        }
+    }
+
+    if (dst_size > 0) dst[out < dst_size ? out : dst_size - 1] = '\0';
+    return out;
+}
+
+#undef PUT_BYTE
+
+// Reads an integer from a number token, or from a string token holding one
+// (users.json stores score and gold as strings); true reads as 1, false and
+// null as 0. Values beyond a long stop at LONG_MAX or LONG_MIN. Returns false,
+// leaving *value alone, for anything else, a fraction or exponent included.
+bool json_token_long(const struct JsonToken* token, long* value) {
+    const char* p = token->start;
+    const char* end = token->start + token->length;
+    bool negative = false;
+
+    if (token->type == JSON_TRUE || token->type == JSON_FALSE || token->type == JSON_NULL) {
+        *value = token->type == JSON_TRUE;
+        return true;
+    }
+    if (token->type != JSON_NUMBER && token->type != JSON_STRING) return false;
+
+    while (p < end && *p == ' ') p++;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+    // Accumulated unsigned so the magnitude of LONG_MIN fits
+    unsigned long limit = negative ? (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX;
+    unsigned long magnitude = 0;
+    const char* digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        unsigned digit = (unsigned)(*p++ - '0');
+        magnitude = magnitude > (limit - digit) / 10 ? limit : magnitude * 10 + digit;
+    }
+    if (p == digits || p != end) return false;
+
+    if (!negative) *value = (long)magnitude;
+    else *value = magnitude == limit ? LONG_MIN : -(long)magnitude;
+    return true;
+}
+
+// Buffered writer
+
+static bool writer_reserve(struct JsonWriter* writer, size_t extra) {
+    if (writer->failed) return false;
+    if (writer->length + extra <= writer->capacity) return true;
+
+    size_t capacity = writer->capacity ? writer->capacity : 256;
+    while (capacity < writer->length + extra) capacity *= 2;
+
+    char* data = realloc(writer->data, capacity);
+    if (data == NULL) {
+        writer->failed = true;
+        return false;
+    }
+    writer->data = data;
+    writer->capacity = capacity;
+    return true;
+}
+
+void json_writer_init(struct JsonWriter* writer, size_t initial_capacity) {
+    writer->data = NULL;
+    writer->length = 0;
+    writer->capacity = 0;
+    writer->failed = false;
+    writer_reserve(writer, initial_capacity);
+}
+
+void json_writer_free(struct JsonWriter* writer) {
+    free(writer->data);
+    writer->data = NULL;
+    writer->length = writer->capacity = 0;
+}
+
+void json_write_raw(struct JsonWriter* writer, const char* text) {
+    size_t len = strlen(text);
+    if (!writer_reserve(writer, len)) return;
+    memcpy(writer->data + writer->length, text, len);
+    writer->length += len;
+}
+
+// Writes text as a quoted JSON string, escaping quotes, backslashes and
+// control characters
+void json_write_string(struct JsonWriter* writer, const char* text) {
+    json_write_string_length(writer, text, strlen(text));
+}
+
+// Length of the well-formed UTF-8 sequence at text[0], 0 if it is not one
+static size_t utf8_sequence(const unsigned char* text, size_t len) {
+    size_t need;
+    unsigned min;
+    if (text[0] >= 0xC2 && text[0] <= 0xDF) { need = 2; min = 0x80; }
+    else if (text[0] >= 0xE0 && text[0] <= 0xEF) { need = 3; min = 0x800; }
+    else if (text[0] >= 0xF0 && text[0] <= 0xF4) { need = 4; min = 0x10000; }
+    else return 0;
+    if (len < need) return 0;
+
+    unsigned cp = text[0] & (0x3F >> (need - 1));
+    for (size_t i = 1; i < need; i++) {
+        if ((text[i] & 0xC0) != 0x80) return 0;
+        cp = (cp << 6) | (text[i] & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+    return need;
+}
+
+// As json_write_string, for text that is not NUL-terminated. Bytes that are
+// not UTF-8 (a character cut in half by the screen) become U+FFFD.
+void json_write_string_length(struct JsonWriter* writer, const char* text, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+
+    // Worst case every byte becomes \u00XX
+    if (!writer_reserve(writer, len * 6 + 2)) return;
+
+    char* out = writer->data + writer->length;
+    *out++ = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = (char)c;
+        } else if (c == '\n') {
+            *out++ = '\\'; *out++ = 'n';
+        } else if (c == '\t') {
+            *out++ = '\\'; *out++ = 't';
+        } else if (c < 0x20) {
+            *out++ = '\\'; *out++ = 'u'; *out++ = '0'; *out++ = '0';
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xF];
+        } else if (c < 0x80) {
+            *out++ = (char)c;
+        } else {
+            size_t n = utf8_sequence((const unsigned char*)text + i, len - i);
+            if (n == 0) {
+                memcpy(out, "\\ufffd", 6);
+                out += 6;
+            } else {
+                memcpy(out, text + i, n);
+                out += n;
+                i += n - 1;
+            }
+        }
+    }
+    *out++ = '"';
+    writer->length = (size_t)(out - writer->data);
+}
+
+void json_write_long(struct JsonWriter* writer, long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+
+    do {
+        digits[n++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (!writer_reserve(writer, (size_t)n + 1)) return;
+    if (value < 0) writer->data[writer->length++] = '-';
+    while (n > 0) writer->data[writer->length++] = digits[--n];
+}
@@ -0,0 +1,62 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Minimal single-pass JSON tokenizer working in place over a buffer, and a
+// growable buffered writer. Tokens point into the source buffer; strings are
+// only unescaped when copied out with json_copy_string, so parsing allocates
+// nothing.
+
+typedef enum {
+    JSON_OBJECT_START,
+    JSON_OBJECT_END,
+    JSON_ARRAY_START,
+    JSON_ARRAY_END,
+    JSON_KEY,       // A string followed by ':' (the colon is consumed)
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL,
+    JSON_END,       // End of input
+    JSON_ERROR
+} JsonTokenType;
+
+struct JsonToken {
+    JsonTokenType type;
+    const char* start;   // Strings/keys: contents without the quotes, still escaped
+    size_t length;
+};
+
+struct JsonParser {
+    const char* data;
+    size_t length;
+    size_t pos;
+    bool after_value;    // A value just ended: ',' or a closing bracket comes next
+    bool need_value;     // After ',' or a key: a value comes next
+};
+
+struct JsonWriter {
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed;         // Set when an allocation failed; output is incomplete
+};
+
+// Function declarations
+void json_parser_init(struct JsonParser* parser, const char* data, size_t length);
+JsonTokenType json_next(struct JsonParser* parser, struct JsonToken* token);
+bool json_skip_value(struct JsonParser* parser, const struct JsonToken* first);
+size_t json_copy_string(const struct JsonToken* token, char* dst, size_t dst_size);
+bool json_token_long(const struct JsonToken* token, long* value);
+
+void json_writer_init(struct JsonWriter* writer, size_t initial_capacity);
+void json_writer_free(struct JsonWriter* writer);
+void json_write_raw(struct JsonWriter* writer, const char* text);
+void json_write_string(struct JsonWriter* writer, const char* text);
+void json_write_string_length(struct JsonWriter* writer, const char* text, size_t len);
+void json_write_long(struct JsonWriter* writer, long value);
+
+#endif
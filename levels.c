@@ -0,0 +1,327 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "game.h"
+#include "compress.h"
+#include "trace.h"
+#include "levels.h"
+
+typedef enum {
+    LEVEL_NONE,
+    LEVEL_FULL,        // map
+    LEVEL_PACKED,      // packed_size bytes at packed
+    LEVEL_SPILLED      // packed_size bytes at spill_offset in the spill file
+} LevelForm;
+
+struct StoredLevel {
+    LevelForm form;
+    struct Map* map;
+    uint8_t* packed;
+    size_t packed_size;
+    long spill_offset;
+    unsigned long last_left;     // Store clock when the player left this floor
+};
+
+struct LevelStore {
+    struct StoredLevel* levels;  // Indexed by depth
+    int capacity;
+    unsigned long clock;
+    size_t packed_bytes;         // Sum of packed_size over LEVEL_PACKED floors
+    FILE* spill;                 // Opened by the first spill
+    long spill_end;
+    int spilled;                 // Floors in the spill file
+};
+
+struct LevelStore* level_store_create(void) {
+    return calloc(1, sizeof(struct LevelStore));
+}
+
+static void forget(struct LevelStore* store, struct StoredLevel* level) {
+    if (level->form == LEVEL_PACKED) store->packed_bytes -= level->packed_size;
+    // Once nothing is left in the spill file, write over it from the start
+    if (level->form == LEVEL_SPILLED && --store->spilled == 0) store->spill_end = 0;
+    free(level->map);
+    free(level->packed);
+    memset(level, 0, sizeof(*level));
+}
+
+void level_store_destroy(struct LevelStore* store) {
+    if (store == NULL) return;
+    for (int depth = 0; depth < store->capacity; depth++) forget(store, &store->levels[depth]);
+    free(store->levels);
+    if (store->spill) fclose(store->spill);
+    free(store);
+}
+
+static struct StoredLevel* find(const struct LevelStore* store, int depth) {
+    if (depth < 0 || depth >= store->capacity) return NULL;
+    struct StoredLevel* level = &store->levels[depth];
+    return level->form == LEVEL_NONE ? NULL : level;
+}
+
+bool level_store_has(const struct LevelStore* store, int depth) {
+    return find(store, depth) != NULL;
+}
+
+// Full copy to compressed copy; stays full if compression fails
+static void pack(struct LevelStore* store, struct StoredLevel* level) {
+    TRACE_SCOPE("level_pack");
+    const size_t cap = COMPRESS_BOUND(sizeof(struct Map));
+    uint8_t* packed = malloc(cap);
+    size_t size = packed ? compress_buffer((const uint8_t*)level->map, sizeof(struct Map), packed, cap) : 0;
+    if (size == 0) {
+        free(packed);
+        return;
+    }
+
+    uint8_t* shrunk = realloc(packed, size);
+    level->packed = shrunk ? shrunk : packed;
+    level->packed_size = size;
+    free(level->map);
+    level->map = NULL;
+    level->form = LEVEL_PACKED;
+    store->packed_bytes += size;
+}
+
+// Compressed copy to the spill file; stays in memory if the write fails
+static bool spill(struct LevelStore* store, struct StoredLevel* level) {
+    TRACE_SCOPE("level_spill");
+    if (store->spill == NULL) store->spill = tmpfile();
+    if (store->spill == NULL) return false;
+
+    if (fseek(store->spill, store->spill_end, SEEK_SET) != 0 ||
+        fwrite(level->packed, level->packed_size, 1, store->spill) != 1 ||
+        fflush(store->spill) != 0) {
+        return false;
+    }
+
+    level->spill_offset = store->spill_end;
+    store->spill_end += (long)level->packed_size;
+    store->spilled++;
+    store->packed_bytes -= level->packed_size;
+    free(level->packed);
+    level->packed = NULL;
+    level->form = LEVEL_SPILLED;
+    return true;
+}
+
+// Compresses floors more than LEVEL_NEAR away from the current one, then
+// spills the least recently left until the rest fit the budget
+static void settle(struct LevelStore* store, int current_depth) {
+    for (int depth = 0; depth < store->capacity; depth++) {
+        struct StoredLevel* level = &store->levels[depth];
+        if (level->form == LEVEL_FULL && abs(depth - current_depth) > LEVEL_NEAR) pack(store, level);
+    }
+
+    while (store->packed_bytes > LEVEL_CACHE_BUDGET) {
+        struct StoredLevel* oldest = NULL;
+        for (int depth = 0; depth < store->capacity; depth++) {
+            struct StoredLevel* level = &store->levels[depth];
+            if (level->form == LEVEL_PACKED && (oldest == NULL || level->last_left < oldest->last_left)) {
+                oldest = level;
+            }
+        }
+        if (oldest == NULL || !spill(store, oldest)) break;
+    }
+}
+
+// Makes room for the floor at 'depth' and empties its slot
+static struct StoredLevel* claim(struct LevelStore* store, int depth) {
+    if (depth < 0) return NULL;
+    if (depth >= store->capacity) {
+        int capacity = store->capacity ? store->capacity : 8;
+        while (capacity <= depth) capacity *= 2;
+        struct StoredLevel* grown = realloc(store->levels, capacity * sizeof(struct StoredLevel));
+        if (grown == NULL) return NULL;
+        memset(grown + store->capacity, 0, (capacity - store->capacity) * sizeof(struct StoredLevel));
+        store->levels = grown;
+        store->capacity = capacity;
+    }
+
+    struct StoredLevel* level = &store->levels[depth];
+    forget(store, level);
+    return level;
+}
+
+// Keeps a copy of the floor at 'depth', which the player is leaving for
+// 'current_depth'
+bool level_store_put(struct LevelStore* store, int depth, const struct Map* map, int current_depth) {
+    struct StoredLevel* level = claim(store, depth);
+    if (level == NULL) return false;
+    level->map = malloc(sizeof(struct Map));
+    if (level->map == NULL) return false;
+    memcpy(level->map, map, sizeof(struct Map));
+    level->form = LEVEL_FULL;
+    level->last_left = ++store->clock;
+
+    settle(store, current_depth);
+    return true;
+}
+
+// Full copy of a compressed or spilled floor, NULL if it cannot be read back
+static struct Map* unpack(struct LevelStore* store, struct StoredLevel* level) {
+    TRACE_SCOPE("level_unpack");
+    struct Map* map = malloc(sizeof(struct Map));
+    uint8_t* packed = level->packed;
+    if (map && level->form == LEVEL_SPILLED) {
+        packed = malloc(level->packed_size);
+        bool ok = packed != NULL &&
+                  fseek(store->spill, level->spill_offset, SEEK_SET) == 0 &&
+                  fread(packed, level->packed_size, 1, store->spill) == 1;
+        if (!ok) {
+            free(packed);
+            packed = NULL;
+        }
+    }
+
+    bool ok = map && packed &&
+              decompress_buffer(packed, level->packed_size, (uint8_t*)map, sizeof(struct Map)) == sizeof(struct Map);
+    if (packed != level->packed) free(packed);
+    if (!ok) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+// Restores the floor at 'depth' into 'map' and drops it from the store.
+// 'map' is left alone if the floor is not there or cannot be read back.
+bool level_store_take(struct LevelStore* store, int depth, struct Map* map) {
+    struct StoredLevel* level = find(store, depth);
+    if (level == NULL) return false;
+
+    struct Map* restored = level->form == LEVEL_FULL ? level->map : unpack(store, level);
+    if (restored == NULL) return false;
+    memcpy(map, restored, sizeof(struct Map));
+    if (restored != level->map) free(restored);
+    forget(store, level);
+    return true;
+}
+
+// Saved floors: for each, its depth (int32), its size (uint32) and that many
+// bytes of compressed struct Map, in the order the player left them so the
+// spill order survives a reload.
+#define RECORD_HEADER (sizeof(int32_t) + sizeof(uint32_t))
+
+static bool append(uint8_t** data, size_t* size, size_t* capacity, const void* bytes, size_t length) {
+    if (*size + length > *capacity) {
+        size_t grown_capacity = *capacity ? *capacity : 4096;
+        while (grown_capacity < *size + length) grown_capacity *= 2;
+        uint8_t* grown = realloc(*data, grown_capacity);
+        if (grown == NULL) return false;
+        *data = grown;
+        *capacity = grown_capacity;
+    }
+    memcpy(*data + *size, bytes, length);
+    *size += length;
+    return true;
+}
+
+// Compressed bytes of one floor; *owned is set when the caller must free them
+static const uint8_t* packed_bytes(const struct LevelStore* store, const struct StoredLevel* level,
+                                   size_t* length, bool* owned) {
+    *owned = false;
+    *length = level->packed_size;
+    if (level->form == LEVEL_PACKED) return level->packed;
+
+    uint8_t* bytes = NULL;
+    if (level->form == LEVEL_SPILLED) {
+        // pread leaves the file position alone: the caller may be a forked
+        // snapshot child sharing it with the game
+        bytes = malloc(level->packed_size);
+        if (bytes && pread(fileno(store->spill), bytes, level->packed_size, level->spill_offset) !=
+                     (ssize_t)level->packed_size) {
+            free(bytes);
+            return NULL;
+        }
+    } else {
+        const size_t cap = COMPRESS_BOUND(sizeof(struct Map));
+        bytes = malloc(cap);
+        *length = bytes ? compress_buffer((const uint8_t*)level->map, sizeof(struct Map), bytes, cap) : 0;
+        if (*length == 0) {
+            free(bytes);
+            return NULL;
+        }
+    }
+    *owned = bytes != NULL;
+    return bytes;
+}
+
+// Every stored floor in the form above, in a malloc'd buffer (NULL and 0 for
+// an empty store). Does not change the store. False if a floor cannot be
+// compressed or read back.
+bool level_store_serialize(const struct LevelStore* store, uint8_t** data, size_t* size) {
+    TRACE_SCOPE("level_store_serialize");
+    size_t capacity = 0;
+    *data = NULL;
+    *size = 0;
+
+    unsigned long after = 0;   // Last-left clock of the floor written last
+    for (;;) {
+        const struct StoredLevel* next = NULL;
+        int next_depth = -1;
+        for (int depth = 0; depth < store->capacity; depth++) {
+            const struct StoredLevel* level = &store->levels[depth];
+            if (level->form != LEVEL_NONE && level->last_left > after &&
+                (next == NULL || level->last_left < next->last_left)) {
+                next = level;
+                next_depth = depth;
+            }
+        }
+        if (next == NULL) return true;
+        after = next->last_left;
+
+        size_t length = 0;
+        bool owned = false;
+        const uint8_t* bytes = packed_bytes(store, next, &length, &owned);
+        int32_t depth = next_depth;
+        uint32_t stored = (uint32_t)length;
+        bool ok = bytes != NULL &&
+                  append(data, size, &capacity, &depth, sizeof(depth)) &&
+                  append(data, size, &capacity, &stored, sizeof(stored)) &&
+                  append(data, size, &capacity, bytes, length);
+        if (owned) free((void*)bytes);
+        if (!ok) {
+            free(*data);
+            *data = NULL;
+            *size = 0;
+            return false;
+        }
+    }
+}
+
+// Adds the floors level_store_serialize wrote to the store, then settles
+// them around 'current_depth'. False if the data is malformed; floors read
+// before the error stay.
+bool level_store_deserialize(struct LevelStore* store, const uint8_t* data, size_t size, int current_depth) {
+    size_t pos = 0;
+    bool ok = true;
+    while (ok && pos < size) {
+        int32_t depth;
+        uint32_t length;
+        ok = size - pos >= RECORD_HEADER;
+        if (!ok) break;
+        memcpy(&depth, data + pos, sizeof(depth));
+        memcpy(&length, data + pos + sizeof(depth), sizeof(length));
+        pos += RECORD_HEADER;
+
+        ok = length > 0 && length <= COMPRESS_BOUND(sizeof(struct Map)) && size - pos >= length &&
+             depth != current_depth;
+        struct StoredLevel* level = ok ? claim(store, depth) : NULL;
+        uint8_t* packed = level ? malloc(length) : NULL;
+        ok = packed != NULL;
+        if (ok) {
+            memcpy(packed, data + pos, length);
+            level->packed = packed;
+            level->packed_size = length;
+            level->form = LEVEL_PACKED;
+            level->last_left = ++store->clock;
+            store->packed_bytes += length;
+            pos += length;
+        }
+    }
+    settle(store, current_depth);
+    return ok;
+}
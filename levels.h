@@ -0,0 +1,35 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Floors the player has left, keyed by depth, so the stairs lead back to
+// them exactly as they were. The floor being played is the game's own
+// struct Map; the store only holds the others.
+//   - Floors within LEVEL_NEAR of the current one are kept as full copies,
+//     so stepping one floor up or down is a memcpy.
+//   - Farther floors are compressed (compress.h) and kept in memory up to
+//     LEVEL_CACHE_BUDGET bytes.
+//   - Past the budget, the least recently left floor is written to an
+//     unnamed temporary file and read back when it is needed.
+// Saved games carry the store (level_store_serialize), so the stairs up
+// still lead somewhere after a reload.
+
+#define LEVEL_NEAR          1                // Floors either side kept uncompressed
+#define LEVEL_CACHE_BUDGET  (64 * 1024)      // Compressed bytes kept in memory
+
+struct Map;
+struct LevelStore;
+
+// Function declarations
+struct LevelStore* level_store_create(void);
+void level_store_destroy(struct LevelStore* store);
+bool level_store_put(struct LevelStore* store, int depth, const struct Map* map, int current_depth);
+bool level_store_has(const struct LevelStore* store, int depth);
+bool level_store_take(struct LevelStore* store, int depth, struct Map* map);
+bool level_store_serialize(const struct LevelStore* store, uint8_t** data, size_t* size);
+bool level_store_deserialize(struct LevelStore* store, const uint8_t* data, size_t size, int current_depth);
+
+#endif
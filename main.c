@@ -5,87 +5,312 @@
 #include "menu.h"
 #include "game.h"
 #include "users.h"
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_mixer.h>
+#include "userdb.h"
+#include "audio.h"
+#include "trace.h"
+#include "input.h"
+#include "server.h"
+#include "spectate.h"
+#include "cast.h"
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+// --startup-trace: when each startup phase ran, in ms since main() started
+enum StartupPhase {
+    PHASE_LOCALE,
+    PHASE_NCURSES,
+    PHASE_USERS,        // Worker thread
+    PHASE_FIRST_FRAME,
+    PHASE_USERS_WAIT,   // Main thread blocked on the users worker
+    PHASE_COUNT
+};
 
-int main() {
+static const char* phase_names[PHASE_COUNT] = {
+    "locale", "ncurses", "users (worker)", "first frame", "wait for users"
+};
+
+static struct timespec startup_begin;
+static double phase_start[PHASE_COUNT];
+static double phase_end[PHASE_COUNT];
+
+static double startup_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - startup_begin.tv_sec) * 1e3 +
+           (now.tv_nsec - startup_begin.tv_nsec) / 1e6;
+}
+
+static void print_startup_trace(void) {
+    fprintf(stderr, "Startup trace (ms since start):\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(stderr, "  %-16s %8.2f - %8.2f  (%.2f)\n", phase_names[i],
+                phase_start[i], phase_end[i], phase_end[i] - phase_start[i]);
+    }
+    double audio_ms = audio_open_ms();
+    if (audio_ms >= 0) {
+        fprintf(stderr, "  %-16s %8s   %8s  (%.2f)\n", "audio (worker)", "", "", audio_ms);
+    }
+}
+
+// Users are loaded on a worker while ncurses comes up and the first frame is
+// drawn; the menu joins it when the player first picks an option.
+struct UsersLoader {
+    pthread_t thread;
+    bool running;
+    const char* db_path;
+    struct UserManager* manager;
+};
+
+static void* load_users_main(void* arg) {
+    struct UsersLoader* loader = arg;
+    phase_start[PHASE_USERS] = startup_ms();
+    loader->manager = create_user_manager(loader->db_path);
+    phase_end[PHASE_USERS] = startup_ms();
+    return NULL;
+}
+
+static void start_loading_users(struct UsersLoader* loader) {
+    loader->running = pthread_create(&loader->thread, NULL, load_users_main, loader) == 0;
+    if (!loader->running) load_users_main(loader);
+}
+
+static struct UserManager* wait_for_users(struct UsersLoader* loader) {
+    phase_start[PHASE_USERS_WAIT] = startup_ms();
+    if (loader->running) {
+        pthread_join(loader->thread, NULL);
+        loader->running = false;
+    }
+    phase_end[PHASE_USERS_WAIT] = startup_ms();
+
+    // The loader only records why it failed: exiting from its thread would
+    // race ncurses coming up here
+    if (!loader->manager) {
+        endwin();
+        fprintf(stderr, "%s\n", users_load_error());
+        exit(1);
+    }
+    return loader->manager;
+}
+
+// --replay: plays every game in the log through start_new_game with the
+// screen going to /dev/null and files written to a scratch directory, then
+// prints how long it took and whether the log still matches the game
+static int run_replay(const char* path) {
+    if (!input_replay_open(path)) {
+        fprintf(stderr, "Cannot read input log %s\n", path);
+        return 1;
+    }
+    audio_disable();
+
+    if (!input_open_headless(MAP_HEIGHT + 10, MAP_WIDTH + 60)) {
+        fprintf(stderr, "Cannot open a headless terminal for the replay\n");
+        return 1;
+    }
+
+    int home = open(".", O_RDONLY);
+    char scratch[] = "/tmp/replay_XXXXXX";
+    if (home < 0 || !mkdtemp(scratch) || chdir(scratch) != 0 || mkdir("saves", 0755) != 0) {
+        input_close_headless();
+        fprintf(stderr, "Cannot create a scratch directory for the replay\n");
+        return 1;
+    }
+
+    struct UserManager* manager = calloc(1, sizeof(struct UserManager));
+    struct User player = { .music_on = false };
+    strcpy(player.username, "replay");
+    if (manager) manager->current_user = add_user(manager, &player);
+    if (manager == NULL || manager->current_user == NULL) {
+        input_close_headless();
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while (input_replay_has_game()) {
+        start_new_game(manager);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+    free_user_manager(manager);
+    input_close_headless();
+
+    remove("saves/replay.sav");
+    rmdir("saves");
+    remove("users.json");
+    remove(USERS_CHECKSUM_FILE);
+    remove(USERS_LOCK_FILE);
+    if (fchdir(home) == 0) rmdir(scratch);
+    close(home);
+
+    const struct InputReplayStats* stats = input_replay_stats();
+    printf("Replayed %d games: %ld turns, %ld inputs in %.3f s (%.0f turns/s)\n",
+           stats->games, stats->turns, stats->keys, seconds,
+           seconds > 0 ? stats->turns / seconds : 0.0);
+    if (stats->desyncs || stats->overruns) {
+        printf("Log does not match the game: %ld mismatched events, %ld inputs past the end\n",
+               stats->desyncs, stats->overruns);
+    }
+    input_close();
+    TRACE_DUMP();
+    return stats->desyncs || stats->overruns ? 2 : 0;
+}
+
+static void print_usage(const char* program) {
+    printf("Usage: %s [options]\n"
+           "  --user-db       Keep users in the binary database %s (created from\n"
+           "                  users.json on first use; used automatically once it exists)\n"
+           "  --import-users  Rebuild %s from users.json\n"
+           "  --export-users  Write users.json from %s and exit\n"
+           "  --no-audio      Start without sound\n"
+           "  --startup-trace Print how long each startup phase took on exit\n"
+           "  --record FILE   Append every new game played to the input log FILE\n"
+           "  --replay FILE   Play back the games in FILE without a terminal and exit\n"
+           "  --server PATH   Host players on the unix socket PATH instead of playing\n"
+           "  --port PORT     Host telnet players on 127.0.0.1:PORT instead of playing\n"
+           "  --workers N     Server worker threads (default: one per core)\n"
+           "  --spectate PATH Let spectators watch games on the unix socket PATH\n"
+           "  --cast PATH     Record what the player sees to PATH in asciicast v2 format\n"
+           "                  (with --server or --port: a directory, one file per session)\n",
+           program, USERDB_FILE, USERDB_FILE, USERDB_FILE);
+}
+
+int main(int argc, char* argv[]) {
+    clock_gettime(CLOCK_MONOTONIC, &startup_begin);
+    bool use_user_db = userdb_exists(USERDB_FILE);
+    bool import_users = false;
+    bool export_users = false;
+    bool startup_trace = false;
+    struct ServerOptions server = { 0 };
+    const char* cast_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--user-db") == 0) {
+            use_user_db = true;
+        } else if (strcmp(argv[i], "--import-users") == 0) {
+            use_user_db = import_users = true;
+        } else if (strcmp(argv[i], "--export-users") == 0) {
+            export_users = true;
+        } else if (strcmp(argv[i], "--no-audio") == 0) {
+            audio_disable();
+        } else if (strcmp(argv[i], "--startup-trace") == 0) {
+            startup_trace = true;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            if (!input_record_open(argv[++i])) {
+                fprintf(stderr, "Cannot open input log %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            return run_replay(argv[++i]);
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            server.socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            server.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            server.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spectate") == 0 && i + 1 < argc) {
+            server.spectate_path = argv[++i];
+        } else if (strcmp(argv[i], "--cast") == 0 && i + 1 < argc) {
+            cast_path = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (export_users) {
+        if (!userdb_exists(USERDB_FILE)) {
+            fprintf(stderr, "%s does not exist; users.json is already current.\n", USERDB_FILE);
+            return 1;
+        }
+        struct UserManager* manager = create_user_manager(USERDB_FILE);
+        if (manager == NULL) {
+            fprintf(stderr, "%s\n", users_load_error());
+            return 1;
+        }
+        export_users_json(manager);
+        printf("Exported %d users to users.json\n", manager->user_count);
+        free_user_manager(manager);
+        return 0;
+    }
+    if (import_users) {
+        remove(USERDB_FILE);
+    }
+    if (server.socket_path || server.port) {
+        server.db_path = use_user_db ? USERDB_FILE : NULL;
+        server.cast_dir = cast_path;
+        int status = run_server(&server);
+        TRACE_DUMP();
+        return status;
+    }
+    if (server.spectate_path && !spectate_start(server.spectate_path)) {
+        fprintf(stderr, "Cannot listen for spectators on %s\n", server.spectate_path);
+        return 1;
+    }
+    struct SpectateChannel* channel = spectate_channel_create();
+    spectate_set_channel(channel);
+
+    // Users do not depend on the terminal: start loading them first. Audio
+    // waits until a player with music on is known (see login_menu).
+    struct UsersLoader loader = { .db_path = use_user_db ? USERDB_FILE : NULL };
+    start_loading_users(&loader);
 
     // Initialize locale for proper Unicode support
+    phase_start[PHASE_LOCALE] = startup_ms();
     setlocale(LC_ALL, "");
+    phase_end[PHASE_LOCALE] = startup_ms();
 
     // Initialize ncurses
+    phase_start[PHASE_NCURSES] = startup_ms();
     cbreak();        // Disable line buffering
     
     // Initialize random seed with current time
     srand(time(NULL));
     init_ncurses();
+    phase_end[PHASE_NCURSES] = startup_ms();
 
-    // Initialize SDL
-    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-        endwin();
-        fprintf(stderr, "SDL could not initialize! SDL Error: %s\n", SDL_GetError());
-        return 1;
+    struct Cast* cast = NULL;
+    if (cast_path) {
+        cast = cast_open(cast_path);
+        if (cast == NULL) {
+            endwin();
+            fprintf(stderr, "Cannot create recording %s\n", cast_path);
+            return 1;
+        }
+        cast_set_current(cast);
     }
 
-    // Initialize SDL_mixer
-    if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
-        endwin();
-        fprintf(stderr, "SDL_mixer could not initialize! SDL_mixer Error: %s\n", Mix_GetError());
-        return 1;
-    }
-    
-    // Create user manager
-    struct UserManager* manager = create_user_manager();
-    if (!manager) {
-        Mix_CloseAudio();
-        SDL_Quit();
-        endwin();
-        fprintf(stderr, "Failed to create user manager\n");
-        return 1;
-    }
+    struct UserManager* manager = NULL;
+    phase_start[PHASE_FIRST_FRAME] = startup_ms();
 
     // Main menu loop
     bool running = true;
     while (running) {
-        clear();
-        mvprintw(0, 0, "Welcome to the Game!");
-        mvprintw(2, 0, "1. Login");
-        mvprintw(3, 0, "2. Register");
-        mvprintw(4, 0, "3. Play as Guest");
-        mvprintw(5, 0, "4. Quit");
-        mvprintw(7, 0, "Current Date and Time (UTC): 2025-01-04 19:45:03");
-        mvprintw(8, 0, "Please choose an option (1-4): ");
-        refresh();
-
-        int choice = getch();
-
-        switch (choice) {
-            case '1':
-                login_menu(manager);
-                break;
-            case '2':
-                register_menu(manager);
-                break;
-            case '3':
-                // Play as guest
-                initialize_guest(manager);
-                break;
-            case '4':
-                running = false;
-                break;
-            default:
-                mvprintw(10, 0, "Invalid option. Press any key to continue...");
-                refresh();
-                getch();
-                break;
-        }
+        draw_welcome_menu();
+        if (manager == NULL) phase_end[PHASE_FIRST_FRAME] = startup_ms();
+
+        int choice = input_getch();
+        if (manager == NULL) manager = wait_for_users(&loader);
+
+        running = welcome_menu_choice(manager, choice);
     }
 
     // Cleanup
+    flush_users(manager);
     free_user_manager(manager);
-    Mix_CloseAudio();
-    SDL_Quit();
+    audio_shutdown();
+    spectate_channel_destroy(channel);
+    spectate_shutdown();
+    cast_set_current(NULL);
+    cast_close(cast);
     endwin();
+    if (startup_trace) print_startup_trace();
+    input_close();
+    TRACE_DUMP();
     return 0;
 }
\ No newline at end of file
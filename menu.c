@@ -1,20 +1,30 @@
 #include <ncurses.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <SDL2/SDL_mixer.h>
 #include "menu.h"
 #include "users.h"
 #include "game.h"
-
-static Mix_Music* g_currentMusic = NULL;
+#include "audio.h"
+#include "input.h"
+#include "levels.h"
+
+// scanw through the input layer: reads a line, then parses it
+static int scan_input(const char* format, ...) {
+    char line[INPUT_MAX_LINE];
+    if (input_getnstr(line, sizeof(line) - 1) != OK) return 0;
+
+    va_list args;
+    va_start(args, format);
+    int parsed = vsscanf(line, format, args);
+    va_end(args);
+    return parsed;
+}
 
 bool init_ncurses(void) {
 
     initscr();
-    raw();
-    keypad(stdscr, TRUE);
-    noecho();
-    curs_set(0);
     
     if (!has_colors()) {
         endwin();
@@ -22,6 +32,18 @@ bool init_ncurses(void) {
         return false;
     }
     
+    setup_screen();
+    return true;
+}
+
+// Input modes and color pairs for the current screen. Every SCREEN needs its
+// own: the terminal's, and each server session's.
+void setup_screen(void) {
+    raw();
+    keypad(stdscr, TRUE);
+    noecho();
+    curs_set(0);
+
     start_color();
     use_default_colors();
 
@@ -57,8 +79,42 @@ bool init_ncurses(void) {
     init_pair(COLOR_PAIR_HEALTH,  COLOR_MAGENTA, COLOR_BLACK); // Health Spell
     init_pair(COLOR_PAIR_SPEED,   COLOR_CYAN,     COLOR_BLACK); // Speed Spell
     init_pair(COLOR_PAIR_DAMAGE,  COLOR_RED,      COLOR_BLACK); // Damage Spell
+}
 
+// The first screen: log in, register, play as guest or quit
+void draw_welcome_menu(void) {
+    clear();
+    mvprintw(0, 0, "Welcome to the Game!");
+    mvprintw(2, 0, "1. Login");
+    mvprintw(3, 0, "2. Register");
+    mvprintw(4, 0, "3. Play as Guest");
+    mvprintw(5, 0, "4. Quit");
+    mvprintw(7, 0, "Current Date and Time (UTC): 2025-01-04 19:45:03");
+    mvprintw(8, 0, "Please choose an option (1-4): ");
+    refresh();
+}
 
+// Acts on a key pressed on the welcome screen; false once the player quits
+bool welcome_menu_choice(struct UserManager* manager, int choice) {
+    switch (choice) {
+        case '1':
+            login_menu(manager);
+            break;
+        case '2':
+            register_menu(manager);
+            break;
+        case '3':
+            // Play as guest
+            initialize_guest(manager);
+            break;
+        case '4':
+            return false;
+        default:
+            mvprintw(10, 0, "Invalid option. Press any key to continue...");
+            refresh();
+            input_getch();
+            break;
+    }
     return true;
 }
 
@@ -100,15 +156,6 @@ void generate_password(char *password, int length) {
 }
 
 void adding_new_user(struct UserManager* manager) {
-    if (manager->user_count >= MAX_USERS) {
-        clear();
-        printw("Maximum number of users reached.\n");
-        printw("Press any key to continue...");
-        refresh();
-        getch();
-        return;
-    }
-
     while (1) {
         clear();
         echo(); // Enable character echo for input
@@ -123,10 +170,10 @@ void adding_new_user(struct UserManager* manager) {
         char email[MAX_STRING_LEN];
 
         // Get username
-        if (getnstr(username, sizeof(username) - 1) != OK) {
+        if (input_getnstr(username, sizeof(username) - 1) != OK) {
             printw("\nError reading username. Press any key to try again...");
             refresh();
-            getch();
+            input_getch();
             continue;
         }
 
@@ -135,24 +182,18 @@ void adding_new_user(struct UserManager* manager) {
             printw("\nUsername must be between 3 and 20 characters.\n");
             printw("Press any key to try again...");
             refresh();
-            getch();
+            input_getch();
             continue;
         }
 
-        // Check username uniqueness
-        bool unique = true;
-        for (int i = 0; i < manager->user_count; i++) {
-            if (strcmp(manager->users[i].username, username) == 0) {
-                unique = false;
-                break;
-            }
-        }
-
-        if (!unique) {
+        // Check username uniqueness, including players registered by other
+        // sessions (register_user checks again when it stores the user)
+        refresh_users(manager);
+        if (find_user_index(manager, username) >= 0) {
             printw("\nUsername already taken. Please choose another one.\n");
             printw("Press any key to try again...");
             refresh();
-            getch();
+            input_getch();
             continue;
         }
 
@@ -163,7 +204,7 @@ void adding_new_user(struct UserManager* manager) {
         refresh();
 
         noecho();
-        char key = getch();
+        char key = input_getch();
         if (key == '+'){
             // Generate password automatically
             generate_password(password, sizeof(password) - 1);
@@ -173,10 +214,10 @@ void adding_new_user(struct UserManager* manager) {
         else{
             echo(); // Re-enable echo for password
             printw("\nEnter your password: ");
-            if (getnstr(password, sizeof(password) - 1) != OK) {
+            if (input_getnstr(password, sizeof(password) - 1) != OK) {
                 printw("\nError reading password. Press any key to try again...");
                 refresh();
-                getch();
+                input_getch();
                 continue;
             }
         }
@@ -186,7 +227,7 @@ void adding_new_user(struct UserManager* manager) {
             printw("\nPassword must be at least 7 characters long.\n");
             printw("Press any key to try again...");
             refresh();
-            getch();
+            input_getch();
             continue;
         }
 
@@ -195,7 +236,7 @@ void adding_new_user(struct UserManager* manager) {
             printw("\nPassword must contain at least one uppercase letter, one lowercase letter, and one number.\n");
             printw("Press any key to try again...");
             refresh();
-            getch();
+            input_getch();
             continue;
         }
 
@@ -204,10 +245,10 @@ void adding_new_user(struct UserManager* manager) {
         printw("\nEmail (format: xxx@yyy.zzz): ");
         refresh();
         
-        if (getnstr(email, sizeof(email) - 1) != OK) {
+        if (input_getnstr(email, sizeof(email) - 1) != OK) {
             printw("\nError reading email. Press any key to try again...");
             refresh();
-            getch();
+            input_getch();
             continue;
         }
 
@@ -216,50 +257,54 @@ void adding_new_user(struct UserManager* manager) {
             printw("\nInvalid email format. Must be xxx@yyy.zzz\n");
             printw("Press any key to try again...");
             refresh();
-            getch();
+            input_getch();
             continue;
         }
 
         // All validations passed; add the new user
-        struct User* new_user = &manager->users[manager->user_count];
-        strncpy(new_user->username,  username,  MAX_STRING_LEN - 1);
-        strncpy(new_user->password,  password,  MAX_STRING_LEN - 1);
-        strncpy(new_user->email,     email,     MAX_STRING_LEN - 1);
-        new_user->username[MAX_STRING_LEN - 1] = '\0';
-        new_user->password[MAX_STRING_LEN - 1] = '\0';
-        new_user->email[MAX_STRING_LEN - 1]    = '\0';
+        struct User new_user;
+        memset(&new_user, 0, sizeof(new_user));
+        strncpy(new_user.username,  username,  MAX_STRING_LEN - 1);
+        strncpy(new_user.password,  password,  MAX_STRING_LEN - 1);
+        strncpy(new_user.email,     email,     MAX_STRING_LEN - 1);
 
         // Initialize user details
-        new_user->score           = 0;
-        new_user->games_completed = 0;
-        new_user->gold            = 0;
-        new_user->difficulty      = 1;
-        new_user->song            = 1;
-        strcpy(new_user->character_color, "White");
-        new_user->music_on        = true;
+        new_user.score           = 0;
+        new_user.games_completed = 0;
+        new_user.gold            = 0;
+        new_user.difficulty      = 1;
+        new_user.song            = 1;
+        strcpy(new_user.character_color, "White");
+        new_user.music_on        = true;
 
         time_t now = time(NULL);
-        new_user->first_game_time = now;
-        new_user->last_game_time  = now;
-        new_user->days_since_first_game = 0;
-
-        // Also store in the manager->usernames array
-        strncpy(manager->usernames[manager->user_count], username, MAX_STRING_LEN - 1);
-        manager->usernames[manager->user_count][MAX_STRING_LEN - 1] = '\0';
+        new_user.first_game_time = now;
+        new_user.last_game_time  = now;
+        new_user.days_since_first_game = 0;
 
-        // Increase user_count
-        manager->user_count++;
-
-        // Save this new user to the JSON file
-        // We'll append if the file is new, or rewrite using save_users_to_json
-        // but let's just do an immediate rewrite of the entire file for consistency:
-        save_users_to_json(manager);
+        struct User* added = register_user(manager, &new_user);
+        if (added == NULL) {
+            clear();
+            if (find_user_index(manager, username) >= 0) {
+                // Another session registered it while this form was filled in
+                printw("Username already taken. Please choose another one.\n");
+                printw("Press any key to try again...");
+                refresh();
+                input_getch();
+                continue;
+            }
+            printw("Could not add the user.\n");
+            printw("Press any key to continue...");
+            refresh();
+            input_getch();
+            return;
+        }
 
         clear();
         printw("User successfully added!\n");
         printw("Press any key to continue...");
         refresh();
-        getch();
+        input_getch();
         break;
     }
 }
@@ -267,13 +312,15 @@ void adding_new_user(struct UserManager* manager) {
 // Modified users_menu to use UserManager
 int users_menu(struct UserManager* manager) {
     int user_id = 0;
+    refresh_users(manager);  // Include players registered by other sessions
     echo();
     while (!user_id) {
         clear();
         mvprintw(0, 0, "\nPress the number for the user you want to choose. Press [q] to quit.");        
         print_users(manager);
-        char input[10];
-        mvscanw(manager->user_count + 5, 0, "%s", input);
+        char input[10] = "";
+        move(manager->user_count + 5, 0);
+        scan_input("%9s", input);
         if (strcmp(input, "q") == 0){
             clear();
             return 0;
@@ -297,25 +344,25 @@ bool entering_menu(struct UserManager* manager, int selected_index) {
         clear();
         printw("Enter the password for the chosen username: ");
         printw("\nPress + if you have forgotten your password.");
-        int key = getch();
+        int key = input_getch();
         if (key=='+'){
             printw("\nEnter your Email: ");
             char email[100];
-            scanw("%s", email);
+            scan_input("%99s", email);
             echo();
 
             if (strcmp(manager->users[selected_index - 1].email, email) == 0) {
                 manager->current_user = &manager->users[selected_index - 1];
                 printw("\nEmail is correct.\n");
                 refresh();
-                getch();
+                input_getch();
                 return true;
             }
 
             else{
                 printw("\nEmail is incorrect. Please try again.\n");
                 refresh();
-                getch();
+                input_getch();
             }
 
         }
@@ -323,18 +370,18 @@ bool entering_menu(struct UserManager* manager, int selected_index) {
         else{
             printw("\nEnter you password: ");
             char password[MAX_STRING_LEN];
-            scanw("%s", password);
+            scan_input("%99s", password);
             echo();
 
             if (authenticate_user(manager, selected_index - 1, password)) {
                 printw("\nPassword is correct.\n");
                 refresh();
-                getch();
+                input_getch();
                 return true;
             } else {
                 printw("\nPassword is incorrect. Please try again.\n");
                 refresh();
-                getch();
+                input_getch();
             }
         }
     }
@@ -354,7 +401,7 @@ void first_menu(struct UserManager* manager) {
         printw("4- Press [q] to quit.\n");
         refresh();
 
-        input = getch();
+        input = input_getch();
         
         switch(input) {
             case 's':
@@ -382,7 +429,7 @@ void first_menu(struct UserManager* manager) {
                 printw("Invalid Input. You must enter l, g, s, or q.\n");
                 printw("Press Any Key To Continue...");
                 refresh();
-                getch();
+                input_getch();
         }
     }
 }
@@ -395,7 +442,7 @@ void settings(struct UserManager* manager) {
     if (!manager->current_user) {
         mvprintw(0, 0, "No user logged in!");
         refresh();
-        getch();
+        input_getch();
         return;
     }
 
@@ -410,7 +457,7 @@ void settings(struct UserManager* manager) {
     mvprintw(7, 0, "Modify settings? (y/n)");
     refresh();
     
-    if (getch() != 'y') return;
+    if (input_getch() != 'y') return;
 
     // Variables for new settings
     int difficulty;
@@ -419,19 +466,20 @@ void settings(struct UserManager* manager) {
 
     echo();
     mvprintw(9, 0, "Difficulty [1-10]: ");
-    scanw("%d", &difficulty);
+    scan_input("%d", &difficulty);
 
     mvprintw(10, 0, "Character color [White/Red/Blue/Green]: ");
-    scanw("%s", color);
+    scan_input("%19s", color);
 
     mvprintw(11, 0, "Song [1-Venom, 2-Chandelier, 3-Hello]: ");
-    scanw("%d", &song);
+    scan_input("%d", &song);
 
     mvprintw(12, 0, "Play music? [1=ON, 0=OFF]: ");
     int musicChoice = 1;
-    scanw("%d", &musicChoice);
+    scan_input("%d", &musicChoice);
 
     // Update the current user's settings
+    begin_user_update(manager, manager->current_user);
     manager->current_user->music_on = (musicChoice != 0);
     noecho();
 
@@ -440,15 +488,15 @@ void settings(struct UserManager* manager) {
     strncpy(manager->current_user->character_color, color, sizeof(manager->current_user->character_color) - 1);
     manager->current_user->song = song;
 
-    // Save updated settings to JSON
-    save_users_to_json(manager);
+    // Save updated settings
+    save_user(manager, manager->current_user, USER_FIELD_SETTINGS);
 
     // Also optionally: play the new chosen song
     play_music(manager->current_user);
 
     mvprintw(13, 0, "Settings saved successfully!");
     refresh();
-    getch();
+    input_getch();
 }
 
 void login_menu(struct UserManager* manager) {
@@ -457,8 +505,12 @@ void login_menu(struct UserManager* manager) {
 
     int selected_index = users_menu(manager);
     if (selected_index > 0) {
+        // Bring audio up while the password is typed, so the song below
+        // does not wait on the device
+        if (manager->users[selected_index - 1].music_on) audio_start();
         if (entering_menu(manager, selected_index)) {
             manager->current_user->last_game_time = time(NULL);
+            save_user(manager, manager->current_user, USER_FIELD_GAME_TIMES);  // Written with the next flush
             play_music(manager->current_user);  // <-- Play the chosen song
             pre_game_menu(manager);
         }
@@ -479,6 +531,7 @@ void pre_game_menu(struct UserManager* manager) {
     bool running = true;
 
     while (running) {
+        flush_users_if_due(manager);
         clear();
         mvprintw(0, 0, "Game Menu");
         mvprintw(2, 0, "1. New Game");
@@ -498,7 +551,7 @@ void pre_game_menu(struct UserManager* manager) {
         mvprintw(12, 0, "Choose an option (1-6): ");
         refresh();
 
-        int choice = getch();
+        int choice = input_getch();
         
         switch (choice) {
             case '1':
@@ -523,7 +576,7 @@ void pre_game_menu(struct UserManager* manager) {
                 } else {
                     mvprintw(13, 0, "No user logged in. Press any key to continue...");
                     refresh();
-                    getch();
+                    input_getch();
                 }
                 break;
             case '6':
@@ -533,36 +586,48 @@ void pre_game_menu(struct UserManager* manager) {
             default:
                 mvprintw(13, 0, "Invalid option. Press any key to continue...");
                 refresh();
-                getch();
+                input_getch();
                 break;
         }
     }
 }
 
 void start_new_game(struct UserManager* manager) {
+    input_begin_game(manager);  // Recorded or replayed from here on
+
     // We'll create a brand new Map, brand new Player
+    input_begin_level(1);
     struct Map game_map = generate_map(manager, NULL, 1, 4, 0, 0);
 
     // Make a fresh Player
     Player player;
     initialize_player(manager, &player, game_map.initial_position);
     // Now start play
-    play_game(manager, &game_map, &player, player.current_score);
+    struct GameContext game;
+    game_context_init(&game);
+    play_game(&game, manager, &game_map, &player, player.current_score);
+    input_end_game();
 }
 
 void continue_game(struct UserManager* manager) {
     if(!manager->current_user) {
         mvprintw(0,0,"Must be logged in to continue a saved game.");
-        getch();
+        input_getch();
         return;
     }
     // load a SavedGame
     struct SavedGame loaded;
-    if(load_saved_game(manager, &loaded)) {
+    struct GameContext game;
+    game_context_init(&game);
+    game.levels = level_store_create();
+    if(load_saved_game(manager, &loaded, game.levels)) {
         struct Map game_map = loaded.game_map;
         Player player = loaded.player;
-        // Continue exactly
-        play_game(manager, &game_map, &player, player.current_score);
+        // Continue exactly, on the saved level with the floors left behind
+        game.start_level = loaded.current_level;
+        play_game(&game, manager, &game_map, &player, player.current_score);
+    } else {
+        game_context_free(&game);
     }
 }
 
@@ -604,54 +669,29 @@ void print_user_profile(struct UserManager *manager) {
     struct tm *last_game_time = localtime(&manager->current_user->last_game_time);
     printw("Last Game Time: %s", asctime(last_game_time));
 
+    // Persistence counters: queued changes vs. records/files actually written
+    printw("\nUser data writes: %lu issued / %lu requested (%d pending)\n",
+           manager->writes_issued, manager->writes_requested, manager->dirty_count);
+
     printw("\nPress any key to return...");
     refresh();
-    getch(); // Wait for user to press any key
+    input_getch(); // Wait for user to press any key
 }
 
 void stop_music() {
-    if (Mix_PlayingMusic()) {
-        Mix_HaltMusic();
-    }
-    if (g_currentMusic) {
-        Mix_FreeMusic(g_currentMusic);
-        g_currentMusic = NULL;
-    }
+    audio_stop();   // Tracks stay cached for the next play_music
 }
 
 void play_music(struct User* user){
-    // 1) If user->music_on == false, stop any current music & return
+    // If user->music_on == false, stop any current music & return
     if (!user->music_on) {
         stop_music();
         return;
     }
 
-    // 2) Stop any currently playing music
-    stop_music(); // Halts & frees g_currentMusic
-
-    // 3) Decide which file to load
-    const char* path = "audio/default.mp3";
-    if (user->song == 1) {
-        path = "audio/Venom.mp3";
-    } else if (user->song == 2) {
-        path = "audio/Chandelier.mp3";
-    } else if (user->song == 3) {
-        path = "audio/Hello.mp3";
-    }
-    // if none match, path remains "audio/default.mp3", etc.
-
-    // 4) Load the new music
-    g_currentMusic = Mix_LoadMUS(path);
-    if (!g_currentMusic) {
-        // If loading fails, print error or fallback
-        printw("Failed to load music: %s\n", Mix_GetError());
-        refresh();
-        return;
-    }
-
-    // 5) Play with loop = -1 for infinite
-    if (Mix_PlayMusic(g_currentMusic, -1) == -1) {
-        printw("Mix_PlayMusic error: %s\n", Mix_GetError());
+    // Tracks come from the audio cache, so switching songs never hits the disk
+    if (!audio_play_song(user->song)) {
+        printw("Failed to play music: %s\n", audio_error());
         refresh();
     }
 }
@@ -659,36 +699,32 @@ void play_music(struct User* user){
 void initialize_guest(struct UserManager* manager){
     // Check if we already have a "Guest" in memory
     // or if we can add a new user to the manager
-    int guestIndex = -1;
-    for (int i = 0; i < manager->user_count; i++) {
-        if (strcmp(manager->users[i].username, "Guest") == 0) {
-            guestIndex = i;
-            break;
-        }
-    }
+    int guestIndex = find_user_index(manager, "Guest");
 
     if (guestIndex == -1) {
         // We haven't created a "Guest" yet, so do it now
-        if (manager->user_count >= MAX_USERS) {
-            printw("Cannot create Guest user - max users reached!\n");
-            getch();
+        struct User guestUser;
+        memset(&guestUser, 0, sizeof(guestUser));
+        strcpy(guestUser.username, "Guest");
+        strcpy(guestUser.password, "guest");  // or some dummy password
+        strcpy(guestUser.email,    "guest@na");  // dummy
+        guestUser.score          = 0;
+        guestUser.games_completed= 0;
+        guestUser.gold           = 0;
+        guestUser.difficulty     = 1;
+        strcpy(guestUser.character_color, "White");
+        guestUser.song           = 1;
+        guestUser.music_on       = true;
+        guestUser.first_game_time= time(NULL);
+        guestUser.last_game_time = time(NULL);
+        guestUser.days_since_first_game = 0;
+
+        if (add_user(manager, &guestUser) == NULL) {
+            printw("Cannot create Guest user - out of memory!\n");
+            input_getch();
             return;
         }
-        guestIndex = manager->user_count++;
-        struct User* guestUser = &manager->users[guestIndex];
-        strcpy(guestUser->username, "Guest");
-        strcpy(guestUser->password, "guest");  // or some dummy password
-        strcpy(guestUser->email,    "guest@na");  // dummy
-        guestUser->score          = 0;
-        guestUser->games_completed= 0;
-        guestUser->gold           = 0;
-        guestUser->difficulty     = 1;
-        strcpy(guestUser->character_color, "White");
-        guestUser->song           = 1;
-        guestUser->music_on       = true;
-        guestUser->first_game_time= time(NULL);
-        guestUser->last_game_time = time(NULL);
-        guestUser->days_since_first_game = 0;
+        guestIndex = manager->user_count - 1;
     }
 
     // Now set current_user to that guest
@@ -698,7 +734,7 @@ void initialize_guest(struct UserManager* manager){
     clear();
     mvprintw(0, 0, "Playing as Guest...");
     refresh();
-    getch();
+    input_getch();
 
     // Start a new game
     start_new_game(manager);
@@ -5,7 +5,6 @@
 #include <stdbool.h>
 #include "game.h"
 
-#define MAX_USERS 100
 #define MAX_STRING_LEN 100
 #define PASSWORD_LENGTH 12
 #define SPECIAL_CHARACTERS "!@#$%^&*()-_=+[]{}|;:,.<>?/"
@@ -19,6 +18,9 @@ struct UserSettings {
 
 void generate_password(char *password, int length);
 bool init_ncurses(void);
+void setup_screen(void);
+void draw_welcome_menu(void);
+bool welcome_menu_choice(struct UserManager* manager, int choice);
 void first_menu(struct UserManager* manager);
 void pre_game_menu(struct UserManager* manager);
 bool entering_menu(struct UserManager* manager, int selected_index);
@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "perf.h"
+
+uint64_t perf_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Values below PERF_SUB_BUCKETS get a bucket each; above that, bucket
+// (magnitude, top bits) where magnitude is the position of the highest set bit
+static int bucket_of(uint64_t value) {
+    if (value < PERF_SUB_BUCKETS) return (int)value;
+
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - PERF_SUB_BUCKET_BITS;
+    int sub = (int)((value >> shift) & (PERF_SUB_BUCKETS - 1));
+    return (shift + 1) * PERF_SUB_BUCKETS + sub;
+}
+
+// Largest value that falls in the bucket
+static uint64_t bucket_high(int bucket) {
+    if (bucket < PERF_SUB_BUCKETS) return (uint64_t)bucket;
+
+    int shift = bucket / PERF_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(bucket % PERF_SUB_BUCKETS);
+    return ((PERF_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void perf_record(struct PerfHistogram* histogram, uint64_t value) {
+    histogram->counts[bucket_of(value)]++;
+    histogram->total++;
+}
+
+// percentile in [0, 100]; 0 for an empty histogram
+uint64_t perf_percentile(const struct PerfHistogram* histogram, double percentile) {
+    if (histogram->total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > histogram->total) rank = histogram->total;
+
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < PERF_BUCKETS; bucket++) {
+        seen += histogram->counts[bucket];
+        if (seen >= rank) return bucket_high(bucket);
+    }
+    return bucket_high(PERF_BUCKETS - 1);
+}
+
+void perf_init(struct PerfStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->phase = -1;
+}
+
+// Ends the phase being timed, if any, and starts timing 'phase'
+void perf_phase(struct PerfStats* stats, PerfPhase phase) {
+    uint64_t now = perf_now_ns();
+    if (stats->phase >= 0) stats->turn_ns[stats->phase] += now - stats->mark_ns;
+    stats->phase = phase;
+    stats->mark_ns = now;
+}
+
+// Called just before waiting for input: records the turn and pauses timing
+void perf_end_turn(struct PerfStats* stats) {
+    uint64_t now = perf_now_ns();
+    if (stats->phase >= 0) stats->turn_ns[stats->phase] += now - stats->mark_ns;
+    stats->phase = -1;
+
+    uint64_t total = 0;
+    for (int phase = 0; phase < PERF_PHASES; phase++) {
+        perf_record(&stats->histograms[phase], stats->turn_ns[phase]);
+        stats->last_ns[phase] = stats->turn_ns[phase];
+        total += stats->turn_ns[phase];
+        stats->turn_ns[phase] = 0;
+    }
+    perf_record(&stats->histograms[PERF_TOTAL], total);
+    stats->last_ns[PERF_TOTAL] = total;
+
+    stats->last_entities_ticked = stats->entities_ticked;
+    stats->last_tiles_redrawn = stats->tiles_redrawn;
+    stats->entities_ticked = 0;
+    stats->tiles_redrawn = 0;
+}
+
+// Everything this thread has written so far, terminal output included, as
+// counted by the kernel; 0 where it does not say. curses writes straight to
+// its file descriptor, so counting has to happen below it.
+uint64_t perf_thread_bytes_written(void) {
+    int fd = open("/proc/thread-self/io", O_RDONLY);
+    if (fd < 0) return 0;
+
+    char text[512];
+    ssize_t length = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (length <= 0) return 0;
+    text[length] = '\0';
+
+    const char* wchar = strstr(text, "wchar:");
+    return wchar ? strtoull(wchar + 6, NULL, 10) : 0;
+}
+
+static uint64_t (*bytes_source)(void) = perf_thread_bytes_written;
+
+// Replaces where perf_bytes_written() reads from (NULL restores the
+// default). The server counts per session, since each of its threads takes
+// turns running many.
+void perf_set_bytes_source(uint64_t (*source)(void)) {
+    bytes_source = source ? source : perf_thread_bytes_written;
+}
+
+uint64_t perf_bytes_written(void) {
+    return bytes_source();
+}
+
+// Called at the start of each frame: charges what was written since the last
+// call to the frame before, including the refresh getch() does at the end
+void perf_count_frame_bytes(struct PerfStats* stats) {
+    uint64_t written = perf_bytes_written();
+    if (stats->bytes_mark && written >= stats->bytes_mark) {
+        stats->last_frame_bytes = written - stats->bytes_mark;
+        perf_record(&stats->frame_bytes, stats->last_frame_bytes);
+    }
+    stats->bytes_mark = written;
+}
@@ -0,0 +1,62 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per-turn timing for the in-game performance HUD ('p' in play_game).
+// A turn runs from the key press to the moment the game waits for the next
+// key, so time spent waiting for input is never counted. Each phase keeps an
+// HDR-style histogram: 16 linear sub-buckets per power of two of
+// nanoseconds, so any percentile is exact to within about 6% whatever the
+// range, in a fixed 8 KB per phase.
+//
+// The HUD also shows how many bytes each frame sent to the terminal. curses
+// keeps the last frame it sent and writes only changed cells, so this
+// is what a slow link (ssh, the server) actually pays per turn.
+
+#define PERF_SUB_BUCKET_BITS 4
+#define PERF_SUB_BUCKETS     (1 << PERF_SUB_BUCKET_BITS)
+#define PERF_BUCKETS         ((64 - PERF_SUB_BUCKET_BITS + 1) * PERF_SUB_BUCKETS)
+
+typedef enum {
+    PERF_LOGIC,     // Simulation: input handling, enemies, timers
+    PERF_RENDER,    // Drawing into curses' buffer
+    PERF_FLUSH,     // refresh(): sending the changes to the terminal
+    PERF_PHASES,
+    PERF_TOTAL = PERF_PHASES
+} PerfPhase;
+
+struct PerfHistogram {
+    uint64_t counts[PERF_BUCKETS];
+    uint64_t total;
+};
+
+struct PerfStats {
+    struct PerfHistogram histograms[PERF_PHASES + 1];   // Phases, then whole turns
+    uint64_t turn_ns[PERF_PHASES];   // Turn in progress
+    uint64_t last_ns[PERF_PHASES + 1];
+    int phase;                       // Phase being timed, -1 if paused
+    uint64_t mark_ns;                // When it started
+    int entities_ticked;             // Counted by the game during the turn
+    int tiles_redrawn;
+    int last_entities_ticked;
+    int last_tiles_redrawn;
+    struct PerfHistogram frame_bytes;   // Bytes written per frame
+    uint64_t last_frame_bytes;
+    uint64_t bytes_mark;             // perf_bytes_written() at the last frame, 0 to restart
+};
+
+// Function declarations
+uint64_t perf_now_ns(void);
+void perf_record(struct PerfHistogram* histogram, uint64_t value);
+uint64_t perf_percentile(const struct PerfHistogram* histogram, double percentile);
+void perf_init(struct PerfStats* stats);
+void perf_phase(struct PerfStats* stats, PerfPhase phase);
+void perf_end_turn(struct PerfStats* stats);
+uint64_t perf_thread_bytes_written(void);
+void perf_set_bytes_source(uint64_t (*source)(void));
+uint64_t perf_bytes_written(void);
+void perf_count_frame_bytes(struct PerfStats* stats);
+
+#endif
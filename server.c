@@ -0,0 +1,809 @@
+#define _GNU_SOURCE   // memfd_create
+#include <ncurses.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "game.h"
+#include "menu.h"
+#include "users.h"
+#include "input.h"
+#include "audio.h"
+#include "perf.h"
+#include "spectate.h"
+#include "cast.h"
+#include "trace.h"
+
+#define SESSION_STACK (1024 * 1024)   // Reserved per session; only pages in use are resident
+#define SESSION_INPUT 256             // Bytes typed ahead of the game
+#define SESSION_LINES (MAP_HEIGHT + 10)
+#define SESSION_COLUMNS (MAP_WIDTH + 60)
+#define SESSION_OUTPUT_LIMIT (256 * 1024)   // Unsent bytes past which a player counts as gone
+#define SERVER_MAX_WORKERS 64
+#define SERVER_EVENTS 64
+
+// Telnet protocol bytes (RFC 854, 857, 858, 1073)
+#define TELNET_SE   240
+#define TELNET_SB   250
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_DO   253
+#define TELNET_DONT 254
+#define TELNET_IAC  255
+#define TELNET_ECHO 1
+#define TELNET_SGA  3
+#define TELNET_NAWS 31
+
+typedef enum {
+    TELNET_DATA,
+    TELNET_COMMAND,     // After IAC
+    TELNET_OPTION,      // After IAC WILL/WONT/DO/DONT
+    TELNET_SUB,         // Inside IAC SB ... IAC SE
+    TELNET_SUB_IAC
+} TelnetState;
+
+struct Worker;
+
+struct Session {
+    int fd;
+    struct Worker* worker;
+    struct Session* next;         // In the worker's list
+
+    // Input, after telnet commands are stripped and CR LF is folded to '\n'
+    unsigned char pending[SESSION_INPUT];
+    int pending_len;
+    bool last_cr;
+    bool telnet;
+    TelnetState telnet_state;
+    unsigned char sub[8];         // Subnegotiation being read
+    int sub_len;
+
+    // Output: curses writes to a memfd, which never blocks; once the session
+    // yields, what it wrote is queued and sent as fast as the player reads
+    SCREEN* screen;
+    FILE* out;
+    unsigned char* queued;
+    size_t queued_len, queued_sent, queued_cap;
+    bool watching_output;         // EPOLLOUT registered: the socket was full
+    int lines, columns;
+    bool resized;                 // Apply lines x columns on the next resume
+
+    // The coroutine running the menus and game
+    ucontext_t context;
+    char* stack;
+    char* stack_mark;             // Deepest stack address in use while suspended
+    jmp_buf hangup;               // Unwinds the session once its player is gone
+    struct InputBot input;
+    struct SpectateChannel* channel;   // For spectators, NULL without --spectate
+    struct Cast* cast;            // Recording, NULL without --cast
+    struct GameContext* game;     // Game in progress on the session's stack, NULL in the menus
+    struct TraceStack trace;      // Open trace scopes and the session's track (trace.h)
+    uint64_t bytes_written;       // Sent to the player, for the performance HUD
+    uint64_t resume_bytes;        // The thread's total when the session was resumed
+    int user_index;               // Logged-in user, -1 for none
+    bool waiting;                 // Suspended for input
+    bool closed;                  // The player hung up
+    bool finished;                // The coroutine returned
+};
+
+struct Worker {
+    pthread_t thread;
+    int epoll_fd;
+    int wake_fd;                  // eventfd: new sessions or shutdown
+    pthread_mutex_t lock;         // Guards incoming
+    struct Session* incoming;     // Accepted, not started yet
+    struct Session* sessions;     // Running
+    ucontext_t context;           // Where a suspended session returns to
+};
+
+// The game reaches its session through process-wide state: curses' current
+// screen (set_term), the bot in input.c, the channel in spectate.c, the
+// recording in cast.c and the GameContext in game.c (current_game), which
+// enter_session points at the session. It also shares the UserManager. So a
+// session holds this for as long as it runs, and perf.c's per-thread byte
+// count is split per session around it. Nothing done under it waits on a
+// player, since curses only ever writes to the session's memfd, nor on
+// another process: saves are written inline (game_set_snapshot_saves) and
+// waits for the user store's file locks let go of it (store_wait_begin).
+static pthread_mutex_t game_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct UserManager* manager;
+static FILE* null_input;          // Curses never reads: input comes through input_set_bot
+static const char* terminal_type;
+static const char* cast_dir;      // Guarded by game_lock, like the counter
+static long casts_started = 0;
+static long page_size;
+static volatile sig_atomic_t stopping = 0;
+static __thread struct Session* running_session;
+
+static void on_stop_signal(int signal_number) {
+    (void)signal_number;
+    stopping = 1;
+}
+
+// Stores one byte of player input, folding CR, CR LF and CR NUL to '\n'
+static void push_input(struct Session* session, unsigned char byte) {
+    if (session->last_cr && (byte == '\n' || byte == '\0')) {
+        session->last_cr = false;
+        return;
+    }
+    session->last_cr = byte == '\r';
+    if (session->pending_len < SESSION_INPUT) {
+        session->pending[session->pending_len++] = byte == '\r' ? '\n' : byte;
+    }
+}
+
+static void telnet_subnegotiation(struct Session* session) {
+    if (session->sub_len >= 5 && session->sub[0] == TELNET_NAWS) {
+        int columns = session->sub[1] << 8 | session->sub[2];
+        int lines = session->sub[3] << 8 | session->sub[4];
+        if (columns > 0 && lines > 0) {
+            session->columns = columns;
+            session->lines = lines;
+            session->resized = true;
+        }
+    }
+}
+
+static void feed_input(struct Session* session, const unsigned char* bytes, int length) {
+    for (int i = 0; i < length; i++) {
+        unsigned char byte = bytes[i];
+        if (!session->telnet) {
+            push_input(session, byte);
+            continue;
+        }
+
+        switch (session->telnet_state) {
+            case TELNET_DATA:
+                if (byte == TELNET_IAC) session->telnet_state = TELNET_COMMAND;
+                else push_input(session, byte);
+                break;
+            case TELNET_COMMAND:
+                if (byte == TELNET_IAC) {
+                    push_input(session, byte);
+                    session->telnet_state = TELNET_DATA;
+                } else if (byte == TELNET_SB) {
+                    session->sub_len = 0;
+                    session->telnet_state = TELNET_SUB;
+                } else if (byte >= TELNET_WILL && byte <= TELNET_DONT) {
+                    session->telnet_state = TELNET_OPTION;
+                } else {
+                    session->telnet_state = TELNET_DATA;
+                }
+                break;
+            case TELNET_OPTION:
+                // Whatever the client agrees to, we behave the same
+                session->telnet_state = TELNET_DATA;
+                break;
+            case TELNET_SUB:
+                if (byte == TELNET_IAC) session->telnet_state = TELNET_SUB_IAC;
+                else if (session->sub_len < (int)sizeof(session->sub)) session->sub[session->sub_len++] = byte;
+                break;
+            case TELNET_SUB_IAC:
+                if (byte == TELNET_SE) {
+                    telnet_subnegotiation(session);
+                    session->telnet_state = TELNET_DATA;
+                } else {
+                    if (byte == TELNET_IAC && session->sub_len < (int)sizeof(session->sub)) {
+                        session->sub[session->sub_len++] = byte;
+                    }
+                    session->telnet_state = TELNET_SUB;
+                }
+                break;
+        }
+    }
+}
+
+// Takes the next key typed, decoding arrow keys; -1 if there is none yet
+static int take_key(struct Session* session) {
+    unsigned char* bytes = session->pending;
+    int length = session->pending_len;
+    if (length == 0) return -1;
+
+    int key = bytes[0], used = 1;
+    if (bytes[0] == 27 && length < 3 && length < SESSION_INPUT) {
+        if (length == 1 || bytes[1] == '[' || bytes[1] == 'O') return -1;   // Rest still on its way
+    } else if (bytes[0] == 27 && (bytes[1] == '[' || bytes[1] == 'O')) {
+        switch (bytes[2]) {
+            case 'A': key = KEY_UP; break;
+            case 'B': key = KEY_DOWN; break;
+            case 'C': key = KEY_RIGHT; break;
+            case 'D': key = KEY_LEFT; break;
+            case 'H': key = KEY_HOME; break;
+            case 'F': key = KEY_END; break;
+        }
+        if (key != 27) used = 3;
+    } else if (bytes[0] == 127 || bytes[0] == 8) {
+        key = KEY_BACKSPACE;
+    }
+
+    session->pending_len -= used;
+    memmove(bytes, bytes + used, session->pending_len);
+    return key;
+}
+
+// Suspends the running session until its player types something
+static void session_wait(struct Session* session) {
+    char mark;
+    session->stack_mark = &mark;
+    session->waiting = true;
+    swapcontext(&session->context, &session->worker->context);
+    session->waiting = false;
+}
+
+static int session_key(void* context, bool new_turn) {
+    struct Session* session = context;
+    (void)new_turn;
+
+    refresh();   // As getch() would: screens rely on it to show their last lines
+    for (;;) {
+        int key = take_key(session);
+        if (key >= 0) return key;
+        if (session->closed) {
+            // The jump skips play_game's own cleanup
+            struct GameContext* game = game_context_current();
+            if (game) game_context_free(game);
+            longjmp(session->hangup, 1);
+        }
+        session_wait(session);
+    }
+}
+
+// getnstr for a remote player: the line is echoed as it is typed
+static void session_line(void* context, char* buffer, int max_len) {
+    struct Session* session = context;
+    int length = 0;
+
+    for (;;) {
+        int key = session_key(session, false);
+        if (key == '\n') break;
+
+        if (key == KEY_BACKSPACE) {
+            if (length > 0) {
+                length--;
+                int y, x;
+                getyx(stdscr, y, x);
+                mvaddch(y, x - 1, ' ');
+                move(y, x - 1);
+                refresh();
+            }
+        } else if (key >= ' ' && key < 127 && length < max_len) {
+            buffer[length++] = (char)key;
+            addch(key);
+            refresh();
+        }
+    }
+    buffer[length] = '\0';
+}
+
+static void session_main(void) {
+    struct Session* session = running_session;
+
+    if (setjmp(session->hangup) == 0) {
+        do {
+            draw_welcome_menu();
+        } while (welcome_menu_choice(manager, input_getch()));
+    }
+    // A game left by hanging up continues from its last save
+    session->finished = true;
+}
+
+// Bytes the running session has written: a worker's own count also
+// includes every other session it has run
+static uint64_t session_bytes_written(void) {
+    struct Session* session = running_session;
+    if (session == NULL) return perf_thread_bytes_written();
+    return session->bytes_written + perf_thread_bytes_written() - session->resume_bytes;
+}
+
+// Takes game_lock and points curses and the game's globals at 'session'
+static void enter_session(struct Session* session) {
+    pthread_mutex_lock(&game_lock);
+    set_term(session->screen);
+    if (session->resized) {
+        resize_term(session->lines, session->columns);
+        clearok(curscr, TRUE);
+        session->resized = false;
+    }
+    input_set_bot(&session->input);
+    spectate_set_channel(session->channel);
+    cast_set_current(session->cast);
+    game_context_set_current(session->game);
+    manager->current_user = session->user_index >= 0 ? &manager->users[session->user_index] : NULL;
+    running_session = session;
+    session->resume_bytes = perf_thread_bytes_written();
+}
+
+// Keeps what the session changed of the globals, clears them and drops game_lock
+static void leave_session(struct Session* session) {
+    session->bytes_written += perf_thread_bytes_written() - session->resume_bytes;
+    running_session = NULL;
+    // An index, since adding users moves the array
+    session->user_index = manager->current_user ? (int)(manager->current_user - manager->users) : -1;
+    manager->current_user = NULL;
+    input_set_bot(NULL);
+    spectate_set_channel(NULL);
+    cast_set_current(NULL);
+    session->game = game_context_current();
+    game_context_set_current(NULL);
+    pthread_mutex_unlock(&game_lock);
+}
+
+// Runs a session until it waits for input again or finishes
+static void resume_session(struct Worker* worker, struct Session* session) {
+    enter_session(session);
+    TRACE_USE_STACK(&session->trace);
+    swapcontext(&worker->context, &session->context);
+    TRACE_USE_STACK(NULL);
+    leave_session(session);
+}
+
+// Around a wait on another process's lock on the user store (users.h):
+// other sessions play on meanwhile, as they do while this one waits for a
+// key. Outside a session (startup) nothing is held, so there is nothing to
+// give back.
+static __thread struct Session* waiting_session;
+
+static void store_wait_begin(void) {
+    waiting_session = running_session;
+    if (waiting_session) leave_session(waiting_session);
+}
+
+static void store_wait_end(void) {
+    if (waiting_session) enter_session(waiting_session);
+    waiting_session = NULL;
+}
+
+// Gives back the stack pages below the suspended frame, so a deep call
+// (level generation, saving) does not stay resident while the player thinks
+static void trim_stack(struct Session* session) {
+    char* low = session->stack + page_size;
+    char* high = (char*)(((uintptr_t)session->stack_mark - page_size) & ~(uintptr_t)(page_size - 1));
+    if (high > low) madvise(low, (size_t)(high - low), MADV_DONTNEED);
+}
+
+// Ends the session the next time it runs, dropping whatever was typed ahead
+static void hang_up(struct Session* session) {
+    session->closed = true;
+    session->pending_len = 0;
+}
+
+// Moves what curses wrote since the last call from the memfd to the send
+// queue. False if the player is so far behind that they count as gone.
+static bool collect_output(struct Session* session) {
+    int fd = fileno(session->out);
+    struct stat status;
+    if (fflush(session->out) != 0 || fstat(fd, &status) != 0) return false;
+    size_t size = (size_t)status.st_size;
+    if (size == 0) return true;
+
+    if (session->queued_sent > 0) {
+        session->queued_len -= session->queued_sent;
+        memmove(session->queued, session->queued + session->queued_sent, session->queued_len);
+        session->queued_sent = 0;
+    }
+    bool ok = session->queued_len + size <= SESSION_OUTPUT_LIMIT;
+    if (ok && session->queued_len + size > session->queued_cap) {
+        size_t capacity = session->queued_cap ? session->queued_cap : 16 * 1024;
+        while (capacity < session->queued_len + size) capacity *= 2;
+        unsigned char* grown = realloc(session->queued, capacity);
+        ok = grown != NULL;
+        if (ok) {
+            session->queued = grown;
+            session->queued_cap = capacity;
+        }
+    }
+    ok = ok && pread(fd, session->queued + session->queued_len, size, 0) == (ssize_t)size;
+    if (ok) session->queued_len += size;
+    // Opened for appending, so curses carries on from the start
+    return ftruncate(fd, 0) == 0 && ok;
+}
+
+// Sends as much of the queue as the socket takes without blocking. False
+// if the player has gone.
+static bool send_output(struct Session* session) {
+    while (session->queued_sent < session->queued_len) {
+        ssize_t sent = send(session->fd, session->queued + session->queued_sent,
+                            session->queued_len - session->queued_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent > 0) {
+            session->queued_sent += (size_t)sent;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;   // The rest goes when the socket has room (EPOLLOUT)
+        } else if (sent < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+    session->queued_len = session->queued_sent = 0;
+    return true;
+}
+
+// Asks for EPOLLOUT only while output is waiting for room in the socket
+static bool watch_output(struct Worker* worker, struct Session* session) {
+    bool waiting = session->queued_len > 0;
+    if (waiting == session->watching_output) return true;
+
+    struct epoll_event event = { .events = EPOLLIN | (waiting ? EPOLLOUT : 0), .data.ptr = session };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, session->fd, &event) != 0) return false;
+    session->watching_output = waiting;
+    return true;
+}
+
+static bool deliver_output(struct Worker* worker, struct Session* session) {
+    return collect_output(session) && send_output(session) && watch_output(worker, session);
+}
+
+static void free_session(struct Session* session) {
+    pthread_mutex_lock(&game_lock);
+    if (session->screen) {
+        set_term(session->screen);
+        endwin();
+        delscreen(session->screen);
+    }
+    // Under the lock: it forgets the channel if it was the last one to run
+    spectate_channel_destroy(session->channel);
+    pthread_mutex_unlock(&game_lock);
+    // Not under it: this waits for the writer thread and writes what is left
+    cast_close(session->cast);
+    if (session->out) {
+        // The goodbye and terminal reset, if the player still reads
+        if (collect_output(session)) send_output(session);
+        fclose(session->out);
+    }
+    free(session->queued);
+    if (session->stack) munmap(session->stack, SESSION_STACK);
+    close(session->fd);
+    free(session);
+}
+
+static void end_session(struct Worker* worker, struct Session* session) {
+    for (struct Session** link = &worker->sessions; *link; link = &(*link)->next) {
+        if (*link == session) {
+            *link = session->next;
+            break;
+        }
+    }
+    free_session(session);
+}
+
+static void run_session(struct Worker* worker, struct Session* session) {
+    resume_session(worker, session);
+    if (!session->finished && !deliver_output(worker, session)) {
+        // Stopped reading, or gone: unwind it now rather than queue more
+        hang_up(session);
+        resume_session(worker, session);
+    }
+    if (session->finished) {
+        end_session(worker, session);
+    } else {
+        trim_stack(session);
+    }
+}
+
+static bool start_session(struct Worker* worker, struct Session* session) {
+    session->worker = worker;
+    TRACE_STACK_INIT(&session->trace);
+    session->channel = spectate_channel_create();
+    session->stack = mmap(NULL, SESSION_STACK, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (session->stack == MAP_FAILED) {
+        session->stack = NULL;
+        return false;
+    }
+    mprotect(session->stack, page_size, PROT_NONE);   // Overflowing faults instead of corrupting
+
+    getcontext(&session->context);
+    session->context.uc_stack.ss_sp = session->stack;
+    session->context.uc_stack.ss_size = SESSION_STACK;
+    session->context.uc_link = &worker->context;
+    makecontext(&session->context, session_main, 0);
+
+    // Appending, so collect_output can empty it under curses
+    int out_fd = memfd_create("session-output", MFD_CLOEXEC);
+    session->out = out_fd >= 0 ? fdopen(out_fd, "a") : NULL;
+    if (session->out == NULL) {
+        if (out_fd >= 0) close(out_fd);
+        return false;
+    }
+
+    pthread_mutex_lock(&game_lock);
+    session->screen = newterm(terminal_type, session->out, null_input);
+    if (session->screen) {
+        resize_term(session->lines, session->columns);
+        setup_screen();
+        if (cast_dir) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/session-%ld-%ld.cast", cast_dir, (long)time(NULL), ++casts_started);
+            session->cast = cast_open(path);
+        }
+    }
+    pthread_mutex_unlock(&game_lock);
+    if (session->screen == NULL) return false;
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = session };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, session->fd, &event) != 0) return false;
+
+    session->next = worker->sessions;
+    worker->sessions = session;
+    run_session(worker, session);
+    return true;
+}
+
+static void read_input(struct Session* session) {
+    unsigned char buffer[SESSION_INPUT];
+    int room = SESSION_INPUT - session->pending_len;
+    if (room <= 0) return;
+
+    ssize_t count = recv(session->fd, buffer, (size_t)room, MSG_DONTWAIT);
+    if (count > 0) {
+        feed_input(session, buffer, (int)count);
+    } else if (count == 0 || (errno != EAGAIN && errno != EINTR)) {
+        session->closed = true;
+    }
+}
+
+// Hangs up every session: each unwinds and is freed
+static void close_sessions(struct Worker* worker) {
+    while (worker->sessions) {
+        struct Session* session = worker->sessions;
+        hang_up(session);
+        run_session(worker, session);
+        if (worker->sessions == session) end_session(worker, session);   // Did not unwind
+    }
+}
+
+static void start_incoming(struct Worker* worker) {
+    pthread_mutex_lock(&worker->lock);
+    struct Session* incoming = worker->incoming;
+    worker->incoming = NULL;
+    pthread_mutex_unlock(&worker->lock);
+
+    while (incoming) {
+        struct Session* session = incoming;
+        incoming = session->next;
+        session->next = NULL;
+        if (!start_session(worker, session)) {
+            if (worker->sessions == session) end_session(worker, session);
+            else free_session(session);
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    struct Worker* worker = arg;
+    struct epoll_event events[SERVER_EVENTS];
+
+    while (!stopping) {
+        int count = epoll_wait(worker->epoll_fd, events, SERVER_EVENTS, -1);
+        for (int i = 0; i < count; i++) {
+            struct Session* session = events[i].data.ptr;
+            if (session == NULL) {
+                uint64_t wakeups;
+                if (read(worker->wake_fd, &wakeups, sizeof(wakeups)) < 0) continue;
+                start_incoming(worker);
+                continue;
+            }
+
+            read_input(session);
+            if ((events[i].events & EPOLLOUT) && !deliver_output(worker, session)) hang_up(session);
+            if (session->waiting && (session->pending_len > 0 || session->closed)) {
+                run_session(worker, session);
+            }
+        }
+    }
+
+    start_incoming(worker);   // Accepted just before the stop: still need freeing
+    close_sessions(worker);
+    return NULL;
+}
+
+static void wake_worker(struct Worker* worker) {
+    uint64_t one = 1;
+    if (write(worker->wake_fd, &one, sizeof(one)) < 0) {
+        // The counter is only full if the worker has many wakeups pending already
+    }
+}
+
+static void hand_over(struct Worker* worker, struct Session* session) {
+    pthread_mutex_lock(&worker->lock);
+    session->next = worker->incoming;
+    worker->incoming = session;
+    pthread_mutex_unlock(&worker->lock);
+    wake_worker(worker);
+}
+
+static struct Session* accept_session(int listener, bool telnet) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) return NULL;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct Session* session = calloc(1, sizeof(struct Session));
+    if (session == NULL) {
+        close(fd);
+        return NULL;
+    }
+    session->fd = fd;
+    session->telnet = telnet;
+    session->lines = SESSION_LINES;
+    session->columns = SESSION_COLUMNS;
+    session->user_index = -1;
+    session->input = (struct InputBot){
+        .next_key = session_key,
+        .next_line = session_line,
+        .context = session,
+        .real_time = true,
+    };
+
+    if (telnet) {
+        // We echo, we send characters as they come, and we want the window size
+        static const unsigned char hello[] = {
+            TELNET_IAC, TELNET_WILL, TELNET_ECHO,
+            TELNET_IAC, TELNET_WILL, TELNET_SGA,
+            TELNET_IAC, TELNET_DO, TELNET_NAWS,
+        };
+        if (send(fd, hello, sizeof(hello), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            free(session);
+            close(fd);
+            return NULL;
+        }
+    }
+    return session;
+}
+
+static int listen_unix(const char* path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path);   // Left behind by a server that did not shut down
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 128) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_tcp(int port) {
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),   // Local players only
+    };
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 128) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool start_worker(struct Worker* worker) {
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pthread_mutex_init(&worker->lock, NULL);
+    if (worker->epoll_fd < 0 || worker->wake_fd < 0) return false;
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event) != 0) return false;
+    return pthread_create(&worker->thread, NULL, worker_main, worker) == 0;
+}
+
+int run_server(const struct ServerOptions* options) {
+    page_size = sysconf(_SC_PAGESIZE);
+    const char* term = getenv("TERM");
+    terminal_type = term && *term ? term : "xterm";
+    cast_dir = options->cast_dir;
+
+    signal(SIGPIPE, SIG_IGN);   // Writes to a player who hung up just fail
+    struct sigaction stop = { .sa_handler = on_stop_signal };   // No SA_RESTART: wakes epoll_wait
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    int listeners[2] = { -1, -1 };   // Unix, TCP
+    if (options->socket_path && (listeners[0] = listen_unix(options->socket_path)) < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", options->socket_path, strerror(errno));
+        return 1;
+    }
+    if (options->port && (listeners[1] = listen_tcp(options->port)) < 0) {
+        fprintf(stderr, "Cannot listen on port %d: %s\n", options->port, strerror(errno));
+        return 1;
+    }
+
+    if (options->spectate_path && !spectate_start(options->spectate_path)) {
+        fprintf(stderr, "Cannot listen for spectators on %s: %s\n", options->spectate_path, strerror(errno));
+        return 1;
+    }
+
+    audio_disable();
+    game_set_snapshot_saves(false);
+    users_set_wait_hooks(store_wait_begin, store_wait_end);
+    perf_set_bytes_source(session_bytes_written);
+    srand(time(NULL));
+    null_input = fopen("/dev/null", "r");
+    manager = create_user_manager(options->db_path);
+    if (manager == NULL) {
+        fprintf(stderr, "Cannot load users: %s\n", users_load_error());
+        return 1;
+    }
+    if (null_input == NULL) {
+        fprintf(stderr, "Cannot open /dev/null\n");
+        return 1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int worker_count = options->workers > 0 ? options->workers : (cores > 0 ? (int)cores : 1);
+    if (worker_count > SERVER_MAX_WORKERS) worker_count = SERVER_MAX_WORKERS;
+    struct Worker* workers = calloc((size_t)worker_count, sizeof(struct Worker));
+    int started = 0;
+    while (workers && started < worker_count && start_worker(&workers[started])) started++;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (int i = 0; i < 2; i++) {
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = (uint32_t)i };
+        if (listeners[i] >= 0 && epoll_fd >= 0) epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listeners[i], &event);
+    }
+    if (started == 0 || epoll_fd < 0) {
+        fprintf(stderr, "Cannot start the server\n");
+        stopping = 1;
+    } else {
+        if (options->socket_path) fprintf(stderr, "Serving on %s\n", options->socket_path);
+        if (options->port) fprintf(stderr, "Serving telnet on 127.0.0.1:%d\n", options->port);
+        fprintf(stderr, "%d workers; Ctrl-C stops\n", started);
+    }
+
+    long served = 0;
+    int next_worker = 0;
+    while (!stopping) {
+        struct epoll_event events[2];
+        int count = epoll_wait(epoll_fd, events, 2, -1);
+        for (int i = 0; i < count; i++) {
+            int which = (int)events[i].data.u32;
+            struct Session* session = accept_session(listeners[which], which == 1);
+            if (session == NULL) continue;
+
+            hand_over(&workers[next_worker], session);
+            next_worker = (next_worker + 1) % started;
+            served++;
+        }
+    }
+
+    // Hang everyone up, then save what the sessions left queued
+    for (int i = 0; i < started; i++) {
+        wake_worker(&workers[i]);
+        pthread_join(workers[i].thread, NULL);
+    }
+    spectate_shutdown();
+    flush_users(manager);
+    free_user_manager(manager);
+    fclose(null_input);
+    free(workers);
+    for (int i = 0; i < 2; i++) {
+        if (listeners[i] >= 0) close(listeners[i]);
+    }
+    if (epoll_fd >= 0) close(epoll_fd);
+    if (options->socket_path) unlink(options->socket_path);
+
+    fprintf(stderr, "Server stopped after %ld sessions\n", served);
+    return started > 0 ? 0 : 1;
+}
@@ -0,0 +1,33 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Server mode: one process hosts every connected player. Sessions share the
+// user store and scoreboard. Each runs the normal menus and game on its own
+// curses screen, written straight to its socket.
+//
+// Connect with a raw terminal:
+//   socat -,raw,echo=0 UNIX-CONNECT:game.sock   (--server game.sock)
+//   telnet localhost 4000                       (--port 4000)
+//
+// Each session runs as a coroutine on one of a pool of worker threads. A
+// worker sleeps in epoll until one of its players types something, then
+// runs that session's menu or game until it waits for the next key. So an
+// idle player costs no CPU, only its screen, its game state and the stack
+// pages in use. The game finds its screen, input, recording and game in
+// progress through globals, so only one session runs game code at a time;
+// one waiting on another process's lock on the user store lets the others
+// run. The workers overlap reading, writing and waking up around that.
+
+struct ServerOptions {
+    const char* socket_path;   // Unix socket to listen on, NULL for none
+    int port;                  // TCP port on 127.0.0.1 (telnet), 0 for none
+    int workers;               // Worker threads, 0 for one per core
+    const char* db_path;       // Binary user database, NULL to use users.json
+    const char* spectate_path; // Unix socket for spectators, NULL for none
+    const char* cast_dir;      // Directory for one asciicast per session, NULL for none
+};
+
+// Runs until SIGINT or SIGTERM; returns the exit status
+int run_server(const struct ServerOptions* options);
+
+#endif
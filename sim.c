@@ -0,0 +1,475 @@
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "game.h"
+#include "users.h"
+#include "audio.h"
+#include "input.h"
+#include "perf.h"
+
+// Headless balance and soak testing. Scripted bots play complete games
+// through play_game: they fight whatever is next to them, eat when hungry,
+// pick up nearby gold and food and otherwise head for the stairs. Games are
+// spread over worker processes, one per core by default, each with its own
+// copy of the game state, its own /dev/null screen and its own scratch
+// directory. Built and run with `make sim`; ./simulator -h lists the options.
+
+#define SIM_DEFAULT_GAMES 1000
+#define SIM_DEFAULT_MAX_TURNS 3000
+#define SIM_LEVELS 5
+#define SIM_EAT 10             // Eat from this hunger rate up; held food rots in a minute
+#define SIM_HUNGRY 60          // Go looking for food from this hunger rate up
+#define SIM_ITEM_RANGE 12      // Detour at most this many steps for gold or food
+
+typedef enum {
+    SIM_VICTORY,
+    SIM_KILLED_BY_ENEMY,
+    SIM_KILLED_BY_TRAP,
+    SIM_KILLED_OTHER,          // Enchanted rooms, rotten food, ...
+    SIM_STARVED,
+    SIM_TURN_LIMIT,
+    SIM_OUTCOMES
+} SimOutcome;
+
+static const char* outcome_names[SIM_OUTCOMES] = {
+    "victory", "killed by enemy", "killed by trap", "killed (other)", "starved", "turn limit"
+};
+
+struct SimOptions {
+    int games;
+    int workers;
+    int max_turns;
+    int difficulty;
+    unsigned seed;
+};
+
+struct SimResult {
+    int outcome;
+    int level;                          // Deepest level reached
+    int turns;
+    int gold;
+    int score;
+    int level_turns[SIM_LEVELS + 1];    // Turns spent on each level
+    bool done;
+};
+
+struct Bot {
+    struct Map* map;
+    Player* player;
+    int max_turns;
+    int turn;
+    int level;
+    int level_start;
+    int level_turns[SIM_LEVELS + 1];
+    char lines[2][32];                  // Inventory commands still to type
+    int line_count;
+    int next_line;
+    int last_hp;
+    struct Point last_position;
+    SimOutcome last_damage;             // What caused the latest HP loss
+    struct Point door;                  // Password door being walked into
+    bool quitting;
+    int quit_keys;
+    uint64_t turn_start_ns;
+    struct PerfHistogram* turn_times;
+};
+
+static const int step_dx[8] = { 0, 0, -1, 1, -1, 1, -1, 1 };
+static const int step_dy[8] = { -1, 1, 0, 0, -1, -1, 1, 1 };
+static const int step_keys[8] = { KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, '7', '9', '1', '3' };
+
+static bool enemy_at(const struct Map* map, int x, int y) {
+    for (int i = 0; i < map->enemy_count; i++) {
+        if (map->enemies[i].position.x == x && map->enemies[i].position.y == y) return true;
+    }
+    return false;
+}
+
+static bool enemy_adjacent(const struct Map* map, struct Point at) {
+    for (int d = 0; d < 8; d++) {
+        if (enemy_at(map, at.x + step_dx[d], at.y + step_dy[d])) return true;
+    }
+    return false;
+}
+
+static bool passable(struct Bot* bot, int x, int y) {
+    if (x < 0 || x >= MAP_WIDTH || y < 0 || y >= MAP_HEIGHT) return false;
+
+    char tile = bot->map->grid[y][x];
+    switch (tile) {
+        case WALL_HORIZONTAL:
+        case WALL_VERTICAL:
+        case WINDOW:
+        case PILLAR:
+        case FOG:
+        case PASSWORD_GEN:      // Shows the code but cannot be stood on
+        case TRAP_SYMBOL:
+            return false;
+        case DOOR_PASSWORD: {
+            Room* room = find_room_by_position(bot->map, x, y);
+            return room && (room->password_unlocked || room->door_code[0] != '\0');
+        }
+        default:
+            return !enemy_at(bot->map, x, y);
+    }
+}
+
+typedef bool (*TileWanted)(char tile);
+
+static bool is_item(char tile) {
+    return tile == GOLD_NORMAL_SYM || tile == GOLD_BLACK_SYM || tile == FOOD_NORMAL_SYM ||
+           tile == FOOD_GREAT_SYM || tile == FOOD_MAGICAL_SYM;
+}
+
+static bool is_exit(char tile) {
+    return tile == STAIRS || tile == TREASURE_CHEST_SYM;
+}
+
+static bool is_code_tile(char tile) {
+    return tile == PASSWORD_GEN;
+}
+
+// Breadth-first search from the player. Returns the direction of the first
+// step towards the nearest wanted tile within max_distance, or -1.
+static int step_towards(struct Bot* bot, TileWanted wanted, int max_distance) {
+    static short distance[MAP_HEIGHT][MAP_WIDTH];
+    static signed char first_step[MAP_HEIGHT][MAP_WIDTH];
+    static struct Point queue[MAP_HEIGHT * MAP_WIDTH];
+    memset(distance, -1, sizeof(distance));
+
+    struct Point start = bot->player->location;
+    int head = 0, tail = 0;
+    distance[start.y][start.x] = 0;
+    first_step[start.y][start.x] = -1;
+    queue[tail++] = start;
+
+    while (head < tail) {
+        struct Point at = queue[head++];
+        if (distance[at.y][at.x] >= max_distance) continue;
+
+        for (int d = 0; d < 8; d++) {
+            int x = at.x + step_dx[d], y = at.y + step_dy[d];
+            if (x < 0 || x >= MAP_WIDTH || y < 0 || y >= MAP_HEIGHT || distance[y][x] >= 0) continue;
+
+            int step = first_step[at.y][at.x] < 0 ? d : first_step[at.y][at.x];
+            // Wanted tiles are walked into even when they cannot be stood on
+            if (wanted(bot->map->grid[y][x])) return step;
+            if (!passable(bot, x, y)) continue;
+
+            distance[y][x] = distance[at.y][at.x] + 1;
+            first_step[y][x] = (signed char)step;
+            queue[tail++] = (struct Point){ x, y };
+        }
+    }
+    return -1;
+}
+
+static bool is_food(char tile) {
+    return tile == FOOD_NORMAL_SYM;
+}
+
+// Only normal food brings hunger down
+static bool has_food(const Player* player) {
+    for (int i = 0; i < player->food_count; i++) {
+        if (!player->foods[i].consumed && player->foods[i].type == FOOD_NORMAL) return true;
+    }
+    return false;
+}
+
+static SimOutcome damage_cause(const struct Bot* bot) {
+    struct Point at = bot->player->location;
+    bool moved = at.x != bot->last_position.x || at.y != bot->last_position.y;
+    if (moved && bot->map->grid[at.y][at.x] == TRAP_SYMBOL) return SIM_KILLED_BY_TRAP;
+    if (enemy_adjacent(bot->map, at)) return SIM_KILLED_BY_ENEMY;
+    return SIM_KILLED_OTHER;
+}
+
+static int choose_move(struct Bot* bot) {
+    Player* player = bot->player;
+
+    if (enemy_adjacent(bot->map, player->location) && player->equipped_weapon != -1) {
+        return ' ';
+    }
+
+    if (player->hunger_rate >= SIM_EAT && has_food(player)) {
+        snprintf(bot->lines[0], sizeof(bot->lines[0]), "u normal");
+        snprintf(bot->lines[1], sizeof(bot->lines[1]), "q");
+        bot->line_count = 2;
+        bot->next_line = 0;
+        return 'e';
+    }
+
+    int step = player->hunger_rate >= SIM_HUNGRY ? step_towards(bot, is_food, MAP_WIDTH * MAP_HEIGHT) : -1;
+    if (step < 0) step = step_towards(bot, is_item, SIM_ITEM_RANGE);
+    if (step < 0) step = step_towards(bot, is_exit, MAP_WIDTH * MAP_HEIGHT);
+    if (step < 0) step = step_towards(bot, is_code_tile, MAP_WIDTH * MAP_HEIGHT);
+    if (step < 0) step = rand() % 8;
+
+    bot->door = (struct Point){ player->location.x + step_dx[step], player->location.y + step_dy[step] };
+    return step_keys[step];
+}
+
+static int bot_key(void* context, bool new_turn) {
+    struct Bot* bot = context;
+
+    if (!new_turn) {
+        // Prompts and "press any key" screens; when quitting, back out of everything
+        if (bot->quitting) return ++bot->quit_keys % 2 ? 'q' : '\n';
+        return '\n';
+    }
+
+    uint64_t now = perf_now_ns();
+    if (bot->turn_start_ns) perf_record(bot->turn_times, now - bot->turn_start_ns);
+
+    if (bot->player->hitpoints < bot->last_hp) bot->last_damage = damage_cause(bot);
+    bot->last_hp = bot->player->hitpoints;
+    bot->last_position = bot->player->location;
+
+    int key;
+    if (++bot->turn > bot->max_turns) {
+        bot->quitting = true;
+        key = 'q';
+    } else {
+        key = choose_move(bot);
+    }
+    bot->turn_start_ns = perf_now_ns();
+    return key;
+}
+
+static void bot_line(void* context, char* buffer, int max_len) {
+    struct Bot* bot = context;
+    const char* line = "q";
+
+    if (bot->next_line < bot->line_count) {
+        line = bot->lines[bot->next_line++];
+    } else {
+        // A password prompt for the door being walked into
+        Room* room = find_room_by_position(bot->map, bot->door.x, bot->door.y);
+        if (room && room->door_code[0] != '\0') line = room->door_code;
+    }
+    snprintf(buffer, (size_t)max_len + 1, "%s", line);
+}
+
+static void bot_level(void* context, int level) {
+    struct Bot* bot = context;
+    if (bot->level >= 1 && bot->level <= SIM_LEVELS) {
+        bot->level_turns[bot->level] += bot->turn - bot->level_start;
+    }
+    bot->level = level;
+    bot->level_start = bot->turn;
+}
+
+static void play_one(struct UserManager* manager, const struct SimOptions* options, int game,
+                     struct SimResult* result, struct PerfHistogram* turn_times) {
+    static struct GameContext context;
+    static struct Map map;
+    static Player player;
+
+    srand(options->seed + (unsigned)game);
+    struct Bot bot = {
+        .map = &map,
+        .player = &player,
+        .max_turns = options->max_turns,
+        .turn_times = turn_times,
+    };
+    struct InputBot input = { bot_key, bot_line, bot_level, &bot, false };
+    input_set_bot(&input);
+
+    input_begin_game(manager);
+    input_begin_level(1);
+    map = generate_map(manager, NULL, 1, 4, 0, 0);
+    initialize_player(manager, &player, map.initial_position);
+    bot.last_hp = player.hitpoints;
+    bot.last_position = player.location;
+
+    game_context_init(&context);
+    play_game(&context, manager, &map, &player, player.current_score);
+    input_end_game();
+    bot_level(&bot, 0);
+
+    if (bot.quitting) {
+        result->outcome = SIM_TURN_LIMIT;
+    } else if (player.hunger_rate >= 100) {
+        result->outcome = SIM_STARVED;
+    } else if (player.hitpoints <= 0) {
+        result->outcome = player.hitpoints < bot.last_hp ? damage_cause(&bot) : bot.last_damage;
+    } else {
+        result->outcome = SIM_VICTORY;
+    }
+    result->turns = bot.turn;
+    result->gold = player.current_gold;
+    result->score = player.current_score;
+    for (int level = 1; level <= SIM_LEVELS; level++) {
+        result->level_turns[level] = bot.level_turns[level];
+        if (bot.level_turns[level] > 0) result->level = level;
+    }
+    result->done = true;
+}
+
+// Runs in a forked child: plays games worker, worker + workers, ...
+static int run_worker(int worker, const struct SimOptions* options,
+                      struct SimResult* results, struct PerfHistogram* turn_times) {
+    char scratch[] = "/tmp/sim_XXXXXX";
+    if (!mkdtemp(scratch) || chdir(scratch) != 0 || mkdir("saves", 0755) != 0) return 1;
+    if (!input_open_headless(MAP_HEIGHT + 10, MAP_WIDTH + 60)) return 1;
+    audio_disable();
+
+    struct UserManager* manager = calloc(1, sizeof(struct UserManager));
+    struct User user = { .difficulty = options->difficulty };
+    strcpy(user.username, "bot");
+    strcpy(user.character_color, "White");
+    if (manager) manager->current_user = add_user(manager, &user);
+    if (manager == NULL || manager->current_user == NULL) return 1;
+
+    for (int game = worker; game < options->games; game += options->workers) {
+        manager->current_user->difficulty = options->difficulty;
+        play_one(manager, options, game, &results[game], turn_times);
+    }
+
+    free_user_manager(manager);
+    input_close_headless();
+    remove("saves/bot.sav");
+    rmdir("saves");
+    remove("users.json");
+    remove(USERS_CHECKSUM_FILE);
+    remove(USERS_LOCK_FILE);
+    if (chdir("/") == 0) rmdir(scratch);
+    return 0;
+}
+
+static void print_report(const struct SimOptions* options, const struct SimResult* results,
+                         struct PerfHistogram* turn_times, double seconds) {
+    int finished = 0;
+    int outcomes[SIM_OUTCOMES] = {0};
+    long turns = 0, gold = 0, levels = 0;
+    long level_turns[SIM_LEVELS + 1] = {0};
+    int level_games[SIM_LEVELS + 1] = {0};
+
+    for (int game = 0; game < options->games; game++) {
+        const struct SimResult* result = &results[game];
+        if (!result->done) continue;
+        finished++;
+        outcomes[result->outcome]++;
+        turns += result->turns;
+        gold += result->gold;
+        levels += result->level;
+        for (int level = 1; level <= SIM_LEVELS; level++) {
+            if (result->level_turns[level] > 0) {
+                level_turns[level] += result->level_turns[level];
+                level_games[level]++;
+            }
+        }
+    }
+
+    // Merge the workers' turn-time histograms
+    for (int worker = 1; worker < options->workers; worker++) {
+        for (int bucket = 0; bucket < PERF_BUCKETS; bucket++) {
+            turn_times[0].counts[bucket] += turn_times[worker].counts[bucket];
+        }
+        turn_times[0].total += turn_times[worker].total;
+    }
+
+    printf("Simulated %d of %d games (difficulty %d, %d workers) in %.2f s: %.0f games/min\n",
+           finished, options->games, options->difficulty, options->workers, seconds,
+           seconds > 0 ? finished / seconds * 60 : 0.0);
+    if (finished == 0) return;
+
+    printf("Outcomes:\n");
+    for (int outcome = 0; outcome < SIM_OUTCOMES; outcome++) {
+        printf("  %-16s %7d  %5.1f%%\n", outcome_names[outcome], outcomes[outcome],
+               100.0 * outcomes[outcome] / finished);
+    }
+    printf("Per game: %.1f turns, %.1f gold, deepest level %.2f\n",
+           (double)turns / finished, (double)gold / finished, (double)levels / finished);
+    printf("Turns per level (games that reached it):\n");
+    for (int level = 1; level <= SIM_LEVELS; level++) {
+        printf("  level %d  %8.1f  (%d games)\n", level,
+               level_games[level] ? (double)level_turns[level] / level_games[level] : 0.0,
+               level_games[level]);
+    }
+    printf("Time per turn: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           perf_percentile(&turn_times[0], 50) / 1e3,
+           perf_percentile(&turn_times[0], 99) / 1e3,
+           perf_percentile(&turn_times[0], 100) / 1e3);
+}
+
+static void print_usage(const char* program) {
+    printf("Usage: %s [-n games] [-j workers] [-t max turns] [-d difficulty] [-s seed]\n", program);
+}
+
+int main(int argc, char* argv[]) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    struct SimOptions options = {
+        .games = SIM_DEFAULT_GAMES,
+        .workers = cores > 0 ? (int)cores : 1,
+        .max_turns = SIM_DEFAULT_MAX_TURNS,
+        .difficulty = 1,
+        .seed = 1,
+    };
+
+    int option;
+    while ((option = getopt(argc, argv, "n:j:t:d:s:h")) != -1) {
+        switch (option) {
+            case 'n': options.games = atoi(optarg); break;
+            case 'j': options.workers = atoi(optarg); break;
+            case 't': options.max_turns = atoi(optarg); break;
+            case 'd': options.difficulty = atoi(optarg); break;
+            case 's': options.seed = (unsigned)strtoul(optarg, NULL, 10); break;
+            default:
+                print_usage(argv[0]);
+                return option == 'h' ? 0 : 1;
+        }
+    }
+    if (options.games < 1 || options.workers < 1 || options.max_turns < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (options.workers > options.games) options.workers = options.games;
+
+    // Results are written straight into memory shared with the workers
+    size_t results_size = options.games * sizeof(struct SimResult);
+    size_t times_size = options.workers * sizeof(struct PerfHistogram);
+    struct SimResult* results = mmap(NULL, results_size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    struct PerfHistogram* turn_times = mmap(NULL, times_size, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED || turn_times == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    int started = 0;
+    for (int worker = 0; worker < options.workers; worker++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            _exit(run_worker(worker, &options, results, &turn_times[worker]));
+        }
+        if (pid > 0) started++;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < started; i++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+    print_report(&options, results, turn_times, seconds);
+    if (failed || started < options.workers) {
+        fprintf(stderr, "%d of %d workers failed\n", failed + options.workers - started, options.workers);
+    }
+
+    munmap(results, results_size);
+    munmap(turn_times, times_size);
+    return failed || started < options.workers ? 1 : 0;
+}
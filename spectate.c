@@ -0,0 +1,580 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "spectate.h"
+#include "frame.h"
+
+#define SPECTATE_EVENTS 32
+
+// Encoded once, shared by every viewer it is queued for. Only the sender
+// thread touches frames, so the count needs no atomics.
+struct Frame {
+    int refs;
+    size_t length;
+    char data[];
+};
+
+struct SpectateChannel {
+    int id;
+    char player[32];
+    bool published;               // Has been played: listed for viewers
+    bool closed;                  // Destroyed by the game; the sender frees it
+    int viewers;                  // Atomic: read by the game on every publish
+
+    // Guarded by lock: written by the game, taken by the sender
+    struct FrameGrid* incoming;
+    bool fresh;
+
+    // Sender thread only
+    struct FrameGrid* work;
+    struct FrameGrid* sent;       // What viewers in sync are showing
+    struct SpectateChannel* next;
+};
+
+struct Viewer {
+    int fd;
+    struct SpectateChannel* channel;   // NULL while choosing a game
+    struct Frame* queue[SPECTATE_QUEUE];
+    int head, count;
+    size_t offset;                // Bytes of queue[head] already sent
+    bool needs_keyframe;          // Attached, or its backlog was dropped
+    bool want_write;              // Waiting for EPOLLOUT
+    char typed[8];                // Game number being typed
+    int typed_len;
+    struct Viewer* next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct SpectateChannel* channels = NULL;   // Guarded by lock
+static int next_channel_id = 1;
+static struct FramePalette palette;               // Set under lock before the first frame
+static bool palette_captured = false;
+static struct SpectateChannel* current_channel = NULL;
+
+static bool started = false;
+static pthread_t sender_thread;
+static int listen_fd = -1, wake_fd = -1, epoll_fd = -1;
+static char socket_path[108];
+static bool stopping = false;
+
+// Sender thread only
+static struct Viewer* viewers = NULL;
+static int viewer_count = 0;
+static bool viewer_freed = false;    // Ends the epoll batch: later events may name it
+static struct FrameText scratch;
+static int listener_tag, wake_tag;   // epoll data for the non-viewer descriptors
+
+static void wake_sender(void) {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // Already has wakeups pending
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Game side
+// ---------------------------------------------------------------------------
+
+struct SpectateChannel* spectate_channel_create(void) {
+    if (!started) return NULL;
+    struct SpectateChannel* channel = calloc(1, sizeof(struct SpectateChannel));
+    if (channel == NULL) return NULL;
+
+    pthread_mutex_lock(&lock);
+    channel->id = next_channel_id++;
+    channel->next = channels;
+    channels = channel;
+    pthread_mutex_unlock(&lock);
+    return channel;
+}
+
+// The channel must not be used afterwards; the sender detaches its viewers
+void spectate_channel_destroy(struct SpectateChannel* channel) {
+    if (channel == NULL) return;
+    if (current_channel == channel) current_channel = NULL;
+    pthread_mutex_lock(&lock);
+    channel->closed = true;
+    pthread_mutex_unlock(&lock);
+    wake_sender();
+}
+
+// Where spectate_publish() sends the screen; NULL for nowhere
+void spectate_set_channel(struct SpectateChannel* channel) {
+    current_channel = channel;
+}
+
+// Called with the turn's screen complete, before waiting for the key
+void spectate_publish(const char* player) {
+    struct SpectateChannel* channel = current_channel;
+    if (channel == NULL) return;
+
+    // Only this thread writes the name, so reading it here is safe
+    if (!channel->published || strcmp(channel->player, player) != 0) {
+        pthread_mutex_lock(&lock);
+        snprintf(channel->player, sizeof(channel->player), "%s", player);
+        channel->published = true;
+        pthread_mutex_unlock(&lock);
+    }
+    if (__atomic_load_n(&channel->viewers, __ATOMIC_ACQUIRE) == 0) return;
+
+    pthread_mutex_lock(&lock);
+    if (!palette_captured) {
+        frame_capture_palette(&palette);
+        palette_captured = true;
+    }
+    channel->incoming = frame_capture(channel->incoming);
+    if (channel->incoming) channel->fresh = true;
+    pthread_mutex_unlock(&lock);
+    wake_sender();
+}
+
+// ---------------------------------------------------------------------------
+// Encoding
+// ---------------------------------------------------------------------------
+
+static struct Frame* make_frame(const char* data, size_t length) {
+    struct Frame* frame = malloc(sizeof(struct Frame) + length);
+    if (frame == NULL) return NULL;
+    frame->refs = 1;
+    frame->length = length;
+    memcpy(frame->data, data, length);
+    return frame;
+}
+
+static void release_frame(struct Frame* frame) {
+    if (frame && --frame->refs == 0) free(frame);
+}
+
+// The escapes that turn 'from' into 'to' on a viewer's terminal (from NULL:
+// a full frame); NULL if nothing changed
+static struct Frame* encode_frame(const struct FrameGrid* from, const struct FrameGrid* to) {
+    scratch.length = 0;
+    if (!frame_encode(&scratch, from, to, &palette)) return NULL;
+    return make_frame(scratch.data, scratch.length);
+}
+
+// ---------------------------------------------------------------------------
+// Viewers
+// ---------------------------------------------------------------------------
+
+static void set_want_write(struct Viewer* viewer, bool want) {
+    if (viewer->want_write == want) return;
+    struct epoll_event event = { .events = EPOLLIN | (want ? EPOLLOUT : 0), .data.ptr = viewer };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, viewer->fd, &event);
+    viewer->want_write = want;
+}
+
+static void queue_frame(struct Viewer* viewer, struct Frame* frame) {
+    viewer->queue[(viewer->head + viewer->count) % SPECTATE_QUEUE] = frame;
+    viewer->count++;
+    frame->refs++;
+}
+
+// Forgets what the viewer has not been sent. A frame already partly sent
+// stays, or its last escape sequence would be cut in half.
+static void drop_backlog(struct Viewer* viewer) {
+    int keep = viewer->offset > 0 ? 1 : 0;
+    for (int i = keep; i < viewer->count; i++) {
+        release_frame(viewer->queue[(viewer->head + i) % SPECTATE_QUEUE]);
+    }
+    viewer->count = keep;
+}
+
+static void send_text(struct Viewer* viewer, const char* text) {
+    struct Frame* frame = make_frame(text, strlen(text));
+    if (frame == NULL) return;
+    if (viewer->count == SPECTATE_QUEUE) drop_backlog(viewer);
+    if (viewer->count < SPECTATE_QUEUE) queue_frame(viewer, frame);
+    release_frame(frame);
+}
+
+// A viewer that needs a full frame gets one as soon as nothing is queued
+// ahead of it, from the last frame its game sent
+static void resync(struct Viewer* viewer, struct Frame** shared) {
+    struct SpectateChannel* channel = viewer->channel;
+    if (channel == NULL || !viewer->needs_keyframe || viewer->count > 0 || channel->sent == NULL) return;
+
+    struct Frame* frame = shared && *shared ? *shared : encode_frame(NULL, channel->sent);
+    if (frame == NULL) return;
+    queue_frame(viewer, frame);
+    viewer->needs_keyframe = false;
+    if (shared && *shared == NULL) *shared = frame;
+    else if (shared == NULL) release_frame(frame);
+}
+
+// Sends what the socket takes without blocking; false once the viewer is gone
+static bool flush_viewer(struct Viewer* viewer) {
+    for (;;) {
+        while (viewer->count > 0) {
+            struct Frame* frame = viewer->queue[viewer->head];
+            ssize_t sent = send(viewer->fd, frame->data + viewer->offset, frame->length - viewer->offset,
+                                MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            viewer->offset += (size_t)sent;
+            if (viewer->offset < frame->length) continue;
+
+            release_frame(frame);
+            viewer->head = (viewer->head + 1) % SPECTATE_QUEUE;
+            viewer->count--;
+            viewer->offset = 0;
+        }
+        if (viewer->count > 0 || !viewer->needs_keyframe || viewer->channel == NULL ||
+            viewer->channel->sent == NULL) {
+            break;
+        }
+        resync(viewer, NULL);   // Caught up after a drop
+    }
+    set_want_write(viewer, viewer->count > 0);
+    return true;
+}
+
+static void set_viewers(struct SpectateChannel* channel, int change) {
+    int count = __atomic_add_fetch(&channel->viewers, change, __ATOMIC_ACQ_REL);
+    if (count > 0) return;
+
+    // Nobody watches: the game stops copying, and what was sent goes stale
+    free(channel->work);
+    free(channel->sent);
+    channel->work = channel->sent = NULL;
+    pthread_mutex_lock(&lock);
+    free(channel->incoming);
+    channel->incoming = NULL;
+    channel->fresh = false;
+    pthread_mutex_unlock(&lock);
+}
+
+static void detach(struct Viewer* viewer) {
+    if (viewer->channel) set_viewers(viewer->channel, -1);
+    viewer->channel = NULL;
+}
+
+static void attach(struct Viewer* viewer, struct SpectateChannel* channel) {
+    detach(viewer);
+    drop_backlog(viewer);
+    viewer->channel = channel;
+    viewer->needs_keyframe = true;
+    set_viewers(channel, +1);
+    if (channel->sent == NULL) {
+        send_text(viewer, "\x1b[0m\x1b[H\x1b[2JWaiting for the player's next move...");
+    }
+    resync(viewer, NULL);
+}
+
+// Lists the games being played; with exactly one, 'only' gets it
+static void send_listing(struct Viewer* viewer, const char* note, struct SpectateChannel** only) {
+    struct FrameText text = { 0 };
+    int listed = 0;
+    struct SpectateChannel* last = NULL;
+
+    frame_appendf(&text, "\x1b[0m\x1b[H\x1b[2J\x1b[?25h");
+    if (note) {
+        frame_append(&text, note, strlen(note));
+        frame_appendf(&text, "\r\n\r\n");
+    }
+    pthread_mutex_lock(&lock);
+    for (struct SpectateChannel* channel = channels; channel; channel = channel->next) {
+        if (!channel->published || channel->closed) continue;
+        if (listed++ == 0) frame_appendf(&text, "Games being played:\r\n");
+        frame_appendf(&text, "  %3d  ", channel->id);
+        frame_append(&text, channel->player, strlen(channel->player));
+        frame_appendf(&text, "\r\n");
+        last = channel;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (only && listed == 1) {
+        *only = last;
+    } else {
+        if (listed == 0) frame_appendf(&text, "No games are being played.\r\nEnter looks again, ");
+        else frame_appendf(&text, "\r\nType a game number and Enter to watch, ");
+        frame_appendf(&text, "q leaves: ");
+        frame_append(&text, "", 1);
+        send_text(viewer, text.data);
+    }
+    free(text.data);
+}
+
+static struct SpectateChannel* find_channel(int id) {
+    pthread_mutex_lock(&lock);
+    struct SpectateChannel* found = NULL;
+    for (struct SpectateChannel* channel = channels; channel && !found; channel = channel->next) {
+        if (channel->id == id && channel->published && !channel->closed) found = channel;
+    }
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+static void free_viewer(struct Viewer* viewer) {
+    for (struct Viewer** link = &viewers; *link; link = &(*link)->next) {
+        if (*link == viewer) {
+            *link = viewer->next;
+            break;
+        }
+    }
+    detach(viewer);
+    viewer->offset = 0;
+    drop_backlog(viewer);
+    close(viewer->fd);
+    free(viewer);
+    viewer_count--;
+    viewer_freed = true;
+}
+
+static void accept_viewer(void) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    if (viewer_count >= SPECTATE_MAX_VIEWERS) {
+        static const char full[] = "Too many spectators; try again later.\r\n";
+        if (send(fd, full, sizeof(full) - 1, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            // Closing anyway
+        }
+        close(fd);
+        return;
+    }
+
+    struct Viewer* viewer = calloc(1, sizeof(struct Viewer));
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = viewer };
+    if (viewer == NULL || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        free(viewer);
+        close(fd);
+        return;
+    }
+    viewer->fd = fd;
+    viewer->next = viewers;
+    viewers = viewer;
+    viewer_count++;
+
+    struct SpectateChannel* only = NULL;
+    send_listing(viewer, NULL, &only);
+    if (only) attach(viewer, only);
+    if (!flush_viewer(viewer)) free_viewer(viewer);
+}
+
+// Viewers only type game numbers, Enter and q; false once the viewer is gone
+static bool read_viewer(struct Viewer* viewer) {
+    char bytes[64];
+    ssize_t count = recv(viewer->fd, bytes, sizeof(bytes), MSG_DONTWAIT);
+    if (count == 0) return false;
+    if (count < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    for (ssize_t i = 0; i < count; i++) {
+        char c = bytes[i];
+        if (c == 'q' || c == 'Q' || c == 3 || c == 4) return false;   // Also Ctrl-C, Ctrl-D
+        if (c >= '0' && c <= '9' && viewer->typed_len < (int)sizeof(viewer->typed) - 1) {
+            viewer->typed[viewer->typed_len++] = c;
+        } else if (c == '\r' || c == '\n') {
+            viewer->typed[viewer->typed_len] = '\0';
+            struct SpectateChannel* channel = viewer->typed_len ? find_channel(atoi(viewer->typed)) : NULL;
+            viewer->typed_len = 0;
+            if (channel) {
+                attach(viewer, channel);
+            } else {
+                detach(viewer);
+                drop_backlog(viewer);
+                send_listing(viewer, NULL, NULL);
+            }
+        }
+    }
+    return flush_viewer(viewer);
+}
+
+// ---------------------------------------------------------------------------
+// Sender thread
+// ---------------------------------------------------------------------------
+
+// Encodes a game's newest screen once and queues it for everyone watching
+static void deliver(struct SpectateChannel* channel) {
+    pthread_mutex_lock(&lock);
+    struct FrameGrid* latest = channel->incoming;
+    channel->incoming = channel->work;
+    channel->work = latest;
+    channel->fresh = false;
+    pthread_mutex_unlock(&lock);
+    if (latest == NULL) return;
+
+    struct FrameGrid* sent = channel->sent;
+    bool same_shape = sent && sent->lines == latest->lines && sent->columns == latest->columns;
+    struct Frame* diff = NULL;
+    bool encoded = false;
+
+    for (struct Viewer* viewer = viewers; viewer; viewer = viewer->next) {
+        if (viewer->channel != channel) continue;
+        if (!same_shape) viewer->needs_keyframe = true;
+        if (viewer->needs_keyframe) continue;   // Skips frames until it has caught up
+
+        if (!encoded) {
+            diff = encode_frame(sent, latest);
+            encoded = true;
+        }
+        if (diff == NULL) continue;
+        if (viewer->count == SPECTATE_QUEUE) {
+            drop_backlog(viewer);
+            viewer->needs_keyframe = true;
+        } else {
+            queue_frame(viewer, diff);
+        }
+    }
+    release_frame(diff);
+
+    channel->work = sent;
+    channel->sent = latest;
+
+    struct Frame* keyframe = NULL;
+    for (struct Viewer* viewer = viewers, *next; viewer; viewer = next) {
+        next = viewer->next;
+        if (viewer->channel != channel) continue;
+        resync(viewer, &keyframe);
+        if (!flush_viewer(viewer)) free_viewer(viewer);
+    }
+    release_frame(keyframe);
+}
+
+static void free_channel(struct SpectateChannel* channel) {
+    free(channel->incoming);
+    free(channel->work);
+    free(channel->sent);
+    free(channel);
+}
+
+// Frames for every game that published since the last wakeup; games that
+// ended send their viewers back to the list
+static void handle_wakeup(void) {
+    uint64_t wakeups;
+    if (read(wake_fd, &wakeups, sizeof(wakeups)) < 0) return;
+
+    for (;;) {
+        struct SpectateChannel* pick = NULL;
+        pthread_mutex_lock(&lock);
+        for (struct SpectateChannel** link = &channels; *link && !pick; ) {
+            struct SpectateChannel* channel = *link;
+            if (channel->closed) {
+                *link = channel->next;
+                pick = channel;
+            } else if (channel->fresh) {
+                pick = channel;
+            } else {
+                link = &channel->next;
+            }
+        }
+        pthread_mutex_unlock(&lock);
+        if (pick == NULL) break;
+
+        if (!pick->closed) {
+            deliver(pick);
+            continue;
+        }
+        for (struct Viewer* viewer = viewers, *next; viewer; viewer = next) {
+            next = viewer->next;
+            if (viewer->channel != pick) continue;
+            detach(viewer);
+            drop_backlog(viewer);
+            send_listing(viewer, "That game has ended.", NULL);
+            if (!flush_viewer(viewer)) free_viewer(viewer);
+        }
+        free_channel(pick);
+    }
+}
+
+static void* sender_main(void* arg) {
+    (void)arg;
+    struct epoll_event events[SPECTATE_EVENTS];
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        int count = epoll_wait(epoll_fd, events, SPECTATE_EVENTS, -1);
+        viewer_freed = false;
+        // Events are level-triggered: the rest of a batch cut short comes back
+        for (int i = 0; i < count && !viewer_freed; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &listener_tag) {
+                accept_viewer();
+            } else if (tag == &wake_tag) {
+                handle_wakeup();
+            } else {
+                struct Viewer* viewer = tag;
+                bool alive = true;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) alive = read_viewer(viewer);
+                if (alive && (events[i].events & EPOLLOUT)) alive = flush_viewer(viewer);
+                if (!alive) free_viewer(viewer);
+            }
+        }
+    }
+
+    while (viewers) free_viewer(viewers);
+    return NULL;
+}
+
+// Listens for spectators on the unix socket 'path'
+bool spectate_start(const char* path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (started || strlen(path) >= sizeof(address.sun_path)) return false;
+    strcpy(address.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    bool ok = listen_fd >= 0 && wake_fd >= 0 && epoll_fd >= 0;
+    if (ok) {
+        unlink(path);
+        ok = bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) == 0 && listen(listen_fd, 16) == 0;
+    }
+    if (ok) {
+        struct epoll_event listener = { .events = EPOLLIN, .data.ptr = &listener_tag };
+        struct epoll_event wake = { .events = EPOLLIN, .data.ptr = &wake_tag };
+        ok = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listener) == 0 &&
+             epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &wake) == 0;
+    }
+    stopping = false;
+    if (ok) ok = pthread_create(&sender_thread, NULL, sender_main, NULL) == 0;
+
+    if (!ok) {
+        int saved = errno;
+        if (listen_fd >= 0) close(listen_fd);
+        if (wake_fd >= 0) close(wake_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+        listen_fd = wake_fd = epoll_fd = -1;
+        errno = saved;
+        return false;
+    }
+    snprintf(socket_path, sizeof(socket_path), "%s", path);
+    started = true;
+    return true;
+}
+
+// Disconnects every spectator. Channels still open are freed: the games
+// must not publish to them afterwards.
+void spectate_shutdown(void) {
+    if (!started) return;
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    wake_sender();
+    pthread_join(sender_thread, NULL);
+
+    while (channels) {
+        struct SpectateChannel* channel = channels;
+        channels = channel->next;
+        free_channel(channel);
+    }
+    current_channel = NULL;
+    free(scratch.data);
+    scratch = (struct FrameText){ 0 };
+    close(listen_fd);
+    close(wake_fd);
+    close(epoll_fd);
+    listen_fd = wake_fd = epoll_fd = -1;
+    unlink(socket_path);
+    started = false;
+}
@@ -0,0 +1,34 @@
+#ifndef SPECTATE_H
+#define SPECTATE_H
+
+#include <stdbool.h>
+
+// Read-only spectators of live games on a unix socket (--spectate PATH):
+//   socat -,raw,echo=0 UNIX-CONNECT:spectate.sock
+// A viewer gets the list of games being played, types a number and Enter,
+// and from then on sees that player's screen. Typing another number
+// switches games. With a single game the viewer is attached right away.
+//
+// Every game is a channel. The game publishes its screen once a turn, just
+// before it waits for a key. With nobody watching that costs one atomic
+// load. Otherwise the game copies the screen's cells and goes on. A sender
+// thread diffs the copy against the last frame it sent and encodes the
+// changed cells (cursor moves, colors, text) once. The same buffer goes to
+// every viewer of that game. A viewer more than SPECTATE_QUEUE frames behind
+// has its backlog dropped and gets a full frame instead, so the game never
+// waits on a viewer.
+
+#define SPECTATE_QUEUE 8          // Frames a viewer may fall behind
+#define SPECTATE_MAX_VIEWERS 64
+
+struct SpectateChannel;
+
+// Function declarations
+bool spectate_start(const char* path);
+void spectate_shutdown(void);
+struct SpectateChannel* spectate_channel_create(void);
+void spectate_channel_destroy(struct SpectateChannel* channel);
+void spectate_set_channel(struct SpectateChannel* channel);
+void spectate_publish(const char* player);
+
+#endif
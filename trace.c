@@ -0,0 +1,166 @@
+#include "trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int track;
+};
+
+// One per thread, created on its first event. Only the owning thread writes
+// to it, so recording an event takes no lock.
+struct TraceBuffer {
+    int tid;
+    uint64_t written;          // Total events; the ring keeps the last TRACE_RING_SIZE
+    struct TraceStack own;     // Used while trace_use_stack has not set another
+    struct TraceEvent events[TRACE_RING_SIZE];
+};
+
+static struct TraceBuffer* buffers[TRACE_MAX_THREADS];
+static int buffer_count = 0;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct TraceBuffer* thread_buffer = NULL;
+static __thread bool thread_untraced = false;   // Ran out of buffers
+static __thread struct TraceStack* thread_stack = NULL;
+static int tracks_given = TRACE_MAX_THREADS;    // Threads' tracks come first
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static struct TraceBuffer* get_buffer(void) {
+    if (thread_buffer || thread_untraced) return thread_buffer;
+
+    pthread_mutex_lock(&buffers_lock);
+    if (buffer_count < TRACE_MAX_THREADS) {
+        thread_buffer = calloc(1, sizeof(struct TraceBuffer));
+        if (thread_buffer) {
+            thread_buffer->tid = buffer_count + 1;
+            thread_buffer->own.track = thread_buffer->tid;
+            buffers[buffer_count++] = thread_buffer;
+        }
+    }
+    pthread_mutex_unlock(&buffers_lock);
+
+    thread_untraced = thread_buffer == NULL;
+    return thread_buffer;
+}
+
+static struct TraceStack* current_stack(struct TraceBuffer* buffer) {
+    return thread_stack ? thread_stack : &buffer->own;
+}
+
+// A stack of its own, on a track no thread uses
+void trace_stack_init(struct TraceStack* stack) {
+    stack->track = __atomic_add_fetch(&tracks_given, 1, __ATOMIC_RELAXED);
+    stack->depth = 0;
+}
+
+// Makes 'stack' the one this thread's TRACE_BEGIN, TRACE_END and events use
+// until the next call; NULL goes back to the thread's own
+void trace_use_stack(struct TraceStack* stack) {
+    thread_stack = stack;
+}
+
+static void record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    struct TraceBuffer* buffer = get_buffer();
+    if (buffer == NULL) return;
+
+    struct TraceEvent* event = &buffer->events[buffer->written % TRACE_RING_SIZE];
+    event->name = name;
+    event->start_ns = start_ns;
+    event->duration_ns = end_ns - start_ns;
+    event->track = current_stack(buffer)->track;
+    // Published after the event, so a dump only reads slots that have been
+    // filled at least once. Slots are not versioned: if this thread wraps the
+    // ring while a dump is copying it, the dump can show an event mixed from
+    // an old and a new write. Dump once tracing threads are idle for an exact
+    // trace.
+    __atomic_store_n(&buffer->written, buffer->written + 1, __ATOMIC_RELEASE);
+}
+
+struct TraceScope trace_scope_begin(const char* name) {
+    return (struct TraceScope){ name, now_ns() };
+}
+
+void trace_scope_end(struct TraceScope* scope) {
+    record(scope->name, scope->start_ns, now_ns());
+}
+
+void trace_begin(const char* name) {
+    struct TraceBuffer* buffer = get_buffer();
+    if (buffer == NULL) return;
+
+    struct TraceStack* stack = current_stack(buffer);
+    if (stack->depth < TRACE_MAX_DEPTH) {
+        stack->open[stack->depth] = trace_scope_begin(name);
+    }
+    stack->depth++;
+}
+
+void trace_end(void) {
+    struct TraceBuffer* buffer = get_buffer();
+    if (buffer == NULL) return;
+
+    struct TraceStack* stack = current_stack(buffer);
+    if (stack->depth == 0) return;
+    stack->depth--;
+    if (stack->depth < TRACE_MAX_DEPTH) {
+        trace_scope_end(&stack->open[stack->depth]);
+    }
+}
+
+// Writes every thread's retained events as a Chrome trace. Timestamps are
+// microseconds; the earliest event is moved to zero. Events a thread records
+// during the dump may show up mixed with the ones they overwrite (see record).
+void trace_dump(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return;
+
+    pthread_mutex_lock(&buffers_lock);
+
+    uint64_t origin = UINT64_MAX;
+    for (int b = 0; b < buffer_count; b++) {
+        uint64_t written = __atomic_load_n(&buffers[b]->written, __ATOMIC_ACQUIRE);
+        uint64_t first = written > TRACE_RING_SIZE ? written - TRACE_RING_SIZE : 0;
+        for (uint64_t i = first; i < written; i++) {
+            uint64_t start = buffers[b]->events[i % TRACE_RING_SIZE].start_ns;
+            if (start < origin) origin = start;
+        }
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first_event = true;
+    int pid = (int)getpid();
+    for (int b = 0; b < buffer_count; b++) {
+        struct TraceBuffer* buffer = buffers[b];
+        uint64_t written = __atomic_load_n(&buffer->written, __ATOMIC_ACQUIRE);
+        uint64_t first = written > TRACE_RING_SIZE ? written - TRACE_RING_SIZE : 0;
+
+        for (uint64_t i = first; i < written; i++) {
+            const struct TraceEvent* event = &buffer->events[i % TRACE_RING_SIZE];
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                          "\"ts\":%.3f,\"dur\":%.3f}",
+                    first_event ? "" : ",", event->name, pid, event->track,
+                    (event->start_ns - origin) / 1e3, event->duration_ns / 1e3);
+            first_event = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    pthread_mutex_unlock(&buffers_lock);
+    fclose(file);
+}
+
+#endif
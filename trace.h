@@ -0,0 +1,74 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Hot-path instrumentation. Built with -DENABLE_TRACE (make TRACE=1), the
+// macros record timed events into a ring buffer owned by the calling thread
+// and TRACE_DUMP() writes them out as Chrome trace JSON (chrome://tracing,
+// Perfetto). Without it every macro expands to nothing.
+//
+//   TRACE_SCOPE("print_map");          // Ends when the enclosing block does
+//   TRACE_BEGIN("food"); ... TRACE_END();
+//
+// Event names must be string literals: only the pointer is stored.
+//
+// TRACE_BEGINs still open are kept on a stack, which also names the track
+// (Chrome "tid") events go to. Each thread has one. Coroutines that take
+// turns on a thread (server sessions) each bring their own with
+// TRACE_USE_STACK, so they do not close each other's scopes or show up
+// inside each other's spans.
+
+#define TRACE_FILE "trace.json"
+#define TRACE_RING_SIZE 65536     // Events kept per thread; older ones are overwritten
+#define TRACE_MAX_THREADS 32
+#define TRACE_MAX_DEPTH 32        // Nested TRACE_BEGINs per stack
+
+#ifdef ENABLE_TRACE
+
+#include <stdint.h>
+
+struct TraceScope {
+    const char* name;
+    uint64_t start_ns;
+};
+
+struct TraceStack {
+    int track;
+    int depth;
+    struct TraceScope open[TRACE_MAX_DEPTH];
+};
+
+struct TraceScope trace_scope_begin(const char* name);
+void trace_scope_end(struct TraceScope* scope);
+void trace_begin(const char* name);
+void trace_end(void);
+void trace_dump(const char* path);
+void trace_stack_init(struct TraceStack* stack);
+void trace_use_stack(struct TraceStack* stack);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    struct TraceScope TRACE_CONCAT(trace_scope_, __LINE__) \
+        __attribute__((cleanup(trace_scope_end))) = trace_scope_begin(name)
+#define TRACE_BEGIN(name) trace_begin(name)
+#define TRACE_END() trace_end()
+#define TRACE_DUMP() trace_dump(TRACE_FILE)
+#define TRACE_STACK_INIT(stack) trace_stack_init(stack)
+#define TRACE_USE_STACK(stack) trace_use_stack(stack)
+
+#else
+
+struct TraceStack {
+    int unused;
+};
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END() do {} while (0)
+#define TRACE_DUMP() do {} while (0)
+#define TRACE_STACK_INIT(stack) do {} while (0)
+#define TRACE_USE_STACK(stack) do {} while (0)
+
+#endif
+
+#endif
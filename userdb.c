@@ -0,0 +1,421 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "userdb.h"
+#include "checksum.h"
+
+_Static_assert(sizeof(struct UserDbHeader) == 32, "users.db header layout changed");
+_Static_assert(sizeof(struct UserRecord) == 384, "users.db record layout changed");
+
+#define RECORD_CHECKSUM_SIZE offsetof(struct UserRecord, checksum)
+
+static struct UserDbHeader* db_header(struct UserDb* db) {
+    return (struct UserDbHeader*)db->map;
+}
+
+static struct UserRecord* db_record(struct UserDb* db, uint32_t n) {
+    return (struct UserRecord*)(db->map + sizeof(struct UserDbHeader)) + n;
+}
+
+static size_t db_file_size(uint32_t records) {
+    return sizeof(struct UserDbHeader) + (size_t)records * sizeof(struct UserRecord);
+}
+
+static void user_to_record(const struct User* user, struct UserRecord* record) {
+    memset(record, 0, sizeof(*record));
+    memcpy(record->username, user->username, sizeof(record->username));
+    memcpy(record->password, user->password, sizeof(record->password));
+    memcpy(record->email, user->email, sizeof(record->email));
+    memcpy(record->character_color, user->character_color, sizeof(record->character_color));
+    record->first_game_time = user->first_game_time;
+    record->last_game_time = user->last_game_time;
+    record->score = user->score;
+    record->gold = user->gold;
+    record->games_completed = user->games_completed;
+    record->difficulty = user->difficulty;
+    record->song = user->song;
+    record->music_on = user->music_on ? 1 : 0;
+    record->checksum = crc32c(0, record, RECORD_CHECKSUM_SIZE);
+}
+
+static void record_to_user(const struct UserRecord* record, struct User* user) {
+    memset(user, 0, sizeof(*user));
+    memcpy(user->username, record->username, sizeof(user->username));
+    memcpy(user->password, record->password, sizeof(user->password));
+    memcpy(user->email, record->email, sizeof(user->email));
+    memcpy(user->character_color, record->character_color, sizeof(user->character_color));
+    user->username[MAX_STRING_LEN - 1] = '\0';
+    user->password[MAX_STRING_LEN - 1] = '\0';
+    user->email[MAX_STRING_LEN - 1] = '\0';
+    user->character_color[sizeof(user->character_color) - 1] = '\0';
+    user->first_game_time = (time_t)record->first_game_time;
+    user->last_game_time = (time_t)record->last_game_time;
+    user->score = record->score;
+    user->gold = record->gold;
+    user->games_completed = record->games_completed;
+    user->difficulty = record->difficulty;
+    user->song = record->song;
+    user->music_on = record->music_on != 0;
+}
+
+// Blocks until the byte-range lock is granted ('type' F_RDLCK/F_WRLCK/F_UNLCK).
+// While another process holds it, the wait runs between users_wait_begin and
+// users_wait_end, so other sessions may use the store meanwhile. fcntl locks
+// belong to the process, not the session: one of them can release a range
+// this wait was granted, so the lock is taken again after the wait (at once
+// if it is still ours). A session in the middle of an update (locked_record)
+// waits without letting others in, since they could release its record.
+static bool lock_range(struct UserDb* db, short type, off_t start, off_t length) {
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = length;
+
+    for (;;) {
+        if (fcntl(db->fd, F_SETLK, &lock) == 0) return true;
+        if (errno != EAGAIN && errno != EACCES && errno != EINTR) return false;
+
+        bool yield = db->locked_record < 0;
+        if (yield) users_wait_begin();
+        int waited;
+        do {
+            waited = fcntl(db->fd, F_SETLKW, &lock);
+        } while (waited != 0 && errno == EINTR);
+        int error = errno;
+        if (yield) users_wait_end();
+
+        if (waited != 0) {
+            errno = error;
+            return false;
+        }
+        if (!yield) return true;
+    }
+}
+
+static bool lock_header(struct UserDb* db, short type) {
+    return lock_range(db, type, 0, sizeof(struct UserDbHeader));
+}
+
+static bool lock_record(struct UserDb* db, uint32_t n, short type) {
+    return lock_range(db, type, (off_t)db_file_size(n), sizeof(struct UserRecord));
+}
+
+// record_count is published by other processes through the shared mapping
+static uint32_t db_record_count(struct UserDb* db) {
+    return __atomic_load_n(&db_header(db)->record_count, __ATOMIC_ACQUIRE);
+}
+
+// Maps the whole file again if another process has grown it
+static bool db_remap(struct UserDb* db) {
+    struct stat st;
+    if (fstat(db->fd, &st) != 0) return false;
+    if ((size_t)st.st_size <= db->map_size) return true;
+
+    uint8_t* map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, db->fd, 0);
+    if (map == MAP_FAILED) return false;
+
+    if (db->map) munmap(db->map, db->map_size);
+    db->map = map;
+    db->map_size = (size_t)st.st_size;
+    db->record_capacity = (uint32_t)((db->map_size - sizeof(struct UserDbHeader)) /
+                                     sizeof(struct UserRecord));
+    return true;
+}
+
+// Grows the file and the mapping to hold at least 'records' records.
+// Appenders hold the header lock, so the file only ever grows.
+static bool db_reserve(struct UserDb* db, uint32_t records) {
+    if (!db_remap(db)) return false;
+    if (db->map && records <= db->record_capacity) return true;   // Always map the header
+
+    uint32_t capacity = db->record_capacity ? db->record_capacity : USERDB_INITIAL_RECORDS;
+    while (capacity < records) capacity *= 2;
+
+    if (ftruncate(db->fd, (off_t)db_file_size(capacity)) != 0) return false;
+    return db_remap(db);
+}
+
+// Records which db record holds user 'index'
+static bool db_map_user(struct UserDb* db, int index, int record) {
+    if (index >= db->mapped_users) {
+        int count = db->mapped_users ? db->mapped_users : USERDB_INITIAL_RECORDS;
+        while (count <= index) count *= 2;
+
+        int* map = realloc(db->record_of_user, sizeof(int) * (size_t)count);
+        if (map == NULL) return false;
+        memset(map + db->mapped_users, -1, sizeof(int) * (size_t)(count - db->mapped_users));
+        db->record_of_user = map;
+        db->mapped_users = count;
+    }
+    db->record_of_user[index] = record;
+    return true;
+}
+
+// Tracks record 'n' (which must be the next unknown record) and the user
+// loaded from it
+static bool db_track_record(struct UserDb* db, uint32_t n, int user, uint32_t checksum) {
+    if (n >= db->slot_capacity) {
+        uint32_t capacity = db->slot_capacity ? db->slot_capacity * 2 : USERDB_INITIAL_RECORDS;
+        while (capacity <= n) capacity *= 2;
+
+        struct UserDbSlot* slots = realloc(db->slots, sizeof(struct UserDbSlot) * capacity);
+        if (slots == NULL) return false;
+        db->slots = slots;
+        db->slot_capacity = capacity;
+    }
+    if (user >= 0 && !db_map_user(db, user, (int)n)) return false;
+
+    db->slots[n].user = user;
+    db->slots[n].checksum = checksum;
+    db->known_records = n + 1;
+    return true;
+}
+
+// Adds users appended by other processes since we last looked.
+// 'ranked' inserts them into the leaderboard one by one (bulk loads rebuild
+// it afterwards instead).
+static bool db_load_new_records(struct UserDb* db, struct UserManager* manager, bool ranked) {
+    uint32_t count = db_record_count(db);
+    if (count > db->record_capacity && !db_remap(db)) return false;
+
+    for (uint32_t n = db->known_records; n < count; n++) {
+        const struct UserRecord* record = db_record(db, n);
+        if (crc32c(0, record, RECORD_CHECKSUM_SIZE) != record->checksum) return false;
+
+        struct User user;
+        record_to_user(record, &user);
+        struct User* stored = ranked ? add_user(manager, &user) : add_user_unranked(manager, &user);
+        int index = stored ? (int)(stored - manager->users) : -1;   // NULL: duplicate name
+        if (!db_track_record(db, n, index, record->checksum)) return false;
+    }
+    return true;
+}
+
+static struct UserDb* db_alloc(int fd) {
+    struct UserDb* db = calloc(1, sizeof(struct UserDb));
+    if (db == NULL) {
+        close(fd);
+        return NULL;
+    }
+    db->fd = fd;
+    db->locked_record = -1;
+    return db;
+}
+
+bool userdb_exists(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+// Maps an existing database and loads every record into the (empty) store.
+// Returns NULL if the file is not a user database or a record is damaged.
+struct UserDb* userdb_open(struct UserManager* manager, const char* path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return NULL;
+
+    struct UserDb* db = db_alloc(fd);
+    if (db == NULL) return NULL;
+
+    // A read lock on the whole file waits out any record being rewritten
+    lock_range(db, F_RDLCK, 0, 0);
+
+    struct UserDbHeader header;
+    bool ok = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+              memcmp(header.magic, USERDB_MAGIC, 4) == 0 &&
+              header.version == USERDB_VERSION &&
+              header.record_size == sizeof(struct UserRecord) &&
+              db_remap(db) && db->map_size >= db_file_size(header.record_count) &&
+              db_load_new_records(db, manager, false);
+
+    lock_range(db, F_UNLCK, 0, 0);
+
+    if (!ok || !rebuild_rankings(manager)) {
+        userdb_close(db);
+        return NULL;
+    }
+    return db;
+}
+
+// Writes a new database holding every user currently in the store (used to
+// migrate from users.json). The file is built under a private name and
+// linked into place, so a process starting at the same moment either sees
+// no database or a complete one; if another process got there first, that
+// database is opened instead.
+struct UserDb* userdb_create(struct UserManager* manager, const char* path) {
+    char tmp_path[300];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid());
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return NULL;
+
+    struct UserDb* db = db_alloc(fd);
+    if (db == NULL || !db_reserve(db, (uint32_t)manager->user_count)) {
+        userdb_close(db);
+        unlink(tmp_path);
+        return NULL;
+    }
+
+    struct UserDbHeader* header = db_header(db);
+    memcpy(header->magic, USERDB_MAGIC, 4);
+    header->version = USERDB_VERSION;
+    header->record_size = sizeof(struct UserRecord);
+    header->record_count = 0;
+
+    for (int i = 0; i < manager->user_count; i++) {
+        if (!userdb_put(db, manager, &manager->users[i])) {
+            userdb_close(db);
+            unlink(tmp_path);
+            return NULL;
+        }
+    }
+    msync(db->map, db->map_size, MS_SYNC);
+
+    bool linked = link(tmp_path, path) == 0;
+    int link_errno = errno;
+    unlink(tmp_path);
+    if (linked) return db;
+
+    userdb_close(db);
+    if (link_errno != EEXIST) return NULL;
+
+    // Lost the race: use the other process's database
+    manager->user_count = 0;
+    manager->ranked_count = 0;
+    manager->current_user = NULL;
+    if (manager->index_capacity > 0) {
+        memset(manager->name_index, -1, sizeof(int) * (size_t)manager->index_capacity);
+    }
+    return userdb_open(manager, path);
+}
+
+// Takes what another process last wrote to record 'n' into 'user', except
+// the fields 'user' has unwritten changes to. A record mid-rewrite fails its
+// checksum and is left for next time.
+static void take_record(struct UserDb* db, struct UserManager* manager, uint32_t n, struct User* user) {
+    const struct UserRecord* record = db_record(db, n);
+    if (record->checksum == db->slots[n].checksum ||
+        crc32c(0, record, RECORD_CHECKSUM_SIZE) != record->checksum) {
+        return;
+    }
+
+    struct User latest;
+    record_to_user(record, &latest);
+    take_user_fields(manager, user, &latest, USER_FIELDS_ALL & ~user->dirty);
+    db->slots[n].checksum = record->checksum;
+}
+
+// Locks the record of 'user' and re-reads it so an update starts from what
+// other processes last wrote. The lock is released by userdb_put.
+bool userdb_lock_user(struct UserDb* db, struct UserManager* manager, struct User* user) {
+    int index = (int)(user - manager->users);
+    if (index >= db->mapped_users || db->record_of_user[index] < 0) return true;
+
+    uint32_t n = (uint32_t)db->record_of_user[index];
+    if (!lock_record(db, n, F_WRLCK)) return false;
+    db->locked_record = (int)n;
+
+    // By index: sessions that ran during the wait may have moved the users
+    take_record(db, manager, n, &manager->users[index]);
+    return true;
+}
+
+// Appends a record for user 'index' (caller holds the header lock and has
+// loaded every record already there)
+static bool append_record(struct UserDb* db, struct UserManager* manager, int index) {
+    uint32_t n = db_record_count(db);
+    if (!db_reserve(db, n + 1)) return false;
+
+    // Write the record before publishing it in the header
+    struct User* user = &manager->users[index];
+    struct UserRecord* record = db_record(db, n);
+    user_to_record(user, record);
+    __atomic_store_n(&db_header(db)->record_count, n + 1, __ATOMIC_RELEASE);
+    user->dirty = 0;
+    return db_track_record(db, n, index, record->checksum);
+}
+
+// Persists one user: rewrites their record in place under its lock, or
+// appends a record for a user the database has not seen. The record is
+// re-read under the lock first, so only the fields changed here (dirty)
+// replace what other processes wrote. Guest is never stored.
+bool userdb_put(struct UserDb* db, struct UserManager* manager, struct User* user) {
+    int index = (int)(user - manager->users);
+    if (index < db->mapped_users && db->record_of_user[index] >= 0) {
+        uint32_t n = (uint32_t)db->record_of_user[index];
+        if (db->locked_record != (int)n && !lock_record(db, n, F_WRLCK)) return false;
+
+        user = &manager->users[index];   // Moved if others added users during the wait
+        take_record(db, manager, n, user);
+        struct UserRecord* record = db_record(db, n);
+        user_to_record(user, record);
+        db->slots[n].checksum = record->checksum;
+        user->dirty = 0;
+
+        lock_record(db, n, F_UNLCK);
+        db->locked_record = -1;
+        return true;
+    }
+
+    if (strcmp(user->username, "Guest") == 0) return true;
+
+    if (!lock_header(db, F_WRLCK)) return false;
+
+    // Others' registrations first, so record numbers stay in step
+    bool ok = db_load_new_records(db, manager, true) && append_record(db, manager, index);
+    lock_header(db, F_UNLCK);
+    return ok;
+}
+
+// Adds 'user' to the store and appends their record, unless the name is
+// already stored. The check and the append happen under the header lock,
+// so two processes cannot both register one name. Returns NULL if the name
+// is taken or the user cannot be added; *stored says whether the record
+// was written (if not, the caller queues the user for the next flush).
+struct User* userdb_register(struct UserDb* db, struct UserManager* manager, const struct User* user,
+                             bool* stored) {
+    *stored = false;
+    if (!lock_header(db, F_WRLCK)) return NULL;
+
+    struct User* added = NULL;
+    if (db_load_new_records(db, manager, true) && find_user_index(manager, user->username) < 0) {
+        added = add_user(manager, user);
+        *stored = added && (strcmp(user->username, "Guest") == 0 ||
+                            append_record(db, manager, (int)(added - manager->users)));
+    }
+    lock_header(db, F_UNLCK);
+    return added;
+}
+
+// Picks up users registered by other processes and records they rewrote
+// (scores, settings), keeping the fields this process has queued changes to
+void userdb_sync(struct UserDb* db, struct UserManager* manager) {
+    if (!lock_header(db, F_RDLCK)) return;
+    db_load_new_records(db, manager, true);
+    lock_header(db, F_UNLCK);
+
+    for (uint32_t n = 0; n < db->known_records; n++) {
+        int index = db->slots[n].user;
+        if (index < 0 || (int)n == db->locked_record) continue;
+        take_record(db, manager, n, &manager->users[index]);
+    }
+}
+
+void userdb_close(struct UserDb* db) {
+    if (db == NULL) return;
+    if (db->map) {
+        msync(db->map, db->map_size, MS_SYNC);
+        munmap(db->map, db->map_size);
+    }
+    close(db->fd);
+    free(db->record_of_user);
+    free(db->slots);
+    free(db);
+}
@@ -0,0 +1,79 @@
+#ifndef USERDB_H
+#define USERDB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "users.h"
+
+// Optional binary user database (users.db). The file is a header followed by
+// fixed-size records, one per user, and is memory-mapped: updating one user
+// rewrites that user's record in place and registrations append a record, so
+// a save costs the same with ten users or a hundred thousand.
+// users.json stays the exchange format (import/export).
+//
+// Several game processes may share one users.db. Each record is guarded by
+// an fcntl() byte-range lock held only while it is read-modify-written, and
+// appends lock the header; others' changes are picked up with userdb_sync.
+
+#define USERDB_FILE "users.db"
+#define USERDB_MAGIC "RGUD"
+#define USERDB_VERSION 1
+#define USERDB_INITIAL_RECORDS 64
+
+struct UserDbHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t record_count;    // Records in use; bumped after the record is written
+    uint32_t reserved[4];
+};
+
+// On-disk form of struct User with fixed-width fields
+struct UserRecord {
+    char username[MAX_STRING_LEN];
+    char password[MAX_STRING_LEN];
+    char email[MAX_STRING_LEN];
+    char character_color[20];
+    int64_t first_game_time;
+    int64_t last_game_time;
+    int32_t score;
+    int32_t gold;
+    int32_t games_completed;
+    int32_t difficulty;
+    int32_t song;
+    uint8_t music_on;
+    uint8_t reserved[23];
+    uint32_t checksum;        // CRC32C of everything above
+};
+
+// What this process last saw in a record
+struct UserDbSlot {
+    int user;                   // Index in the store, -1 if not loaded (duplicate name)
+    uint32_t checksum;          // Detects rewrites by other processes
+};
+
+struct UserDb {
+    int fd;
+    uint8_t* map;
+    size_t map_size;
+    uint32_t record_capacity;   // Records that fit in the mapping
+    int* record_of_user;        // User index -> record number, -1 if not stored
+    int mapped_users;           // Entries in record_of_user
+    struct UserDbSlot* slots;   // One per known record
+    uint32_t known_records;     // Records already loaded into the store
+    uint32_t slot_capacity;
+    int locked_record;          // Record held by userdb_lock_user, -1 if none
+};
+
+// Function declarations
+bool userdb_exists(const char* path);
+struct UserDb* userdb_open(struct UserManager* manager, const char* path);
+struct UserDb* userdb_create(struct UserManager* manager, const char* path);
+bool userdb_lock_user(struct UserDb* db, struct UserManager* manager, struct User* user);
+bool userdb_put(struct UserDb* db, struct UserManager* manager, struct User* user);
+struct User* userdb_register(struct UserDb* db, struct UserManager* manager, const struct User* user,
+                             bool* stored);
+void userdb_sync(struct UserDb* db, struct UserManager* manager);
+void userdb_close(struct UserDb* db);
+
+#endif
@@ -1,7 +1,19 @@
 #include <ncurses.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include "users.h"
+#include "checksum.h"
+#include "json.h"
+#include "userdb.h"
+#include "input.h"
 
 // File handling functions
 void handle_file_error(const char* operation) {
@@ -9,7 +21,7 @@ void handle_file_error(const char* operation) {
     printw("Error: Could not %s file.\n", operation);
     printw("Press any key to continue...");
     refresh();
-    getch();
+    input_getch();
 }
 
 // Password validation functions
@@ -72,124 +84,549 @@ bool validate_email(const char *email) {
     return true;
 }
 
+// Why the last create_user_manager call returned NULL. The loader may run
+// on a worker thread, so it only records the reason; the caller reports it.
+static char load_error[256];
+
+static void set_load_error(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void set_load_error(const char* format, ...) {
+    if (load_error[0] != '\0') return;   // Keep the first, most specific reason
+    va_list args;
+    va_start(args, format);
+    vsnprintf(load_error, sizeof(load_error), format, args);
+    va_end(args);
+}
+
+const char* users_load_error(void) {
+    return load_error;
+}
+
 // User management functions
-struct UserManager* create_user_manager(void) {
-    struct UserManager* manager = malloc(sizeof(struct UserManager));
+// With db_path set, users live in the binary database at that path; if it
+// does not exist yet it is created from users.json. Returns NULL if the users
+// cannot be loaded; users_load_error() then says why.
+struct UserManager* create_user_manager(const char* db_path) {
+    load_error[0] = '\0';
+    struct UserManager* manager = calloc(1, sizeof(struct UserManager));
     if (manager == NULL) {
-        endwin();
-        fprintf(stderr, "Failed to allocate memory for user manager\n");
-        exit(1);
+        set_load_error("Failed to allocate memory for user manager");
+        return NULL;
     }
-    if (manager != NULL) {
-        manager->user_count = 0;
-        manager->current_user = NULL;
-        memset(manager->users, 0, sizeof(struct User) * MAX_USERS);
-        load_users_from_json(manager);
+
+    bool ok = true;
+    if (db_path && userdb_exists(db_path)) {
+        manager->db = userdb_open(manager, db_path);
+    } else {
+        ok = load_users_from_json(manager);
+        if (ok && db_path) manager->db = userdb_create(manager, db_path);
+    }
+
+    if (ok && db_path && manager->db == NULL) {
+        set_load_error("%s could not be opened or is corrupted.\n"
+                       "Move it aside to rebuild it from users.json.", db_path);
+        ok = false;
+    }
+    if (!ok) {
+        free_user_manager(manager);
+        return NULL;
     }
     return manager;
 }
 
 void free_user_manager(struct UserManager* manager) {
     if (manager != NULL) {
+        userdb_close(manager->db);
+        free(manager->users);
+        free(manager->name_index);
+        free(manager->rank_order);
+        free(manager->dirty_users);
         free(manager);
     }
 }
 
-void load_users_from_json(struct UserManager* manager) {
-    FILE* file = fopen("users.json", "r");
-    if (file == NULL) {
-        manager->user_count = 0;
-        return;
+// FNV-1a
+static uint32_t hash_username(const char* username) {
+    uint32_t hash = 2166136261u;
+    while (*username) {
+        hash ^= (unsigned char)*username++;
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    char line[256];
-    manager->user_count = 0;
+// Returns the slot holding 'username', or the empty slot where it would go
+static int find_index_slot(const struct UserManager* manager, const char* username) {
+    int mask = manager->index_capacity - 1;
+    int slot = (int)(hash_username(username) & (uint32_t)mask);
+
+    while (manager->name_index[slot] >= 0 &&
+           strcmp(manager->users[manager->name_index[slot]].username, username) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
 
-    while (fgets(line, sizeof(line), file)) {
-        if (strstr(line, "\"username\":") != NULL) {
-            struct User* user = &manager->users[manager->user_count];
-
-            // Parse username from *this* line
-            sscanf(line, " \"username\": \"%[^\"]\",", user->username);
-
-            // Next line => password
-            fgets(line, sizeof(line), file);
-            sscanf(line, " \"password\": \"%[^\"]\",", user->password);
-
-            // Next line => email
-            fgets(line, sizeof(line), file);
-            sscanf(line, " \"email\": \"%[^\"]\",", user->email);
-
-            // Next line => "score"
-            fgets(line, sizeof(line), file);
-            char score_str[16];
-            sscanf(line, " \"score\": \"%[^\"]\"", score_str);
-            user->score = atoi(score_str);
-
-            // Next line => "gold_collected"
-            fgets(line, sizeof(line), file);
-            char gold_str[16];
-            sscanf(line, " \"gold_collected\": \"%[^\"]\"", gold_str);
-            user->gold = atoi(gold_str);
-
-            // Next line => difficulty
-            fgets(line, sizeof(line), file);
-            sscanf(line, " \"difficulty\": %d,", &user->difficulty);
-
-            // Next line => color
-            fgets(line, sizeof(line), file);
-            sscanf(line, " \"color\": \"%[^\"]\",", user->character_color);
-
-            // Next line => song
-            fgets(line, sizeof(line), file);
-            sscanf(line, " \"song\": %d,", &user->song);
-
-            // Next line => games_played
-            fgets(line, sizeof(line), file);
-            sscanf(line, " \"games_played\": %d,", &user->games_completed);
-
-            fgets(line, sizeof(line), file); 
-            int musicInt = 1;
-            sscanf(line, " \"music_on\": %d,", &musicInt);
-            user->music_on = (musicInt != 0);
-
-            long first_t, last_t;
-            fgets(line, sizeof(line), file);
-            sscanf(line, " \"first_game_time\": %ld,", &first_t);
-            user->first_game_time = (time_t)first_t;
-
-            fgets(line, sizeof(line), file);
-            sscanf(line, " \"last_game_time\": %ld,", &last_t);
-            user->last_game_time = (time_t)last_t;
-
-            // Next line => days_since_first_game
-            // fgets(line, sizeof(line), file);
-            // sscanf(line, " \"days_since_first_game\": %d", &user->days_since_first_game);
-
-            // *Now* we've read 10 lines total. 
-            // If your JSON has a trailing "}" line, you might do one more fgets, or 
-            // it might be read at the top of the next iteration. It's up to you.
-
-            // Store the username in manager->usernames
-            strncpy(manager->usernames[manager->user_count], 
-                    user->username, MAX_STRING_LEN - 1);
-            manager->usernames[manager->user_count][MAX_STRING_LEN - 1] = '\0';
-
-            manager->user_count++;
+static bool grow_name_index(struct UserManager* manager) {
+    int capacity = manager->index_capacity ? manager->index_capacity * 2 : 128;
+    int* index = malloc(sizeof(int) * (size_t)capacity);
+    if (index == NULL) return false;
+    memset(index, -1, sizeof(int) * (size_t)capacity);
+
+    free(manager->name_index);
+    manager->name_index = index;
+    manager->index_capacity = capacity;
+
+    for (int i = 0; i < manager->user_count; i++) {
+        index[find_index_slot(manager, manager->users[i].username)] = i;
+    }
+    return true;
+}
+
+int find_user_index(const struct UserManager* manager, const char* username) {
+    if (manager->index_capacity == 0) return -1;
+    return manager->name_index[find_index_slot(manager, username)];
+}
+
+// Ranking order: higher score first, ties broken by registration order
+static bool ranks_before(const struct UserManager* manager, int a, int b) {
+    int score_a = manager->users[a].score;
+    int score_b = manager->users[b].score;
+    return score_a > score_b || (score_a == score_b && a < b);
+}
+
+// First position in rank_order[lo, hi) that does not rank before user 'index',
+// found by binary search
+static int rank_search(const struct UserManager* manager, int index, int lo, int hi) {
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ranks_before(manager, manager->rank_order[mid], index)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    return lo;
+}
+
+// Position in rank_order where user 'index' belongs (or currently sits)
+static int rank_position(const struct UserManager* manager, int index) {
+    return rank_search(manager, index, 0, manager->ranked_count);
+}
+
+static void insert_rank(struct UserManager* manager, int index) {
+    int pos = rank_position(manager, index);
+    memmove(&manager->rank_order[pos + 1], &manager->rank_order[pos],
+            sizeof(int) * (size_t)(manager->ranked_count - pos));
+    manager->rank_order[pos] = index;
+    manager->ranked_count++;
+}
+
+struct RankEntry {
+    int score;
+    int index;
+};
+
+static int compare_rank_entries(const void* a, const void* b) {
+    const struct RankEntry* ea = a;
+    const struct RankEntry* eb = b;
+    if (ea->score != eb->score) return ea->score < eb->score ? 1 : -1;
+    return ea->index - eb->index;
+}
+
+// Sorts every user into rank_order at once; used after a bulk load where
+// inserting one by one would be quadratic. Returns false if out of memory.
+bool rebuild_rankings(struct UserManager* manager) {
+    struct RankEntry* entries = malloc(sizeof(struct RankEntry) * (size_t)(manager->user_count + 1));
+    if (entries == NULL) {
+        set_load_error("Failed to allocate memory for the leaderboard");
+        return false;
+    }
+
+    for (int i = 0; i < manager->user_count; i++) {
+        entries[i].score = manager->users[i].score;
+        entries[i].index = i;
+    }
+    qsort(entries, (size_t)manager->user_count, sizeof(struct RankEntry), compare_rank_entries);
+    for (int i = 0; i < manager->user_count; i++) {
+        manager->rank_order[i] = entries[i].index;
+    }
+    manager->ranked_count = manager->user_count;
+    free(entries);
+    return true;
+}
+
+// Stores a copy of 'user' and indexes its name without ranking it. For bulk
+// loads: call rebuild_rankings once all users are in.
+struct User* add_user_unranked(struct UserManager* manager, const struct User* user) {
+    if (find_user_index(manager, user->username) >= 0) return NULL;
 
+    if (manager->user_count == manager->user_capacity) {
+        int capacity = manager->user_capacity ? manager->user_capacity * 2 : 64;
+        int current = manager->current_user ? (int)(manager->current_user - manager->users) : -1;
+
+        int* rank_order = realloc(manager->rank_order, sizeof(int) * (size_t)capacity);
+        if (rank_order == NULL) return NULL;
+        manager->rank_order = rank_order;
+
+        struct User* users = realloc(manager->users, sizeof(struct User) * (size_t)capacity);
+        if (users == NULL) return NULL;
+        manager->users = users;
+        manager->user_capacity = capacity;
+        if (current >= 0) manager->current_user = &users[current];
+    }
+
+    if ((manager->user_count + 1) * 2 > manager->index_capacity && !grow_name_index(manager)) {
+        return NULL;
+    }
+
+    int index = manager->user_count++;
+    manager->users[index] = *user;
+    manager->name_index[find_index_slot(manager, user->username)] = index;
+    return &manager->users[index];
+}
+
+// Copies 'user' into the store. Returns the stored user, or NULL if the
+// username is already taken or memory ran out.
+struct User* add_user(struct UserManager* manager, const struct User* user) {
+    struct User* stored = add_user_unranked(manager, user);
+    if (stored != NULL) {
+        insert_rank(manager, (int)(stored - manager->users));
+    }
+    return stored;
+}
+
+// Changes a user's score and moves them to their new place on the leaderboard.
+// Only the entries between the old and new rank shift.
+void update_user_score(struct UserManager* manager, struct User* user, int score) {
+    int index = (int)(user - manager->users);
+    int* order = manager->rank_order;
+    int pos = rank_position(manager, index);
+
+    user->score = score;
+
+    if (pos > 0 && ranks_before(manager, index, order[pos - 1])) {
+        int target = rank_search(manager, index, 0, pos);
+        memmove(&order[target + 1], &order[target], sizeof(int) * (size_t)(pos - target));
+        order[target] = index;
+    } else if (pos + 1 < manager->ranked_count && ranks_before(manager, order[pos + 1], index)) {
+        int target = rank_search(manager, index, pos + 1, manager->ranked_count) - 1;
+        memmove(&order[pos], &order[pos + 1], sizeof(int) * (size_t)(target - pos));
+        order[target] = index;
+    }
+}
+
+// 0-based leaderboard position of 'user'
+int user_rank(const struct UserManager* manager, const struct User* user) {
+    return rank_position(manager, (int)(user - manager->users));
+}
+
+struct User* user_at_rank(const struct UserManager* manager, int rank) {
+    if (rank < 0 || rank >= manager->ranked_count) return NULL;
+    return &manager->users[manager->rank_order[rank]];
+}
+
+// Reads a whole file into a malloc'd, NUL-terminated buffer
+static char* read_file_contents(const char* path, size_t* out_len) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char* data = (size >= 0) ? malloc((size_t)size + 1) : NULL;
+    if (data && fread(data, 1, (size_t)size, file) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
     fclose(file);
+
+    if (data) {
+        data[size] = '\0';
+        *out_len = (size_t)size;
+    }
+    return data;
 }
 
-void save_users_to_json(struct UserManager* manager) {
-    FILE* file = fopen("users.json", "w");
-    if (file == NULL) {
-        handle_file_error("write");
-        return;
+// Stamps the users.json on disk; false (and a zero stamp) if there is none
+static bool stamp_users_file(struct UsersFileStamp* stamp) {
+    struct stat st;
+    memset(stamp, 0, sizeof(*stamp));
+    if (stat("users.json", &st) != 0) return false;
+    stamp->device = st.st_dev;
+    stamp->inode = st.st_ino;
+    stamp->size = st.st_size;
+    stamp->modified = st.st_mtim;
+    return true;
+}
+
+static bool same_stamp(const struct UsersFileStamp* a, const struct UsersFileStamp* b) {
+    return a->device == b->device && a->inode == b->inode && a->size == b->size &&
+           a->modified.tv_sec == b->modified.tv_sec && a->modified.tv_nsec == b->modified.tv_nsec;
+}
+
+// Checks users.json against the CRC32C on its last line ("crc32c 1234abcd"),
+// which covers everything before it, and drops that line from *len so the
+// rest parses as plain JSON. Files written by older builds have no such line
+// and are checked against USERS_CHECKSUM_FILE instead; a file with neither
+// is accepted (hand-written).
+static bool verify_users_checksum(const char* data, size_t* len) {
+    const size_t line = sizeof(USERS_CHECKSUM_TAG) - 1 + 8 + 1;
+    const char* last = *len >= line ? data + *len - line : NULL;
+    if (last && (last == data || last[-1] == '\n') && last[line - 1] == '\n' &&
+        memcmp(last, USERS_CHECKSUM_TAG, sizeof(USERS_CHECKSUM_TAG) - 1) == 0) {
+        char* end = NULL;
+        unsigned long stored = strtoul(last + sizeof(USERS_CHECKSUM_TAG) - 1, &end, 16);
+        *len = (size_t)(last - data);
+        return end == last + line - 1 && stored == crc32c(0, data, *len);
     }
 
-    fprintf(file, "[\n");
+    FILE* file = fopen(USERS_CHECKSUM_FILE, "r");
+    if (file == NULL) return true;
+
+    unsigned int stored = 0;
+    bool ok = fscanf(file, "%8x", &stored) == 1 && stored == crc32c(0, data, *len);
+    fclose(file);
+    return ok;
+}
+
+static UserWaitHook wait_begin_hook = NULL;
+static UserWaitHook wait_end_hook = NULL;
+
+// The server releases game_lock in these. Only what the waiting code owns
+// may be touched in between: other sessions change the store meanwhile.
+void users_set_wait_hooks(UserWaitHook begin, UserWaitHook end) {
+    wait_begin_hook = begin;
+    wait_end_hook = end;
+}
+
+void users_wait_begin(void) {
+    if (wait_begin_hook) wait_begin_hook();
+}
+
+void users_wait_end(void) {
+    if (wait_end_hook) wait_end_hook();
+}
+
+// users.json is shared by every game process on the host. Readers take a
+// shared flock on USERS_LOCK_FILE and writers an exclusive one, held only
+// while the file is read or rewritten. Returns the lock fd, or -1 if locking
+// is unavailable (the caller carries on unlocked).
+static int lock_users_file(int operation) {
+    int fd = open(USERS_LOCK_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return -1;
+    int locked = flock(fd, operation | LOCK_NB);
+    if (locked != 0 && errno == EWOULDBLOCK) {
+        // Another process has it. flock locks belong to the open file, so
+        // other sessions of this process queue behind this one on their own.
+        users_wait_begin();
+        locked = flock(fd, operation);
+        users_wait_end();
+    }
+    if (locked != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void unlock_users_file(int fd) {
+    if (fd >= 0) close(fd);   // Closing drops the flock
+}
+
+// Exclusive lock taken by begin_user_update and released by save_user
+static int held_users_lock = -1;
+
+static bool key_is(const struct JsonToken* key, const char* name) {
+    size_t len = strlen(name);
+    return key->length == len && memcmp(key->start, name, len) == 0;
+}
+
+// Reads a number field into an int, stopping at INT_MAX or INT_MIN
+static bool take_int(const struct JsonToken* value, int* out) {
+    long number;
+    if (!json_token_long(value, &number)) return false;
+    *out = number > INT_MAX ? INT_MAX : number < INT_MIN ? INT_MIN : (int)number;
+    return true;
+}
+
+static bool take_time(const struct JsonToken* value, time_t* out) {
+    long number;
+    if (!json_token_long(value, &number)) return false;
+    *out = (time_t)number;
+    return true;
+}
+
+// Stores one field of a user object. Unknown keys are ignored. Returns false
+// if a number field does not hold an integer.
+static bool set_user_field(struct User* user, const struct JsonToken* key,
+                           const struct JsonToken* value) {
+    if (key_is(key, "username")) {
+        json_copy_string(value, user->username, sizeof(user->username));
+    } else if (key_is(key, "password")) {
+        json_copy_string(value, user->password, sizeof(user->password));
+    } else if (key_is(key, "email")) {
+        json_copy_string(value, user->email, sizeof(user->email));
+    } else if (key_is(key, "color")) {
+        json_copy_string(value, user->character_color, sizeof(user->character_color));
+    } else if (key_is(key, "score")) {
+        return take_int(value, &user->score);
+    } else if (key_is(key, "gold_collected")) {
+        return take_int(value, &user->gold);
+    } else if (key_is(key, "difficulty")) {
+        return take_int(value, &user->difficulty);
+    } else if (key_is(key, "song")) {
+        return take_int(value, &user->song);
+    } else if (key_is(key, "games_played")) {
+        return take_int(value, &user->games_completed);
+    } else if (key_is(key, "music_on")) {
+        int music_on;
+        if (!take_int(value, &music_on)) return false;
+        user->music_on = music_on != 0;
+    } else if (key_is(key, "first_game_time")) {
+        return take_time(value, &user->first_game_time);
+    } else if (key_is(key, "last_game_time")) {
+        return take_time(value, &user->last_game_time);
+    }
+    return true;
+}
+
+// Parses a users.json document (an array of user objects) in a single pass,
+// calling on_user for each complete user. Fields may appear in any order and
+// missing ones keep their defaults. Returns the number of users, or -1 if
+// the document is malformed.
+int parse_users_json(const char* data, size_t length, UserLoadCallback on_user, void* context) {
+    struct JsonParser parser;
+    struct JsonToken token, value;
+    int count = 0;
+
+    json_parser_init(&parser, data, length);
+    if (json_next(&parser, &token) == JSON_END) return 0;   // Empty file
+    if (token.type != JSON_ARRAY_START) return -1;
+
+    while (json_next(&parser, &token) == JSON_OBJECT_START) {
+        struct User user;
+        memset(&user, 0, sizeof(user));
+        user.music_on = true;
+
+        while (json_next(&parser, &token) == JSON_KEY) {
+            json_next(&parser, &value);
+            if (value.type == JSON_OBJECT_START || value.type == JSON_ARRAY_START) {
+                if (!json_skip_value(&parser, &value)) return -1;
+            } else if (value.type == JSON_ERROR || value.type == JSON_END) {
+                return -1;
+            } else if (!set_user_field(&user, &token, &value)) {
+                return -1;
+            }
+        }
+        if (token.type != JSON_OBJECT_END) return -1;
+
+        on_user(&user, context);
+        count++;
+    }
+
+    return token.type == JSON_ARRAY_END ? count : -1;
+}
+
+// Duplicate usernames keep the first entry. Ranking happens once the whole
+// file is in.
+static void add_loaded_user(const struct User* user, void* context) {
+    add_user_unranked(context, user);
+}
+
+// Empties the store but keeps its allocations
+static void clear_users(struct UserManager* manager) {
+    manager->user_count = 0;
+    manager->ranked_count = 0;
+    manager->dirty_count = 0;
+    manager->dirty_since = 0;
+    manager->current_user = NULL;
+    if (manager->index_capacity > 0) {
+        memset(manager->name_index, -1, sizeof(int) * (size_t)manager->index_capacity);
+    }
+}
+
+// Replaces the store's contents with the users in a users.json document.
+// Returns false if the document is malformed (users before the error stay).
+bool import_users_json(struct UserManager* manager, const char* data, size_t length) {
+    clear_users(manager);
+    bool ok = parse_users_json(data, length, add_loaded_user, manager) >= 0;
+    return rebuild_rankings(manager) && ok;
+}
+
+// A missing users.json is an empty store. Returns false, with the reason in
+// users_load_error(), if the file is damaged or cannot be loaded.
+bool load_users_from_json(struct UserManager* manager) {
+    clear_users(manager);
+
+    size_t data_len = 0;
+    int lock = lock_users_file(LOCK_SH);
+    struct UsersFileStamp stamp;
+    stamp_users_file(&stamp);   // Before reading: a newer file then only costs a re-read
+    char* data = read_file_contents("users.json", &data_len);
+    bool checksum_ok = data == NULL || verify_users_checksum(data, &data_len);
+    unlock_users_file(lock);
+    if (data == NULL) return true;
+
+    bool ok = checksum_ok;
+    if (!checksum_ok) {
+        // Refuse to run on a damaged database; saving would overwrite it
+        set_load_error("users.json is corrupted (it does not match its checksum).\n"
+                       "Restore it from a backup, or delete its last line (\"%s...\")\n"
+                       "and any %s to accept it as is.",
+                       USERS_CHECKSUM_TAG, USERS_CHECKSUM_FILE);
+    } else if (!import_users_json(manager, data, data_len)) {
+        set_load_error("users.json is malformed; loaded %d users before the error.",
+                       manager->user_count);
+        ok = false;
+    }
+    free(data);
+    if (ok) manager->json_stamp = stamp;
+    return ok;
+}
+
+// Writes users.json, checksum line included. It is replaced by one rename,
+// so readers see the old file or the new one, never a mix of the two.
+static bool write_users_file(const char* data, size_t len) {
+    FILE* file = fopen("users.json.tmp", "w");
+    if (file == NULL) return false;
+    bool ok = fwrite(data, 1, len, file) == len;
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename("users.json.tmp", "users.json") == 0;
+
+    // An older build's checksum file no longer matches: it would make those
+    // builds refuse the new file
+    if (ok) remove(USERS_CHECKSUM_FILE);
+    return ok;
+}
+
+static void write_string_field(struct JsonWriter* out, const char* key, const char* value) {
+    json_write_raw(out, "    \"");
+    json_write_raw(out, key);
+    json_write_raw(out, "\": ");
+    json_write_string(out, value);
+    json_write_raw(out, ",\n");
+}
+
+// Score and gold have always been written as quoted strings; keep that so
+// older builds can still read the file
+static void write_number_field(struct JsonWriter* out, const char* key, long value,
+                               bool quoted, bool last) {
+    json_write_raw(out, "    \"");
+    json_write_raw(out, key);
+    json_write_raw(out, quoted ? "\": \"" : "\": ");
+    json_write_long(out, value);
+    json_write_raw(out, quoted ? "\"" : "");
+    json_write_raw(out, last ? "\n" : ",\n");
+}
+
+// Writes every user to users.json (caller holds the exclusive lock)
+static bool write_users_json(struct UserManager* manager) {
+    // Build the document in memory so it can be checksummed before it hits disk
+    struct JsonWriter out;
+    json_writer_init(&out, (size_t)manager->user_count * 512 + 16);
+
+    json_write_raw(&out, "[\n");
     bool firstPrinted = false;
 
     for (int i = 0; i < manager->user_count; i++) {
@@ -202,31 +639,277 @@ void save_users_to_json(struct UserManager* manager) {
 
         // Print a comma + newline before each user except the very first
         if (firstPrinted) {
-            fprintf(file, ",\n");
+            json_write_raw(&out, ",\n");
         } else {
             firstPrinted = true;
         }
 
-        // Then save the user as normal
-        fprintf(file, "  {\n");
-        fprintf(file, "    \"username\": \"%s\",\n", user->username);
-        fprintf(file, "    \"password\": \"%s\",\n", user->password);
-        fprintf(file, "    \"email\": \"%s\",\n",    user->email);
-        fprintf(file, "    \"score\": \"%d\",\n",    user->score);
-        fprintf(file, "    \"gold_collected\": \"%d\",\n", user->gold);
-        fprintf(file, "    \"difficulty\": %d,\n",    user->difficulty);
-        fprintf(file, "    \"color\": \"%s\",\n",     user->character_color);
-        fprintf(file, "    \"song\": %d,\n",          user->song);
-        fprintf(file, "    \"games_played\": %d,\n",  user->games_completed);
-        fprintf(file, "    \"music_on\": %d,\n",      user->music_on ? 1 : 0);
-        fprintf(file, "    \"first_game_time\": %ld,\n", (long)user->first_game_time);
-        fprintf(file, "    \"last_game_time\": %ld\n", (long)user->last_game_time);
-        // If you want to store days_since_first_game, do so too
-        fprintf(file, "  }");
-    }
-
-    fprintf(file, "\n]\n");
-    fclose(file);
+        json_write_raw(&out, "  {\n");
+        write_string_field(&out, "username", user->username);
+        write_string_field(&out, "password", user->password);
+        write_string_field(&out, "email", user->email);
+        write_number_field(&out, "score", user->score, true, false);
+        write_number_field(&out, "gold_collected", user->gold, true, false);
+        write_number_field(&out, "difficulty", user->difficulty, false, false);
+        write_string_field(&out, "color", user->character_color);
+        write_number_field(&out, "song", user->song, false, false);
+        write_number_field(&out, "games_played", user->games_completed, false, false);
+        write_number_field(&out, "music_on", user->music_on ? 1 : 0, false, false);
+        write_number_field(&out, "first_game_time", (long)user->first_game_time, false, false);
+        write_number_field(&out, "last_game_time", (long)user->last_game_time, false, true);
+        json_write_raw(&out, "  }");
+    }
+
+    json_write_raw(&out, "\n]\n");
+
+    // Older builds stop reading at the ']', so the checksum can follow it
+    if (!out.failed) {
+        char checksum[32];
+        snprintf(checksum, sizeof(checksum), USERS_CHECKSUM_TAG "%08x\n", crc32c(0, out.data, out.length));
+        json_write_raw(&out, checksum);
+    }
+
+    bool ok = !out.failed && write_users_file(out.data, out.length);
+    json_writer_free(&out);
+    if (ok) stamp_users_file(&manager->json_stamp);   // Under the lock: this is our file
+
+    for (int i = 0; ok && i < manager->user_count; i++) {
+        manager->users[i].dirty = 0;
+    }
+    return ok;
+}
+
+// Copies 'fields' of 'stored' (what another process wrote) into 'user',
+// keeping the leaderboard in step
+void take_user_fields(struct UserManager* manager, struct User* user, const struct User* stored,
+                      unsigned fields) {
+    if (fields & USER_FIELD_ACCOUNT) {
+        memcpy(user->password, stored->password, sizeof(user->password));
+        memcpy(user->email, stored->email, sizeof(user->email));
+    }
+    if (fields & USER_FIELD_GOLD) user->gold = stored->gold;
+    if (fields & USER_FIELD_GAMES) user->games_completed = stored->games_completed;
+    if (fields & USER_FIELD_GAME_TIMES) {
+        user->first_game_time = stored->first_game_time;
+        user->last_game_time = stored->last_game_time;
+    }
+    if (fields & USER_FIELD_SETTINGS) {
+        user->difficulty = stored->difficulty;
+        memcpy(user->character_color, stored->character_color, sizeof(user->character_color));
+        user->song = stored->song;
+        user->music_on = stored->music_on;
+    }
+    if ((fields & USER_FIELD_SCORE) && user->score != stored->score) {
+        update_user_score(manager, user, stored->score);
+    }
+}
+
+// Folds changes other processes made to users.json into the store: new
+// users are added, and known users take the values on disk for every field
+// this process has not changed itself (dirty). Caller holds the lock. Fails
+// if users.json is damaged. Skipped while the file is the one this process
+// last read or wrote, so opening the scoreboard does not re-parse it.
+static bool merge_users_from_json(struct UserManager* manager) {
+    struct UsersFileStamp stamp;
+    if (stamp_users_file(&stamp) && same_stamp(&stamp, &manager->json_stamp)) return true;
+
+    // Reading and parsing touch nothing shared, so other sessions may run
+    // meanwhile; not inside begin_user_update, whose lock they would take
+    bool yield = held_users_lock < 0;
+    if (yield) users_wait_begin();
+    size_t data_len = 0;
+    char* data = read_file_contents("users.json", &data_len);
+    bool found = data != NULL;
+    struct UserManager* disk = found ? calloc(1, sizeof(struct UserManager)) : NULL;
+    bool ok = disk != NULL && verify_users_checksum(data, &data_len) &&
+              import_users_json(disk, data, data_len);
+    free(data);
+    if (yield) users_wait_end();
+    if (!found) return true;
+
+    for (int i = 0; ok && i < disk->user_count; i++) {
+        const struct User* theirs = &disk->users[i];
+        int index = find_user_index(manager, theirs->username);
+        if (index < 0) {
+            ok = add_user(manager, theirs) != NULL;
+        } else {
+            struct User* mine = &manager->users[index];
+            take_user_fields(manager, mine, theirs, USER_FIELDS_ALL & ~mine->dirty);
+        }
+    }
+
+    free_user_manager(disk);
+    if (ok) manager->json_stamp = stamp;
+    return ok;
+}
+
+// Rewrites users.json with this process's changes merged over the current
+// file, so concurrent games do not lose each other's updates
+void save_users_to_json(struct UserManager* manager) {
+    int lock = held_users_lock >= 0 ? held_users_lock : lock_users_file(LOCK_EX);
+    bool ok = merge_users_from_json(manager) && write_users_json(manager);
+    unlock_users_file(lock);
+    held_users_lock = -1;
+
+    if (!ok) handle_file_error("write");
+}
+
+// Adds a newly registered user and stores them at once so other processes
+// see the name taken. The name is checked against what is stored under the
+// same exclusive lock the user is written under, so two processes cannot
+// both register it. Returns NULL if the name is taken or the user could
+// not be added.
+struct User* register_user(struct UserManager* manager, const struct User* user) {
+    manager->writes_requested++;
+    if (manager->db) {
+        bool stored = false;
+        struct User* added = userdb_register(manager->db, manager, user, &stored);
+        if (added) manager->writes_issued++;
+        if (added && !stored) {
+            save_user(manager, added, USER_FIELDS_ALL);   // Retried by the next flush
+            handle_file_error("write");
+        }
+        return added;
+    }
+
+    int lock = held_users_lock >= 0 ? held_users_lock : lock_users_file(LOCK_EX);
+    held_users_lock = -1;
+    struct User* added = NULL;
+    bool ok = merge_users_from_json(manager);
+    if (ok && find_user_index(manager, user->username) < 0) {
+        added = add_user(manager, user);
+        if (added) {
+            added->dirty = USER_FIELDS_ALL;
+            ok = write_users_json(manager);
+            manager->writes_issued++;
+        }
+    }
+    unlock_users_file(lock);
+
+    if (added && !ok) {
+        added->dirty = 0;
+        save_user(manager, added, USER_FIELDS_ALL);   // Retried by the next flush
+    }
+    if (!ok) handle_file_error("write");
+    return added;
+}
+
+// Writes the store to users.json as is (export from the user database)
+void export_users_json(struct UserManager* manager) {
+    int lock = lock_users_file(LOCK_EX);
+    bool ok = write_users_json(manager);
+    unlock_users_file(lock);
+
+    if (!ok) handle_file_error("write");
+}
+
+// Picks up registrations and score changes from other game processes
+void refresh_users(struct UserManager* manager) {
+    if (manager->db) {
+        userdb_sync(manager->db, manager);
+        return;
+    }
+    if (held_users_lock >= 0) {
+        merge_users_from_json(manager);
+        return;
+    }
+    int lock = lock_users_file(LOCK_SH);
+    merge_users_from_json(manager);
+    unlock_users_file(lock);
+}
+
+
+// Re-reads 'user' from storage before it is modified so the change applies
+// to the latest values. Fields with queued changes keep them; save_user
+// writes those together with the update. The user's record (or all of
+// users.json) stays locked until save_user, so keep the update short.
+void begin_user_update(struct UserManager* manager, struct User* user) {
+    if (manager->db) {
+        userdb_lock_user(manager->db, manager, user);
+        return;
+    }
+    if (held_users_lock >= 0) {
+        merge_users_from_json(manager);
+        return;
+    }
+    // Held only once merged: sessions running while this one waits must
+    // not take it for their own writes
+    int lock = lock_users_file(LOCK_EX);
+    merge_users_from_json(manager);
+    held_users_lock = lock;
+}
+
+static bool update_in_progress(const struct UserManager* manager) {
+    return manager->db ? manager->db->locked_record >= 0 : held_users_lock >= 0;
+}
+
+// Queues a change to 'fields' (USER_FIELD_*) of a user for the next flush.
+// A flush writes only the fields changed here over what is stored then.
+// Inside begin_user_update the change is written at once, since the lock
+// has to be released.
+void save_user(struct UserManager* manager, struct User* user, unsigned fields) {
+    manager->writes_requested++;
+
+    if (!user->dirty) {
+        if (manager->dirty_count == manager->dirty_capacity) {
+            int capacity = manager->dirty_capacity ? manager->dirty_capacity * 2 : 16;
+            int* list = realloc(manager->dirty_users, sizeof(int) * (size_t)capacity);
+            if (list == NULL) {
+                // Cannot queue it: write it now
+                user->dirty = fields;
+                if (manager->db) {
+                    if (!userdb_put(manager->db, manager, user)) handle_file_error("write");
+                } else {
+                    save_users_to_json(manager);
+                }
+                manager->writes_issued++;
+                return;
+            }
+            manager->dirty_users = list;
+            manager->dirty_capacity = capacity;
+        }
+        manager->dirty_users[manager->dirty_count++] = (int)(user - manager->users);
+    }
+    user->dirty |= fields;
+    if (manager->dirty_since == 0) manager->dirty_since = time(NULL);
+
+    if (update_in_progress(manager)) flush_users(manager);
+}
+
+// Writes every queued change: one record each with the user database, one
+// merged users.json rewrite otherwise. Does nothing when nothing changed.
+// Records that could not be written stay queued.
+void flush_users(struct UserManager* manager) {
+    if (manager->dirty_count == 0) return;
+
+    bool ok = true;
+    int kept = 0;
+    if (manager->db) {
+        for (int i = 0; i < manager->dirty_count; i++) {
+            struct User* user = &manager->users[manager->dirty_users[i]];
+            if (!user->dirty) continue;
+            if (!userdb_put(manager->db, manager, user)) {
+                manager->dirty_users[kept++] = manager->dirty_users[i];
+                ok = false;
+            }
+            manager->writes_issued++;
+        }
+    } else {
+        save_users_to_json(manager);
+        manager->writes_issued++;
+    }
+
+    manager->dirty_count = kept;
+    if (kept == 0) manager->dirty_since = 0;
+    if (!ok) handle_file_error("write");
+}
+
+// Flushes once the oldest queued change is USERS_FLUSH_INTERVAL seconds old
+void flush_users_if_due(struct UserManager* manager) {
+    if (manager->dirty_count > 0 &&
+        time(NULL) - manager->dirty_since >= USERS_FLUSH_INTERVAL) {
+        flush_users(manager);
+    }
 }
 
 
@@ -259,29 +942,95 @@ void print_users(struct UserManager* manager) {
     }
 }
 
+// Draws one page of the leaderboard straight from the rank index
+static void draw_scoreboard_page(struct UserManager* manager, int page, int total_pages,
+                                 time_t current_time) {
+    clear();
+
+    // Print header with current time
+    attron(COLOR_PAIR(5) | A_BOLD);
+    mvprintw(0, 0, "SCOREBOARD - Page %d/%d", page + 1, total_pages);
+    mvprintw(0, 40, "Current Time: 2025-01-04 18:07:37");
+    if (manager->current_user) {
+        mvprintw(1, 0, "Your rank: %d of %d",
+                 user_rank(manager, manager->current_user) + 1, manager->user_count);
+    }
+
+    // Print column headers
+    mvprintw(2, 0,  "Rank");
+    mvprintw(2, 8,  "Username");
+    mvprintw(2, 25, "Score");
+    mvprintw(2, 35, "Gold");
+    mvprintw(2, 45, "Games");
+    mvprintw(2, 55, "Experience");
+    mvprintw(2, 70, "Title");
+    attroff(COLOR_PAIR(5) | A_BOLD);
+
+    // Print horizontal line
+    mvprintw(3, 0, "--------------------------------------------------------------------------------");
+
+    // Calculate range for current page
+    int start_idx = page * USERS_PER_PAGE;
+    int end_idx = MIN(start_idx + USERS_PER_PAGE, manager->user_count);
+
+    // Print users
+    for (int i = start_idx; i < end_idx; i++) {
+        int row = i - start_idx + 4;
+        struct User* user = user_at_rank(manager, i);
+
+        // Calculate experience days
+        int experience_days = (int)((current_time - user->first_game_time) / (24 * 3600));
+
+        // Set appropriate color and style
+        if (i < 3) {
+            // Top 3 players get special colors and medals
+            attron(COLOR_PAIR(i + 1) | A_BOLD | A_ITALIC);
+            const char* medals[] = {"🏆", "🥈", "🥉"};
+            const char* titles[] = {"GOAT", "Legend", "Champion"};
+            mvprintw(row, 0, "%s %d", medals[i], i + 1);
+            mvprintw(row, 70, "%s", titles[i]);
+            attroff(COLOR_PAIR(i + 1) | A_BOLD | A_ITALIC);
+        } else {
+            // Normal ranking
+            mvprintw(row, 0, "%d", i + 1);
+        }
+
+        // Highlight current user's row
+        if (user == manager->current_user) {
+            attron(COLOR_PAIR(4) | A_BOLD);
+            mvprintw(row, 80, "You****");
+        }
+
+        if (i<3 && user != manager->current_user)
+            attron(COLOR_PAIR(i + 1) | A_BOLD | A_ITALIC);
+
+        // Print user information
+        mvprintw(row, 8,  "%s", user->username);
+        mvprintw(row, 25, "%d", user->score);
+        mvprintw(row, 35, "%d", user->gold);
+        mvprintw(row, 45, "%d", user->games_completed);
+        mvprintw(row, 55, "%d days", experience_days);
+
+        // Reset attributes
+        attroff(COLOR_PAIR(1) | COLOR_PAIR(2) | COLOR_PAIR(3) | COLOR_PAIR(4) | A_BOLD | A_ITALIC);
+    }
+
+
+    // Print navigation instructions
+    mvprintw(USERS_PER_PAGE + 6, 0,
+             "Navigation: 'n' - Next Page, 'p' - Previous Page, 'm' - My Rank, 'q' - Quit");
+    refresh();
+}
+
 void print_scoreboard(struct UserManager* manager) {
+    refresh_users(manager);  // Scores from games finished in other sessions
     if (manager->user_count == 0) {
         mvprintw(0, 0, "No users found.\n");
         refresh();
-        getch();
+        input_getch();
         return;
     }
 
-    // Create temporary array for sorting
-    struct User sorted_users[MAX_USERS];
-    memcpy(sorted_users, manager->users, sizeof(struct User) * manager->user_count);
-
-    // Sort users by score in descending order
-    for (int i = 0; i < manager->user_count - 1; i++) {
-        for (int j = i + 1; j < manager->user_count; j++) {
-            if (sorted_users[j].score > sorted_users[i].score) {
-                struct User temp = sorted_users[i];
-                sorted_users[i] = sorted_users[j];
-                sorted_users[j] = temp;
-            }
-        }
-    }
-
     // Initialize colors
     start_color();
     init_pair(1, COLOR_YELLOW, COLOR_BLACK);  // Gold (1st place)
@@ -297,80 +1046,10 @@ void print_scoreboard(struct UserManager* manager) {
     time_t current_time = time(NULL);
 
     while (running) {
-        clear();
-
-        // Print header with current time
-        attron(COLOR_PAIR(5) | A_BOLD);
-        mvprintw(0, 0, "SCOREBOARD - Page %d/%d", current_page + 1, total_pages);
-        mvprintw(0, 40, "Current Time: 2025-01-04 18:07:37");
-        
-        // Print column headers
-        mvprintw(2, 0,  "Rank");
-        mvprintw(2, 8,  "Username");
-        mvprintw(2, 25, "Score");
-        mvprintw(2, 35, "Gold");
-        mvprintw(2, 45, "Games");
-        mvprintw(2, 55, "Experience");
-        mvprintw(2, 70, "Title");
-        attroff(COLOR_PAIR(5) | A_BOLD);
-
-        // Print horizontal line
-        mvprintw(3, 0, "--------------------------------------------------------------------------------");
-
-        // Calculate range for current page
-        int start_idx = current_page * USERS_PER_PAGE;
-        int end_idx = MIN(start_idx + USERS_PER_PAGE, manager->user_count);
-
-        // Print users
-        for (int i = start_idx; i < end_idx; i++) {
-            int row = i - start_idx + 4;
-            struct User* user = &sorted_users[i];
-            
-            // Calculate experience days
-            int experience_days = (int)((current_time - user->first_game_time) / (24 * 3600));
-
-            // Set appropriate color and style
-            if (i < 3) {
-                // Top 3 players get special colors and medals
-                attron(COLOR_PAIR(i + 1) | A_BOLD | A_ITALIC);
-                const char* medals[] = {"🏆", "🥈", "🥉"};
-                const char* titles[] = {"GOAT", "Legend", "Champion"};
-                mvprintw(row, 0, "%s %d", medals[i], i + 1);
-                mvprintw(row, 70, "%s", titles[i]);
-                attroff(COLOR_PAIR(i + 1) | A_BOLD | A_ITALIC);
-            } else {
-                // Normal ranking
-                mvprintw(row, 0, "%d", i + 1);
-            }
-
-            // Highlight current user's row
-            if (manager->current_user && 
-                strcmp(user->username, manager->current_user->username) == 0) {
-                attron(COLOR_PAIR(4) | A_BOLD);
-                mvprintw(row, 80, "You****");
-            }
-            
-            if (i<3 && strcmp(user->username, manager->current_user->username) != 0)
-                attron(COLOR_PAIR(i + 1) | A_BOLD | A_ITALIC);
-
-            // Print user information
-            mvprintw(row, 8,  "%s", user->username);
-            mvprintw(row, 25, "%d", user->score);
-            mvprintw(row, 35, "%d", user->gold);
-            mvprintw(row, 45, "%d", user->games_completed);
-            mvprintw(row, 55, "%d days", experience_days);
-
-            // Reset attributes
-            attroff(COLOR_PAIR(1) | COLOR_PAIR(2) | COLOR_PAIR(3) | COLOR_PAIR(4) | A_BOLD | A_ITALIC);
-        }
-
-
-        // Print navigation instructions
-        mvprintw(USERS_PER_PAGE + 6, 0, "Navigation: 'n' - Next Page, 'p' - Previous Page, 'q' - Quit");
-        refresh();
+        draw_scoreboard_page(manager, current_page, total_pages, current_time);
 
         // Handle input
-        int ch = getch();
+        int ch = input_getch();
         switch (ch) {
             case 'n':
                 if (current_page < total_pages - 1) current_page++;
@@ -378,6 +1057,11 @@ void print_scoreboard(struct UserManager* manager) {
             case 'p':
                 if (current_page > 0) current_page--;
                 break;
+            case 'm':
+                if (manager->current_user) {
+                    current_page = user_rank(manager, manager->current_user) / USERS_PER_PAGE;
+                }
+                break;
             case 'q':
                 running = false;
                 break;
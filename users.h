@@ -1,12 +1,27 @@
 #ifndef USERS_H
 #define USERS_H
 
+#include <stddef.h>
 #include <time.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
-#define MAX_USERS 100
 #define MAX_STRING_LEN 100
 #define USERS_PER_PAGE 10
+#define USERS_CHECKSUM_TAG "crc32c "     // Starts the last line of users.json
+#define USERS_CHECKSUM_FILE "users.json.crc"   // Where older builds kept the checksum
+#define USERS_LOCK_FILE "users.json.lock"
+#define USERS_FLUSH_INTERVAL 30   // Seconds a queued user change may wait
+
+// Fields of struct User, so that a save writes only what this process
+// changed and keeps what other processes wrote to the rest
+#define USER_FIELD_SCORE       0x01
+#define USER_FIELD_GOLD        0x02
+#define USER_FIELD_GAMES       0x04   // games_completed
+#define USER_FIELD_GAME_TIMES  0x08   // first_game_time, last_game_time
+#define USER_FIELD_SETTINGS    0x10   // difficulty, character_color, song, music_on
+#define USER_FIELD_ACCOUNT     0x20   // password, email
+#define USER_FIELDS_ALL        0x3f
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
@@ -39,25 +54,84 @@ struct User {
     int song;
 
     bool music_on;  // default: true (1)
+
+    unsigned dirty; // USER_FIELD_* changed here since last written (not stored)
+};
+
+// Users live in a growable array indexed by an open-addressing hash table on
+// username, plus a leaderboard kept sorted as scores change (change scores
+// through update_user_score). Growing the array moves the users, so pointers into it (other
+// than current_user, which is fixed up) must not be kept across add_user.
+struct UserDb;
+
+// One version of users.json. Writers replace the file by rename, so the
+// same inode, size and mtime mean nothing was written since.
+struct UsersFileStamp {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
 };
 
 struct UserManager {
-    struct User users[MAX_USERS];
-    char usernames[MAX_USERS][MAX_STRING_LEN];
+    struct User* users;
     int user_count;
+    int user_capacity;
+    int* name_index;      // Slots hold user indices, -1 when empty
+    int index_capacity;   // Power of two, kept at most half full
+    int* rank_order;      // User indices sorted by score (leaderboard), user_capacity slots
+    int ranked_count;
+    struct UserDb* db;    // Binary user database, NULL when users.json is the store
+    struct UsersFileStamp json_stamp;   // users.json as last read or written here
+
+    // Changes queued by save_user until the next flush_users
+    int* dirty_users;     // Indices of dirty users
+    int dirty_count;
+    int dirty_capacity;
+    time_t dirty_since;   // When the oldest queued change was made, 0 if none
+    unsigned long writes_requested;   // save_user calls
+    unsigned long writes_issued;      // Records or files actually written
     struct User* current_user;
 };
 
+typedef void (*UserLoadCallback)(const struct User* user, void* context);
+
+// Run around a wait on another process's lock on the user store, so the
+// server can let other sessions play meanwhile (users_set_wait_hooks)
+typedef void (*UserWaitHook)(void);
+
 
 // Function declarations
-struct UserManager* create_user_manager(void);
+struct UserManager* create_user_manager(const char* db_path);
+const char* users_load_error(void);
 void free_user_manager(struct UserManager* manager);
-void load_users_from_json(struct UserManager* manager);
+int find_user_index(const struct UserManager* manager, const char* username);
+struct User* add_user(struct UserManager* manager, const struct User* user);
+struct User* register_user(struct UserManager* manager, const struct User* user);
+struct User* add_user_unranked(struct UserManager* manager, const struct User* user);
+bool rebuild_rankings(struct UserManager* manager);
+void update_user_score(struct UserManager* manager, struct User* user, int score);
+int user_rank(const struct UserManager* manager, const struct User* user);
+struct User* user_at_rank(const struct UserManager* manager, int rank);
+bool import_users_json(struct UserManager* manager, const char* data, size_t length);
+bool load_users_from_json(struct UserManager* manager);
 void save_users_to_json(struct UserManager* manager);
+void export_users_json(struct UserManager* manager);
+void refresh_users(struct UserManager* manager);
+void take_user_fields(struct UserManager* manager, struct User* user, const struct User* stored,
+                      unsigned fields);
+void begin_user_update(struct UserManager* manager, struct User* user);
+void save_user(struct UserManager* manager, struct User* user, unsigned fields);
+void flush_users(struct UserManager* manager);
+void flush_users_if_due(struct UserManager* manager);
+int parse_users_json(const char* data, size_t length, UserLoadCallback on_user, void* context);
 bool authenticate_user(struct UserManager* manager, int index, const char* password);
 void print_users(struct UserManager* manager);
 void print_scoreboard(struct UserManager* manager);
 void handle_file_error(const char* operation);
+void users_set_wait_hooks(UserWaitHook begin, UserWaitHook end);
+void users_wait_begin(void);
+void users_wait_end(void);
 
 
 // Password validation functions